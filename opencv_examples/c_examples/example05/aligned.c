@@ -0,0 +1,82 @@
+/** Filename: aligned.c
+*
+*   Description: images with aligned, padded rows, see aligned.h.
+*/
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opencv/cv.h>
+
+#include "aligned.h"
+
+
+static int validAlign(int align){
+    return align >= 4 && align <= ALIGNED_MAX_BYTES && (align & (align - 1)) == 0;
+}
+
+
+int alignedParse(const char* text, int* align){
+    char* end;
+    long value = strtol(text, &end, 10);
+
+    if(end == text || *end != '\0' || value > ALIGNED_MAX_BYTES || !validAlign((int)value)){
+        return -1;
+    }
+    *align = (int)value;
+    return 0;
+}
+
+
+IplImage* alignedCreateImage(CvSize size, int depth, int channels, int align){
+    if(align == 0){
+        align = ALIGNED_DEFAULT_BYTES;
+    }
+    if(!validAlign(align) || size.width <= 0 || size.height <= 0){
+        return NULL;
+    }
+
+    /** The padded image must still fit the int widthStep and imageSize */
+    int64_t rowBytes = (int64_t)size.width * channels * ((depth & 255) >> 3);
+    int64_t step = (rowBytes + align - 1) & ~(int64_t)(align - 1);
+    if(step * size.height > INT_MAX - align){
+        return NULL;
+    }
+
+    IplImage* img = cvCreateImageHeader(size, depth, channels);
+    if(img == NULL){
+        return NULL;
+    }
+    img->widthStep = (int)step;
+    img->imageSize = (int)(step * size.height);
+
+    /** align - 1 spare bytes are enough to reach the first aligned address */
+    char* origin = (char*)cvAlloc((size_t)img->imageSize + align - 1);
+    if(origin == NULL){
+        cvReleaseImageHeader(&img);
+        return NULL;
+    }
+    img->imageDataOrigin = origin;
+    img->imageData = (char*)(((uintptr_t)origin + align - 1) & ~(uintptr_t)(align - 1));
+    return img;
+}
+
+
+IplImage* alignedCloneImage(const IplImage* src, int align){
+    IplImage* dst = alignedCreateImage(cvSize(src->width, src->height), src->depth, src->nChannels, align);
+    size_t rowBytes = (size_t)src->width * src->nChannels * ((src->depth & 255) >> 3);
+    int row;
+
+    if(dst == NULL){
+        return NULL;
+    }
+    for(row = 0; row < src->height; ++row){
+        memcpy(dst->imageData + (size_t)row * dst->widthStep, src->imageData + (size_t)row * src->widthStep,
+               rowBytes);
+    }
+    if(src->roi != NULL){
+        cvSetImageROI(dst, cvGetImageROI(src));
+    }
+    return dst;
+}
@@ -0,0 +1,40 @@
+/** Filename: aligned.h
+*
+*   Description: images whose rows start on a SIMD or cache line boundary.
+*
+*   cvCreateImage pads each row to a multiple of 4 bytes and cvAlloc aligns the pixels to
+*   16 bytes, so most rows of a color image start part way into a 32 byte vector or a 64
+*   byte cache line, and a kernel's loads straddle two lines. An aligned image pads every
+*   row to a multiple of align bytes and starts the pixels on an align byte boundary, so
+*   every row starts on one; when the row is also a multiple of the kernel's block, no load
+*   or store crosses a line.
+*
+*   The image is an ordinary IplImage: widthStep is the padded row and imageData points
+*   past the start of the allocation, to the first aligned byte, while imageDataOrigin
+*   keeps the address cvAlloc returned. cvReleaseImage frees imageDataOrigin, so an aligned
+*   image is released like any other, and code that indexes rows by widthStep works as it
+*   did.
+*/
+
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <opencv/cv.h>
+
+#define ALIGNED_DEFAULT_BYTES 64        /// a cache line, two AVX2 vectors
+#define ALIGNED_MAX_BYTES 4096
+
+/** Parse an alignment: a power of two from 4 to ALIGNED_MAX_BYTES. Returns 0, or -1 if
+*   text is not one. */
+int alignedParse(const char* text, int* align);
+
+/** Create an image as cvCreateImage does, with every row padded to a multiple of align
+*   bytes and the first row starting on an align byte boundary; 0 stands for
+*   ALIGNED_DEFAULT_BYTES. The pixel values are not initialized. Returns NULL if align is
+*   not a valid alignment or the image is too large. Release it with cvReleaseImage. */
+IplImage* alignedCreateImage(CvSize size, int depth, int channels, int align);
+
+/** Create an aligned copy of src, its pixels and its region of interest */
+IplImage* alignedCloneImage(const IplImage* src, int align);
+
+#endif
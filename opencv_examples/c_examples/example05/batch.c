@@ -0,0 +1,755 @@
+/** Filename: batch.c
+*
+*   Description: batch mode of example05.
+*
+*   Worker threads take the next image name from a shared counter, load the image and
+*   convert it to gray. The time spent loading the image and in the gray conversion is
+*   recorded per thread, so the workers never share a histogram, and the histograms are
+*   merged for the periodic and final reports. With an output directory, each gray image
+*   is written there under the name of its input file.
+*
+*   With regions of interest (-r), a gray image the size of each rectangle is made and all
+*   of them are converted in one pass over the rows they cover; the outputs are named
+*   name_roiN.ext. In place (-I), each color image is converted in its own buffer and no
+*   gray image is allocated.
+*
+*   With NUMA groups (-M), every worker is restricted to the cores of one node and image i
+*   belongs to node i % nodes. A worker loads its images itself, so their pixels are first
+*   touched, and placed, on its node. When a node runs out of images its workers take the
+*   rest of another node's. The images, megapixels per second and images taken from other
+*   nodes are reported per node.
+*
+*   With read-ahead (-R), an ingest stage (ingest.h) reads the files ahead of the workers
+*   and the workers decode the buffers with cvDecodeImage; the time a worker waits for its
+*   file is recorded as "read wait" and is part of "load".
+*
+*   With a cache (-K, cache.h), the worker reads the file itself and looks the hash of its
+*   bytes up before it decodes anything. A hit writes the cached gray images and skips the
+*   decode and the conversion; a miss is converted as usual and then stored. The read, the
+*   hash and the lookup are part of "load".
+*
+*   A threading policy (threading.h) sets the number of workers together with the number
+*   of threads OpenCV may use inside each cvCvtColor call, so the two do not multiply into
+*   more threads than cores.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "cache.h"
+#include "gray.h"
+#include "ingest.h"
+#include "inplace.h"
+#include "latency.h"
+#include "modes.h"
+#include "numa.h"
+#include "pnm.h"
+#include "startup.h"
+#include "threading.h"
+#include "trace.h"
+
+#define BATCH_AUTO_CONVERSIONS 64       /// conversions per candidate when choosing a policy
+#define BATCH_CACHE_VERSION 1           /// part of every cache key; bump when the gray
+                                        /// output changes in a way the settings do not show
+
+
+/** Per-node totals of NUMA groups, updated atomically by the workers */
+typedef struct BatchNode{
+    int workers;
+    int images;
+    int stolen;                 /// images taken from other nodes
+    uint64_t pixels;
+    uint64_t endNs;             /// when the last worker of the node finished
+} BatchNode;
+
+typedef struct Batch{
+    const char* outputDir;
+    const GrayRect* rects;
+    int rectCount;
+    int inPlace;
+    char** images;
+    int count;
+    int next;                   /// index of the next image to claim
+    int failed;
+    int useOpenCV;
+    const GrayConverter* converter;
+    LatencyRecorder load;
+    LatencyRecorder convert;
+    LatencyRecorder wait;
+    Ingest* ingest;             /// NULL unless reading ahead
+    Cache* cache;               /// NULL unless caching
+    uint64_t cacheSeed;         /// the settings the gray images depend on
+    const NumaTopology* topo;   /// NULL unless there are NUMA groups
+    int nodeNext[NUMA_MAX_NODES];       /// next k of node n's images n + k * nodes
+    BatchNode nodes[NUMA_MAX_NODES];
+} Batch;
+
+typedef struct BatchThread{
+    pthread_t thread;
+    Batch* batch;
+    int node;                   /// index into topo->nodes, -1 without NUMA groups
+} BatchThread;
+
+
+/** Write the gray image to outputDir, keeping the file name (and so the format) of the input.
+*   The image of region of interest roi, if not negative, gets _roi<roi> added to its name. */
+static void writeOutput(const char* outputDir, const char* input, int roi, IplImage* gray){
+    char path[4096];
+    const char* base = strrchr(input, '/');
+    base = base != NULL ? base + 1 : input;
+
+    if(roi < 0){
+        snprintf(path, sizeof(path), "%s/%s", outputDir, base);
+    }
+    else{
+        const char* ext = strrchr(base, '.');
+        if(ext == NULL){
+            ext = base + strlen(base);
+        }
+        snprintf(path, sizeof(path), "%s/%.*s_roi%d%s", outputDir, (int)(ext - base), base, roi, ext);
+    }
+
+    uint64_t start = traceClock();
+    if(!pnmSaveGray(path, gray)){
+        printf("File %s not written\n", path);
+    }
+    traceSpanFile("save", start, input);
+}
+
+
+/** Store the count gray images of an image in the cache */
+static void storeCached(const Batch* batch, const CacheKey* key, IplImage* const* grays, int count){
+    GrayImage planes[CACHE_MAX_PLANES];
+    int i;
+
+    if(batch->cache == NULL){
+        return;
+    }
+    for(i = 0; i < count; ++i){
+        planes[i].data = (unsigned char*)grays[i]->imageData;
+        planes[i].width = grays[i]->width;
+        planes[i].height = grays[i]->height;
+        planes[i].channels = grays[i]->nChannels;
+        planes[i].step = grays[i]->widthStep;
+    }
+    cachePut(batch->cache, key, planes, count);
+}
+
+
+/** Convert the regions of interest of colorimg into grays, which have their sizes */
+static int convertRects(const Batch* batch, IplImage* colorimg, IplImage** grays){
+    unsigned char* grayData[MODES_MAX_RECTS];
+    int grayStep[MODES_MAX_RECTS];
+    int i;
+
+    if(batch->useOpenCV){
+        /** cvCvtColor would clip a rectangle reaching outside the image */
+        for(i = 0; i < batch->rectCount; ++i){
+            const GrayRect* r = &batch->rects[i];
+            if(r->x > colorimg->width - r->width || r->y > colorimg->height - r->height){
+                return GRAY_ERR_RECT;
+            }
+        }
+        for(i = 0; i < batch->rectCount; ++i){
+            const GrayRect* r = &batch->rects[i];
+            cvSetImageROI(colorimg, cvRect(r->x, r->y, r->width, r->height));
+            cvCvtColor(colorimg, grays[i], CV_BGR2GRAY);
+        }
+        cvResetImageROI(colorimg);
+        return GRAY_OK;
+    }
+
+    for(i = 0; i < batch->rectCount; ++i){
+        grayData[i] = (unsigned char*)grays[i]->imageData;
+        grayStep[i] = grays[i]->widthStep;
+    }
+    return grayConvertRects((unsigned char*)colorimg->imageData, colorimg->widthStep,
+                            colorimg->width, colorimg->height,
+                            batch->rects, batch->rectCount, grayData, grayStep);
+}
+
+
+/** Batch mode with regions of interest: one gray image per rectangle, stored under key
+*   if there is a cache */
+static int convertImageRects(Batch* batch, const char* name, const CacheKey* key, IplImage* colorimg){
+    IplImage* grays[MODES_MAX_RECTS] = {0};
+    int status = GRAY_OK;
+    int i;
+
+    for(i = 0; i < batch->rectCount; ++i){
+        grays[i] = cvCreateImage(cvSize(batch->rects[i].width, batch->rects[i].height), colorimg->depth, 1);
+        if(grays[i] == NULL){
+            status = GRAY_ERR_NOMEM;
+            break;
+        }
+    }
+
+    if(status == GRAY_OK){
+        status = convertRects(batch, colorimg, grays);
+    }
+
+    if(status == GRAY_OK){
+        startupFirstPixel();
+        if(batch->outputDir != NULL){
+            for(i = 0; i < batch->rectCount; ++i){
+                writeOutput(batch->outputDir, name, i, grays[i]);
+            }
+        }
+        storeCached(batch, key, grays, batch->rectCount);
+    }
+
+    for(i = 0; i < batch->rectCount; ++i){
+        cvReleaseImage(&grays[i]);
+    }
+    return status;
+}
+
+
+/** Read the whole file name into a malloc'd buffer. Returns 0, or -1 with errno set. */
+static int readFile(const char* name, unsigned char** data, size_t* size){
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    size_t done = 0;
+
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, &st) != 0 || (*data = (unsigned char*)malloc(st.st_size > 0 ? (size_t)st.st_size : 1)) == NULL){
+        close(fd);
+        return -1;
+    }
+
+    while(done < (size_t)st.st_size){
+        ssize_t n = read(fd, *data + done, (size_t)st.st_size - done);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+
+    if(done != (size_t)st.st_size){
+        free(*data);
+        errno = EIO;
+        return -1;
+    }
+    *size = done;
+    return 0;
+}
+
+
+/** Load image i. With read-ahead, decode the buffer the ingest stage has read, recording
+*   the time spent waiting for it; with a cache, read the file and look its bytes up first;
+*   otherwise the file is read by pnmLoadColor. On a cache hit NULL is returned and hit
+*   holds the gray images; key is the image's cache key either way. */
+static IplImage* loadImage(Batch* batch, int i, LatencyHistogram* waitHist, CacheKey* key, CacheEntry* hit){
+    unsigned char* data;
+    size_t size;
+    int status;
+
+    memset(hit, 0, sizeof(*hit));
+    if(batch->ingest == NULL && batch->cache == NULL){
+        return pnmLoadColor(batch->images[i]);
+    }
+
+    if(batch->ingest != NULL){
+        uint64_t start = latencyNow();
+        status = ingestTake(batch->ingest, i, &data, &size);
+        latencyRecord(waitHist, latencyNow() - start);
+        traceSpanFile("read wait", start, batch->images[i]);
+    }
+    else{
+        status = readFile(batch->images[i], &data, &size);
+    }
+
+    if(status != 0){
+        printf("File %s not read: %s\n", batch->images[i], strerror(errno));
+        return NULL;
+    }
+
+    if(batch->cache != NULL){
+        uint64_t start = traceClock();
+        *key = cacheKey(data, size, batch->cacheSeed);
+        int found = cacheGet(batch->cache, key, hit);
+        traceSpanFile(found ? "cache hit" : "cache miss", start, batch->images[i]);
+        if(found){
+            free(data);
+            return NULL;
+        }
+    }
+
+    /** A PPM file is copied straight out of the buffer; anything else is decoded by
+    *   OpenCV from the encoded file as a single row of bytes */
+    IplImage* img = pnmIsPnmName(batch->images[i]) ? pnmDecode(data, size) : NULL;
+    if(img == NULL){
+        CvMat buffer = cvMat(1, (int)size, CV_8UC1, data);
+        img = cvDecodeImage(&buffer, CV_LOAD_IMAGE_COLOR);
+    }
+    free(data);
+    return img;
+}
+
+
+/** Write the gray images of a cache hit as if they had just been converted */
+static void writeCached(const Batch* batch, const char* name, const CacheEntry* hit){
+    int i;
+
+    startupFirstPixel();
+    if(batch->outputDir == NULL){
+        return;
+    }
+
+    for(i = 0; i < hit->count; ++i){
+        IplImage* gray = cvCreateImageHeader(cvSize(hit->planes[i].width, hit->planes[i].height), IPL_DEPTH_8U, 1);
+        if(gray == NULL){
+            printf("File %s not written\n", name);
+            return;
+        }
+        cvSetData(gray, hit->planes[i].data, hit->planes[i].step);
+        writeOutput(batch->outputDir, name, batch->rectCount > 0 ? i : -1, gray);
+        cvReleaseImageHeader(&gray);
+    }
+}
+
+
+/** Return the index of the next image for a worker of node, or -1 when none is left */
+static int claimImage(Batch* batch, int node){
+    if(node < 0){
+        int i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        return i < batch->count ? i : -1;
+    }
+
+    /** The worker's own node first, then the others in turn */
+    int nodes = batch->topo->count;
+    int d;
+    for(d = 0; d < nodes; ++d){
+        int n = (node + d) % nodes;
+        if(__atomic_load_n(&batch->nodeNext[n], __ATOMIC_RELAXED) * nodes + n >= batch->count){
+            continue;
+        }
+        int i = n + __atomic_fetch_add(&batch->nodeNext[n], 1, __ATOMIC_RELAXED) * nodes;
+        if(i < batch->count){
+            __atomic_fetch_add(&batch->nodes[node].images, 1, __ATOMIC_RELAXED);
+            if(d > 0){
+                __atomic_fetch_add(&batch->nodes[node].stolen, 1, __ATOMIC_RELAXED);
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static void* batchWorker(void* arg){
+    BatchThread* self = (BatchThread*)arg;
+    Batch* batch = self->batch;
+    LatencyHistogram* loadHist = latencyRecorderThread(&batch->load);
+    LatencyHistogram* convertHist = latencyRecorderThread(&batch->convert);
+    LatencyHistogram* waitHist = latencyRecorderThread(&batch->wait);
+
+    if(loadHist == NULL || convertHist == NULL || waitHist == NULL){
+        printf("No memory allocated for the latency histograms\n");
+        __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    traceThreadName("batch worker");
+
+    if(self->node >= 0 && numaPinToNode(&batch->topo->nodes[self->node]) != 0){
+        printf("Could not restrict a worker to node %d\n", batch->topo->nodes[self->node].id);
+    }
+
+    for(;;){
+        int i = claimImage(batch, self->node);
+        if(i < 0){
+            break;
+        }
+
+        CacheKey key;
+        CacheEntry hit;
+        uint64_t start = latencyNow();
+        IplImage* colorimg = loadImage(batch, i, waitHist, &key, &hit);
+        latencyRecord(loadHist, latencyNow() - start);
+        traceSpanFile("load", start, batch->images[i]);
+
+        if(hit.data != NULL){
+            writeCached(batch, batch->images[i], &hit);
+            cacheEntryFree(&hit);
+            continue;
+        }
+        if(colorimg == NULL){
+            printf("File %s not opened\n", batch->images[i]);
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if(self->node >= 0){
+            __atomic_fetch_add(&batch->nodes[self->node].pixels,
+                               (uint64_t)colorimg->width * (uint64_t)colorimg->height, __ATOMIC_RELAXED);
+        }
+
+        if(batch->inPlace){
+            start = latencyNow();
+            int status = inPlaceGray(colorimg, NULL);
+            latencyRecord(convertHist, latencyNow() - start);
+            traceSpanFile("convert", start, batch->images[i]);
+
+            if(status != GRAY_OK){
+                printf("File %s not converted: %s\n", batch->images[i], grayStatusString(status));
+                __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+            }
+            else{
+                startupFirstPixel();
+                if(batch->outputDir != NULL){
+                    writeOutput(batch->outputDir, batch->images[i], -1, colorimg);
+                }
+                storeCached(batch, &key, &colorimg, 1);
+            }
+            cvReleaseImage(&colorimg);
+            continue;
+        }
+
+        if(batch->rectCount > 0){
+            start = latencyNow();
+            int status = convertImageRects(batch, batch->images[i], &key, colorimg);
+            latencyRecord(convertHist, latencyNow() - start);
+            traceSpanFile("convert", start, batch->images[i]);
+
+            if(status != GRAY_OK){
+                printf("File %s not converted: %s\n", batch->images[i], grayStatusString(status));
+                __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+            }
+            cvReleaseImage(&colorimg);
+            continue;
+        }
+
+        IplImage* mygrayimg = cvCreateImage(cvSize(colorimg->width, colorimg->height), colorimg->depth, 1);
+        if(mygrayimg == NULL){
+            printf("No memory allocated for the gray image of %s\n", batch->images[i]);
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+            cvReleaseImage(&colorimg);
+            continue;
+        }
+
+        /** The gray image is new, so this also times the page faults of its first touch */
+        start = latencyNow();
+        int status = GRAY_OK;
+        if(batch->useOpenCV){
+            cvCvtColor(colorimg, mygrayimg, CV_BGR2GRAY);
+        }
+        else{
+            status = grayConverterConvert(batch->converter,
+                                          (unsigned char*)colorimg->imageData, colorimg->widthStep,
+                                          (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep,
+                                          colorimg->width, colorimg->height);
+        }
+        latencyRecord(convertHist, latencyNow() - start);
+        traceSpanFile("convert", start, batch->images[i]);
+
+        if(status != GRAY_OK){
+            printf("File %s not converted: %s\n", batch->images[i], grayStatusString(status));
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+        else{
+            startupFirstPixel();
+            if(batch->outputDir != NULL){
+                writeOutput(batch->outputDir, batch->images[i], -1, mygrayimg);
+            }
+            storeCached(batch, &key, &mygrayimg, 1);
+        }
+
+        cvReleaseImage(&colorimg);
+        cvReleaseImage(&mygrayimg);
+    }
+
+    if(self->node >= 0){
+        uint64_t now = latencyNow();
+        uint64_t end = __atomic_load_n(&batch->nodes[self->node].endNs, __ATOMIC_RELAXED);
+        while(now > end && !__atomic_compare_exchange_n(&batch->nodes[self->node].endNs, &end, now, 0,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+        }
+    }
+
+    return NULL;
+}
+
+
+/** Print the images and throughput of each node's worker group */
+static void printNodes(const Batch* batch, uint64_t start){
+    int n;
+
+    printf("%-6s %8s %8s %8s %12s\n", "node", "workers", "images", "stolen", "MPix/s");
+    for(n = 0; n < batch->topo->count; ++n){
+        const BatchNode* node = &batch->nodes[n];
+        double seconds = node->endNs > start ? (node->endNs - start) / 1e9 : 0.0;
+        printf("node%-2d %8d %8d %8d %12.1f\n", batch->topo->nodes[n].id, node->workers,
+               node->images, node->stolen, seconds > 0 ? node->pixels / 1e6 / seconds : 0.0);
+    }
+}
+
+
+/** Open the cache given as dir[:megabytes] and compute the seed of this run's settings */
+static int openCache(const Options* opt, Batch* batch){
+    char dir[4096];
+    const char* colon = strrchr(opt->cacheDir, ':');
+    size_t len = strlen(opt->cacheDir);
+    unsigned long long megabytes = CACHE_DEFAULT_MB;
+    char end;
+    int i;
+
+    if(colon != NULL){
+        if(sscanf(colon + 1, "%llu%c", &megabytes, &end) != 1 || megabytes == 0){
+            printf("Bad cache %s, expected dir[:megabytes]\n", opt->cacheDir);
+            return -1;
+        }
+        len = (size_t)(colon - opt->cacheDir);
+    }
+    if(len == 0 || len >= sizeof(dir)){
+        printf("Bad cache %s, expected dir[:megabytes]\n", opt->cacheDir);
+        return -1;
+    }
+    memcpy(dir, opt->cacheDir, len);
+    dir[len] = '\0';
+
+    batch->cache = cacheOpen(dir, (uint64_t)megabytes << 20);
+    if(batch->cache == NULL){
+        printf("Cache %s not opened: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    /** Everything the gray pixels depend on besides the input. In place gives the same
+    *   pixels as a separate gray image, and cvCvtColor should too, but a different OpenCV
+    *   could round differently, so it gets its own entries. */
+    uint64_t settings[5 + 4 * MODES_MAX_RECTS] = {
+        BATCH_CACHE_VERSION, GRAY_SHIFT,
+        (uint64_t)opt->converter.weights.b | (uint64_t)opt->converter.weights.g << 16 |
+        (uint64_t)opt->converter.weights.r << 32,
+        (uint64_t)opt->useOpenCV, (uint64_t)opt->rectCount
+    };
+    for(i = 0; i < opt->rectCount; ++i){
+        settings[5 + 4 * i] = (uint64_t)opt->rects[i].x;
+        settings[6 + 4 * i] = (uint64_t)opt->rects[i].y;
+        settings[7 + 4 * i] = (uint64_t)opt->rects[i].width;
+        settings[8 + 4 * i] = (uint64_t)opt->rects[i].height;
+    }
+    batch->cacheSeed = cacheHash(settings, sizeof(uint64_t) * (5 + 4 * (size_t)opt->rectCount), 0);
+
+    CacheStats stats;
+    cacheStats(batch->cache, &stats);
+    printf("Cache %s: %llu entries, %.1f of %llu MB\n", dir, (unsigned long long)stats.entries,
+           stats.bytes / 1048576.0, megabytes);
+    return 0;
+}
+
+
+static void printCache(Cache* cache){
+    CacheStats stats;
+    cacheStats(cache, &stats);
+
+    uint64_t lookups = stats.hits + stats.misses;
+    printf("cache: %llu hits, %llu misses (%.1f%% hits), %llu stored, %llu evicted, "
+           "%llu entries, %.1f of %.0f MB\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           lookups > 0 ? 100.0 * stats.hits / lookups : 0.0,
+           (unsigned long long)stats.stores, (unsigned long long)stats.evictions,
+           (unsigned long long)stats.entries, stats.bytes / 1048576.0, stats.maxBytes / 1048576.0);
+}
+
+
+/** Time each candidate policy on the first image and return the best */
+static int choosePolicy(const Options* opt, const char* sampleName, int cores, ThreadPolicy* policy){
+    ThreadPolicy candidates[THREADING_MAX_CANDIDATES];
+    ThreadTrial trials[THREADING_MAX_CANDIDATES];
+    int n = threadingCandidates(cores, opt->useOpenCV, candidates);
+    int i;
+
+    IplImage* sample = pnmLoadColor(sampleName);
+    if(sample == NULL){
+        printf("File %s not opened\n", sampleName);
+        return -1;
+    }
+
+    printf("Choosing a threading policy on %s\n", sampleName);
+    threadingPrint(NULL);
+    for(i = 0; i < n; ++i){
+        if(threadingMeasure(&candidates[i], sample, BATCH_AUTO_CONVERSIONS, &trials[i]) != 0){
+            printf("Policy %s could not be measured\n", candidates[i].name);
+            cvReleaseImage(&sample);
+            return -1;
+        }
+        threadingPrint(&trials[i]);
+    }
+    cvReleaseImage(&sample);
+
+    *policy = trials[threadingChoose(trials, n)].policy;
+    return 0;
+}
+
+
+int runBatch(const Options* opt, char** images, int count){
+    Batch batch = {0};
+    BatchThread threads[LATENCY_MAX_THREADS];
+    NumaTopology* topo = NULL;
+    int perNode[NUMA_MAX_NODES];
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = opt->threads;
+    int started, i;
+
+    if(opt->threadPolicy != NULL){
+        ThreadPolicy policy;
+        int isAuto;
+
+        if(threadingParse(opt->threadPolicy, cores, &policy, &isAuto) != 0){
+            printf("Unknown threading policy %s\n", opt->threadPolicy);
+            return -1;
+        }
+        if(isAuto && choosePolicy(opt, images[0], cores, &policy) != 0){
+            return -1;
+        }
+
+        threadingApply(&policy);
+        printf("Threading policy %s: %d workers, %d OpenCV threads\n", policy.name,
+               policy.workers, policy.cvThreads);
+        if(nthreads <= 0){
+            nthreads = policy.workers;
+        }
+    }
+
+    if(opt->numa){
+        topo = (NumaTopology*)malloc(sizeof(NumaTopology));
+        if(topo == NULL || numaTopology(topo) < 0){
+            printf("NUMA topology not found\n");
+            free(topo);
+            return -1;
+        }
+        nthreads = numaSpread(topo, nthreads, count < LATENCY_MAX_THREADS ? count : LATENCY_MAX_THREADS, perNode);
+        batch.topo = topo;
+    }
+
+    if(nthreads <= 0){
+        nthreads = cores;
+    }
+    if(nthreads > count) nthreads = count;
+    if(nthreads > LATENCY_MAX_THREADS) nthreads = LATENCY_MAX_THREADS;
+    if(nthreads < 1) nthreads = 1;
+
+    /** Workers in node order: perNode[0] on the first node, and so on */
+    int n = 0;
+    for(i = 0; i < nthreads; ++i){
+        threads[i].batch = &batch;
+        threads[i].node = -1;
+        if(topo != NULL){
+            while(perNode[n] == 0){
+                ++n;
+            }
+            --perNode[n];
+            threads[i].node = n;
+            ++batch.nodes[n].workers;
+        }
+    }
+
+    batch.outputDir = opt->outputDir;
+    batch.useOpenCV = opt->useOpenCV;
+    batch.converter = &opt->converter;
+    batch.rects = opt->rects;
+    batch.rectCount = opt->rectCount;
+    batch.inPlace = opt->inPlace;
+    batch.images = images;
+    batch.count = count;
+    latencyRecorderInit(&batch.load, "load");
+    latencyRecorderInit(&batch.convert, "convert");
+    latencyRecorderInit(&batch.wait, "read wait");
+
+    if(opt->cacheDir != NULL && openCache(opt, &batch) != 0){
+        free(topo);
+        return -1;
+    }
+
+    int nrecs = 2;
+    if(opt->readAhead != NULL){
+        IngestMethod method;
+        int depth;
+        if(ingestParse(opt->readAhead, &method, &depth) != 0){
+            printf("Bad read-ahead %s\n", opt->readAhead);
+            cacheClose(batch.cache);
+            free(topo);
+            return -1;
+        }
+        batch.ingest = ingestStart(images, count, method, depth);
+        if(batch.ingest == NULL){
+            printf("Could not start reading ahead\n");
+            cacheClose(batch.cache);
+            free(topo);
+            return -1;
+        }
+        printf("Reading ahead %d files with %s\n", depth, ingestMethodName(ingestMethod(batch.ingest)));
+        nrecs = 3;
+    }
+
+    LatencyRecorder* recs[3] = { &batch.load, &batch.convert, &batch.wait };
+    LatencyReporter* reporter = NULL;
+    if(opt->reportSeconds > 0){
+        reporter = latencyReporterStart(recs, nrecs, opt->reportSeconds, stdout);
+    }
+
+    printf("Batch mode: %d images, %d threads", count, nthreads);
+    if(topo != NULL){
+        printf(" in %d NUMA groups", topo->count);
+    }
+    printf("\n");
+    uint64_t start = latencyNow();
+
+    for(started = 0; started < nthreads; ++started){
+        if(pthread_create(&threads[started].thread, NULL, batchWorker, &threads[started]) != 0){
+            break;
+        }
+    }
+    if(started == 0){
+        /** No thread could be started, so do the work on this one; it claims images from
+        *   every node in turn */
+        batchWorker(&threads[0]);
+    }
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    double seconds = (latencyNow() - start) / 1e9;
+    latencyReporterStop(reporter);
+    ingestStop(batch.ingest);
+
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(total != NULL){
+        for(i = 0; i < nrecs; ++i){
+            latencyRecorderSnapshot(recs[i], total);
+            latencyPrint(stdout, recs[i]->name, total);
+            latencyPrintBuckets(stdout, total);
+        }
+        free(total);
+    }
+    printf("%d images in %.3f s, %.1f images/s, %d failed\n", count, seconds,
+           count / seconds, batch.failed);
+    if(topo != NULL){
+        printNodes(&batch, start);
+        free(topo);
+    }
+    if(batch.cache != NULL){
+        printCache(batch.cache);
+        cacheClose(batch.cache);
+    }
+
+    latencyRecorderFree(&batch.load);
+    latencyRecorderFree(&batch.convert);
+    latencyRecorderFree(&batch.wait);
+    return batch.failed == 0 ? 0 : -1;
+}
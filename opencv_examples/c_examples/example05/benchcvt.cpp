@@ -0,0 +1,171 @@
+/** Filename: benchcvt.cpp
+*
+*   Description: throughput of the BGR to gray conversions available to example05.
+*
+*   Usage: ./benchcvt [-n repeats] [-s widthxheight] [imageName]
+*
+*   Converts the same image with each path and prints the median time of repeats runs,
+*   the throughput in megapixels per second and the speedup over the legacy C path:
+*
+*       legacy cvCvtColor   – the C API used by example05.c (OpenCV 2.4 and 3 only)
+*       cv::cvtColor        – the C++ API, SIMD and parallel_for_ inside OpenCV
+*       libgray <kernel>    – our kernels, one thread, for every kernel this CPU runs
+*
+*   Without an image a random image of the given size (default 1920x1080) is used.
+*   Every output is compared with cv::cvtColor's before it is timed.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#if defined(CV_VERSION_EPOCH) || CV_VERSION_MAJOR == 3
+#define BENCH_LEGACY_C_API 1
+#include <opencv2/imgproc/imgproc_c.h>
+#endif
+
+#include "gray.hpp"
+#include "matimage.hpp"
+
+
+/** Median time of repeats calls of convert, in seconds */
+static double medianSeconds(int repeats, const std::function<void()>& convert){
+    std::vector<double> times;
+
+    convert();                                  /// first touch of the output, not timed
+    for(int i = 0; i < repeats; ++i){
+        auto start = std::chrono::steady_clock::now();
+        convert();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+
+static bool sameGray(const cv::Mat& a, const cv::Mat& b){
+    for(int row = 0; row < a.rows; ++row){
+        if(memcmp(a.ptr(row), b.ptr(row), a.cols) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv){
+    int repeats = 50;
+    int width = 1920, height = 1080;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0){
+                    width = 0;
+                }
+                break;
+            default:
+                width = 0;
+                break;
+        }
+    }
+    if(width == 0){
+        printf("Usage: ./benchcvt [-n repeats] [-s widthxheight] [imageName]\n");
+        return -1;
+    }
+    if(repeats < 1){
+        repeats = 1;
+    }
+
+    try{
+        MatImage color;
+        if(optind < argc){
+            color = loadColor(argv[optind]);
+        }
+        else{
+            color = MatImage(height, width, CV_8UC3);
+            for(int row = 0; row < height; ++row){
+                unsigned char* p = color.mat().ptr(row);
+                for(int i = 0; i < 3 * width; ++i){
+                    p[i] = static_cast<unsigned char>(rand());
+                }
+            }
+        }
+
+        const cv::Mat& c = color.mat();
+        double mpix = c.rows * static_cast<double>(c.cols) / 1e6;
+        MatImage reference(c.rows, c.cols, CV_8UC1);
+        MatImage out(c.rows, c.cols, CV_8UC1);
+        cv::Mat& o = out.mat();
+        double legacySeconds = 0;
+
+        cv::cvtColor(c, reference.mat(), cv::COLOR_BGR2GRAY);
+
+        printf("%d x %d, %d repeats, OpenCV threads %d\n", c.cols, c.rows, repeats, cv::getNumThreads());
+        printf("%-22s %10s %10s %8s\n", "path", "ms", "MPix/s", "speedup");
+
+        std::vector<std::pair<const char*, std::function<void()> > > paths;
+
+#ifdef BENCH_LEGACY_C_API
+        /** IplImage headers over the same pixels, as example05.c sees them */
+        IplImage colorHeader, grayHeader;
+        cvInitImageHeader(&colorHeader, cvSize(c.cols, c.rows), IPL_DEPTH_8U, 3, 0, 4);
+        cvSetData(&colorHeader, c.data, static_cast<int>(c.step));
+        cvInitImageHeader(&grayHeader, cvSize(o.cols, o.rows), IPL_DEPTH_8U, 1, 0, 4);
+        cvSetData(&grayHeader, o.data, static_cast<int>(o.step));
+        paths.push_back(std::make_pair("legacy cvCvtColor", std::function<void()>([&]{
+            cvCvtColor(&colorHeader, &grayHeader, CV_BGR2GRAY);
+        })));
+#endif
+
+        paths.push_back(std::make_pair("cv::cvtColor", std::function<void()>([&]{
+            cv::cvtColor(c, o, cv::COLOR_BGR2GRAY);
+        })));
+
+        static char names[GRAY_KERNEL_COUNT][32];
+        for(int k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            GrayKernel kernel = static_cast<GrayKernel>(k);
+            if(!grayKernelSupported(kernel)){
+                continue;
+            }
+            snprintf(names[k], sizeof(names[k]), "libgray %s", grayKernelName(kernel));
+            paths.push_back(std::make_pair(names[k], std::function<void()>([&, kernel]{
+                gray::convert(c.data, static_cast<int>(c.step), o.data, static_cast<int>(o.step),
+                              c.cols, c.rows, kernel);
+            })));
+        }
+
+        for(size_t i = 0; i < paths.size(); ++i){
+            memset(o.data, 0, o.step * o.rows);
+            paths[i].second();
+            if(!sameGray(o, reference.mat())){
+                printf("%-22s output differs from cv::cvtColor\n", paths[i].first);
+            }
+
+            double seconds = medianSeconds(repeats, paths[i].second);
+            if(i == 0){
+                legacySeconds = seconds;
+            }
+            printf("%-22s %10.3f %10.1f %7.2fx\n", paths[i].first, seconds * 1e3, mpix / seconds,
+                   legacySeconds / seconds);
+        }
+    }
+    catch(const std::exception& e){
+        printf("%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
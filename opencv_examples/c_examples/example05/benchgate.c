@@ -0,0 +1,513 @@
+/** Filename: benchgate.c
+*
+*   Description: performance regression gate for the conversion kernels.
+*
+*   Usage: ./benchgate [-r] [-d dir] [-m class] [-n trials] [-k repeats] [-t percent]
+*
+*   Times every conversion (BT.601, BT.709, BT.2020 and linear light) on every kernel this
+*   CPU runs and the conversion has (linear light has only the scalar kernel), on a
+*   1920x1080 image and on a 641x479 one whose rows are not a multiple of any SIMD block.
+*   A trial of a benchmark is the median of repeats conversions (default 9); trials runs
+*   (default 20) are made of every benchmark in turn, so a burst of noise is spread over
+*   all of them instead of ruining one.
+*
+*   Every trial also times a reference work that does not depend on libgray: a plain C
+*   BT.601 conversion of the 1920x1080 image compiled into benchgate, which does the same
+*   mix of loads, multiplies and stores as the kernels. Each benchmark's time is divided
+*   by the reference time of its trial. A machine that is slower as a whole, from
+*   frequency scaling or a noisy neighbour on a virtual machine, slows both alike, so the
+*   relative times are what is compared; the reference time itself is printed as the
+*   machine's speed against the baseline. (On a virtual machine whose speed wandered by
+*   up to 30% between runs, a memcpy or a hash loop as the reference did not follow the
+*   conversions and failed the gate on unchanged code; this one did.)
+*
+*   -r  record: write the results as the baseline of this machine class, the file
+*       dir/class.txt (dir defaults to baselines). The class is the CPU model from
+*       /proc/cpuinfo with every run of other characters than letters and digits made one _,
+*       or the name given with -m, so machines of one class share a baseline.
+*
+*   Without -r the results are compared with the baseline. The change of each benchmark
+*   is given with its 95% confidence interval (Welch's t interval of the difference of the
+*   two mean relative times). A benchmark has
+*
+*       regressed   if the whole interval is slower than the baseline by more than
+*                   percent (default 5), so noise alone is very unlikely to fail the gate
+*       slower      if the whole interval is slower, by less than percent
+*       faster      if the whole interval is faster
+*       ok          otherwise: no change the trials can tell from noise
+*
+*   Exit status: 0 if nothing regressed, 1 if something did, and -1 (255) if the baseline
+*   cannot be read or written or is missing a benchmark. A kernel the baseline has that
+*   this CPU does not run is reported and skipped.
+*
+*   Needs no OpenCV: make benchgate; make bench-gate runs it against baselines/.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gray.h"
+#include "latency.h"
+
+#define MAX_BENCHES 64
+#define MAX_TRIALS 1000
+#define MAX_NAME 64
+#define MAX_CLASS 128
+#define REFERENCE_NAME "reference"
+
+typedef enum Conversion{
+    CONVERSION_BT601 = 0,               /// the first three are GrayStandard values
+    CONVERSION_BT709,
+    CONVERSION_BT2020,
+    CONVERSION_LINEAR,
+    CONVERSION_COUNT
+} Conversion;
+
+static const char* const conversionNames[CONVERSION_COUNT] = { "bt601", "bt709", "bt2020", "linear" };
+
+typedef struct Size{
+    int width;
+    int height;
+} Size;
+
+static const Size sizes[2] = { { 1920, 1080 }, { 641, 479 } };
+
+/** Read from the reference work's output, so the compiler cannot drop it */
+static volatile unsigned char referenceSink;
+
+/** One benchmark: its results, or a baseline's */
+typedef struct Bench{
+    char name[MAX_NAME];        /// conversion/kernel/widthxheight
+    Conversion conversion;
+    GrayKernel kernel;
+    int size;                   /// index into sizes
+    double ms;                  /// mean time of the trials
+    double mean;                /// mean time relative to the reference work of the same trial
+    double sd;                  /// of the relative times
+    int trials;
+} Bench;
+
+
+/** The 97.5% quantile of Student's t distribution with df degrees of freedom */
+static double tQuantile(double df){
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    if(df < 1){
+        df = 1;
+    }
+    if(df <= 30){
+        return table[(int)df - 1];
+    }
+    return df <= 60 ? 2.021 : df <= 120 ? 2.000 : 1.960;
+}
+
+
+/** The machine class: the CPU model with runs of other characters than letters and
+*   digits made one _, "unknown" if /proc/cpuinfo has none */
+static void machineClass(char* name, size_t size){
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    char line[512];
+    const char* model = NULL;
+
+    snprintf(name, size, "unknown");
+    if(f == NULL){
+        return;
+    }
+    while(fgets(line, sizeof(line), f) != NULL){
+        if(strncmp(line, "model name", 10) == 0 || strncmp(line, "Model", 5) == 0){
+            model = strchr(line, ':');
+            break;
+        }
+    }
+    fclose(f);
+    if(model == NULL){
+        return;
+    }
+
+    size_t n = 0;
+    int underscore = 1;
+    for(++model; *model != '\0' && n + 1 < size; ++model){
+        if(isalnum((unsigned char)*model)){
+            name[n++] = *model;
+            underscore = 0;
+        }
+        else if(!underscore){
+            name[n++] = '_';
+            underscore = 1;
+        }
+    }
+    while(n > 0 && name[n - 1] == '_'){
+        --n;
+    }
+    name[n] = '\0';
+    if(n == 0){
+        snprintf(name, size, "unknown");
+    }
+}
+
+
+/** The reference work: BT.601 gray in plain C, compiled here rather than in libgray so
+*   no change to libgray changes it */
+static void referenceWork(const unsigned char* color, int colorStep, unsigned char* gray, int grayStep,
+                          int width, int height){
+    int row, col;
+
+    for(row = 0; row < height; ++row){
+        const unsigned char* p = color + (size_t)row * colorStep;
+        unsigned char* q = gray + (size_t)row * grayStep;
+        for(col = 0; col < width; ++col){
+            q[col] = (unsigned char)((GRAY_WEIGHT_B * p[3 * col] + GRAY_WEIGHT_G * p[3 * col + 1] +
+                                      GRAY_WEIGHT_R * p[3 * col + 2] + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+        }
+    }
+}
+
+
+static int convert(const Bench* bench, const GrayConverter* converters, const unsigned char* color,
+                   int colorStep, unsigned char* gray, int grayStep){
+    const Size* s = &sizes[bench->size];
+
+    if(bench->conversion == CONVERSION_LINEAR){
+        return grayConvertLinearWith(bench->kernel, color, colorStep, gray, grayStep, s->width, s->height);
+    }
+    return grayConverterConvert(&converters[bench->conversion * GRAY_KERNEL_COUNT + bench->kernel],
+                                color, colorStep, gray, grayStep, s->width, s->height);
+}
+
+
+/** Set up one benchmark per conversion, supported kernel and size. A kernel the
+*   conversion runs as another one (linear light has only the scalar kernel) is left out,
+*   as it would time the other kernel again. */
+static int listBenches(Bench* benches){
+    int n = 0;
+    int c, k, s;
+
+    for(c = 0; c < CONVERSION_COUNT; ++c){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            if(!grayKernelSupported((GrayKernel)k) ||
+               (c == CONVERSION_LINEAR && grayLinearKernel((GrayKernel)k) != (GrayKernel)k)){
+                continue;
+            }
+            for(s = 0; s < 2; ++s){
+                Bench* b = &benches[n++];
+                memset(b, 0, sizeof(*b));
+                b->conversion = (Conversion)c;
+                b->kernel = (GrayKernel)k;
+                b->size = s;
+                snprintf(b->name, sizeof(b->name), "%s/%s/%dx%d", conversionNames[c],
+                         grayKernelName((GrayKernel)k), sizes[s].width, sizes[s].height);
+            }
+        }
+    }
+    return n;
+}
+
+
+/** Mean and sample standard deviation of n values */
+static void meanSd(const double* values, int n, double* mean, double* sd){
+    double sum = 0, squares = 0;
+    int i;
+
+    for(i = 0; i < n; ++i){
+        sum += values[i];
+    }
+    *mean = sum / n;
+    for(i = 0; i < n; ++i){
+        squares += (values[i] - *mean) * (values[i] - *mean);
+    }
+    *sd = n > 1 ? sqrt(squares / (n - 1)) : 0;
+}
+
+
+/** Run the trials of every benchmark. The reference work's results go in reference. */
+static int runBenches(Bench* benches, int count, Bench* reference, int trials, int repeats){
+    const Size* big = &sizes[0];
+    int colorStep = (3 * big->width + 3) & ~3;
+    int grayStep = (big->width + 3) & ~3;
+    unsigned char* color = (unsigned char*)malloc((size_t)colorStep * big->height);
+    unsigned char* gray = (unsigned char*)malloc((size_t)grayStep * big->height);
+    unsigned char* referenceGray = (unsigned char*)malloc((size_t)grayStep * big->height);
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    double* ms = (double*)malloc((size_t)(count + 1) * trials * sizeof(*ms));
+    double* relative = (double*)malloc((size_t)trials * sizeof(*relative));
+    GrayConverter converters[CONVERSION_LINEAR * GRAY_KERNEL_COUNT];
+    unsigned seed = 1;
+    int b, t, r, k, c;
+
+    if(color == NULL || gray == NULL || referenceGray == NULL || times == NULL || ms == NULL || relative == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        free(referenceGray);
+        free(times);
+        free(ms);
+        free(relative);
+        return -1;
+    }
+    latencyFillRandom(color, (size_t)colorStep * big->height, &seed);
+    for(c = 0; c < CONVERSION_LINEAR; ++c){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            grayConverterInit(&converters[c * GRAY_KERNEL_COUNT + k], (GrayStandard)c, NULL,
+                              grayKernelSupported((GrayKernel)k) ? (GrayKernel)k : GRAY_KERNEL_SCALAR);
+        }
+    }
+
+    /** The smaller image uses the top left of the larger one, with the same steps. One
+    *   conversion of each first builds the linear tables and touches the gray images. */
+    referenceWork(color, colorStep, referenceGray, grayStep, big->width, big->height);
+    for(b = 0; b < count; ++b){
+        convert(&benches[b], converters, color, colorStep, gray, grayStep);
+    }
+
+    /** Row count of ms holds the reference work */
+    for(t = 0; t < trials; ++t){
+        for(b = 0; b <= count; ++b){
+            for(r = 0; r < repeats; ++r){
+                uint64_t start = latencyNow();
+                if(b == count){
+                    referenceWork(color, colorStep, referenceGray, grayStep, big->width, big->height);
+                    referenceSink = referenceGray[r];
+                }
+                else{
+                    convert(&benches[b], converters, color, colorStep, gray, grayStep);
+                }
+                times[r] = latencyNow() - start;
+            }
+            ms[b * trials + t] = latencyMedian(times, repeats) / 1e6;
+        }
+    }
+
+    const double* referenceMs = ms + (size_t)count * trials;
+    for(b = 0; b <= count; ++b){
+        Bench* bench = b < count ? &benches[b] : reference;
+        double sd;
+        for(t = 0; t < trials; ++t){
+            relative[t] = ms[b * trials + t] / referenceMs[t];
+        }
+        meanSd(ms + (size_t)b * trials, trials, &bench->ms, &sd);
+        meanSd(relative, trials, &bench->mean, &bench->sd);
+        bench->trials = trials;
+    }
+    snprintf(reference->name, sizeof(reference->name), REFERENCE_NAME);
+
+    free(color);
+    free(gray);
+    free(referenceGray);
+    free(times);
+    free(ms);
+    free(relative);
+    return 0;
+}
+
+
+static int writeBaseline(const char* path, const char* cls, const Bench* benches, int count,
+                         const Bench* reference){
+    FILE* f = fopen(path, "w");
+    int b;
+
+    if(f == NULL){
+        printf("Baseline %s not written: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# benchgate baseline for %s\n", cls);
+    fprintf(f, "# name mean_ms relative_mean relative_sd trials\n");
+    for(b = 0; b <= count; ++b){
+        const Bench* bench = b < count ? &benches[b] : reference;
+        fprintf(f, "%s %.6f %.6f %.6f %d\n", bench->name, bench->ms, bench->mean, bench->sd, bench->trials);
+    }
+    if(fclose(f) != 0){
+        printf("Baseline %s not written: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+/** Read a baseline into base. Returns the number of benchmarks, the reference work
+*   included, or -1. */
+static int readBaseline(const char* path, Bench* base){
+    FILE* f = fopen(path, "r");
+    char line[256];
+    int n = 0;
+
+    if(f == NULL){
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL && n < MAX_BENCHES){
+        Bench* b = &base[n];
+        if(line[0] == '#' || line[0] == '\n'){
+            continue;
+        }
+        if(sscanf(line, "%63s %lf %lf %lf %d", b->name, &b->ms, &b->mean, &b->sd, &b->trials) != 5 ||
+           b->ms <= 0 || b->mean <= 0 || b->trials < 2){
+            printf("Bad baseline line in %s: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        ++n;
+    }
+    fclose(f);
+    return n;
+}
+
+
+static const Bench* findBench(const Bench* benches, int count, const char* name){
+    int b;
+    for(b = 0; b < count; ++b){
+        if(strcmp(benches[b].name, name) == 0){
+            return &benches[b];
+        }
+    }
+    return NULL;
+}
+
+
+/** Compare with the baseline. Returns the number of regressions, or -1. */
+static int compare(const Bench* benches, int count, const Bench* reference, const Bench* base,
+                   int baseCount, double threshold){
+    const Bench* oldReference = findBench(base, baseCount, REFERENCE_NAME);
+    int regressed = 0, missing = 0;
+    int b;
+
+    if(oldReference == NULL){
+        printf("The baseline has no %s line; record it again with -r\n", REFERENCE_NAME);
+        return -1;
+    }
+    printf("Machine speed: reference work %.3f ms, %.3f ms in the baseline (%+.1f%%), "
+           "taken out of the changes below\n", reference->ms, oldReference->ms,
+           100 * (reference->ms - oldReference->ms) / oldReference->ms);
+    printf("%-24s %12s %12s %8s %19s  %s\n", "benchmark", "baseline ms", "now ms", "change",
+           "95% interval", "verdict");
+
+    for(b = 0; b < count; ++b){
+        const Bench* now = &benches[b];
+        const Bench* old = findBench(base, baseCount, now->name);
+        if(old == NULL){
+            printf("%-24s not in the baseline; record it again with -r\n", now->name);
+            ++missing;
+            continue;
+        }
+
+        /** Welch's interval for the difference of the mean relative times, as a share of
+        *   the baseline's */
+        double vNow = now->sd * now->sd / now->trials;
+        double vOld = old->sd * old->sd / old->trials;
+        double se = sqrt(vNow + vOld);
+        double df = se > 0 ? (vNow + vOld) * (vNow + vOld) /
+                             (vNow * vNow / (now->trials - 1) + vOld * vOld / (old->trials - 1)) : 1e9;
+        double diff = now->mean - old->mean;
+        double half = tQuantile(df) * se;
+        double low = 100 * (diff - half) / old->mean;
+        double high = 100 * (diff + half) / old->mean;
+
+        const char* verdict = "ok";
+        if(low > threshold){
+            verdict = "REGRESSED";
+            ++regressed;
+        }
+        else if(low > 0){
+            verdict = "slower";
+        }
+        else if(high < 0){
+            verdict = "faster";
+        }
+
+        char interval[32];
+        snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", low, high);
+        printf("%-24s %12.3f %12.3f %+7.1f%% %19s  %s\n", now->name, old->ms, now->ms,
+               100 * diff / old->mean, interval, verdict);
+    }
+
+    for(b = 0; b < baseCount; ++b){
+        if(&base[b] != oldReference && findBench(benches, count, base[b].name) == NULL){
+            printf("%-24s in the baseline, not run on this CPU\n", base[b].name);
+        }
+    }
+    return missing > 0 ? -1 : regressed;
+}
+
+
+int main(int argc, char** argv){
+    const char* dir = "baselines";
+    const char* classArg = NULL;
+    int record = 0, trials = 20, repeats = 9;
+    double threshold = 5;
+    int opt;
+
+    while((opt = getopt(argc, argv, "rd:m:n:k:t:")) != -1){
+        switch(opt){
+            case 'r': record = 1; break;
+            case 'd': dir = optarg; break;
+            case 'm': classArg = optarg; break;
+            case 'n': trials = atoi(optarg); break;
+            case 'k': repeats = atoi(optarg); break;
+            case 't': threshold = atof(optarg); break;
+            default: trials = 0; break;
+        }
+    }
+    if(trials < 2 || trials > MAX_TRIALS || repeats < 1 || threshold < 0 || optind < argc){
+        printf("Usage: ./benchgate [-r] [-d dir] [-m class] [-n trials] [-k repeats] [-t percent]\n");
+        return -1;
+    }
+
+    char cls[MAX_CLASS], path[4096];
+    if(classArg != NULL){
+        snprintf(cls, sizeof(cls), "%s", classArg);
+    }
+    else{
+        machineClass(cls, sizeof(cls));
+    }
+    snprintf(path, sizeof(path), "%s/%s.txt", dir, cls);
+
+    Bench base[MAX_BENCHES];
+    int baseCount = 0;
+    if(!record){
+        baseCount = readBaseline(path, base);
+        if(baseCount < 0){
+            printf("No baseline %s for this machine class; record one with ./benchgate -r\n", path);
+            return -1;
+        }
+    }
+
+    Bench benches[MAX_BENCHES], reference;
+    int count = listBenches(benches);
+    printf("Machine class %s: %d benchmarks, %d trials of the median of %d conversions\n",
+           cls, count, trials, repeats);
+    if(runBenches(benches, count, &reference, trials, repeats) != 0){
+        return -1;
+    }
+
+    if(record){
+        if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+            printf("Directory %s not created: %s\n", dir, strerror(errno));
+            return -1;
+        }
+        if(writeBaseline(path, cls, benches, count, &reference) != 0){
+            return -1;
+        }
+        printf("Baseline written to %s\n", path);
+        return 0;
+    }
+
+    int regressed = compare(benches, count, &reference, base, baseCount, threshold);
+    if(regressed < 0){
+        return -1;
+    }
+    if(regressed > 0){
+        printf("%d of %d benchmarks regressed by more than %.1f%% against %s\n", regressed, count,
+               threshold, path);
+        return 1;
+    }
+    printf("No regression beyond %.1f%% against %s\n", threshold, path);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/** Filename: benchhuge.c
+*
+*   Description: 4 KB versus huge page image buffers.
+*
+*   Usage: ./benchhuge [-n repeats] [-s widthxheight] [imageName]
+*
+*   For each page mode of hugepage.h, maps a color and a gray buffer and measures
+*
+*       fault ms      clearing the color and gray buffers, which touches every page for
+*                     the first time and so takes every page fault
+*       faults        the minor page faults counted by getrusage during that
+*       first ms      the first conversion, into a fresh gray buffer that was never touched
+*       convert ms    the median of repeats conversions on the touched buffers
+*       huge MB       memory backed by huge pages while the buffers are mapped
+*
+*   Without an image a random image of the given size (default 12000x9000, 108
+*   megapixels) is used. hugetlb needs reserved pages, e.g. as root
+*   echo 400 > /proc/sys/vm/nr_hugepages; otherwise it falls back to thp.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "gray.h"
+#include "hugepage.h"
+#include "latency.h"
+
+
+static long minorFaults(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+
+/** Fill a color buffer from the source image, or with random bytes without one */
+static void fillColor(unsigned char* color, int step, int height, const IplImage* source){
+    int row;
+    unsigned seed = 1;
+
+    for(row = 0; row < height; ++row){
+        unsigned char* p = color + (size_t)row * step;
+        if(source != NULL){
+            memcpy(p, source->imageData + (size_t)row * source->widthStep, (size_t)step);
+        }
+        else{
+            latencyFillRandom(p, (size_t)step, &seed);
+        }
+    }
+}
+
+
+static int benchMode(HugePageMode mode, int width, int height, int repeats, const IplImage* source){
+    int colorStep = (3 * width + 3) & ~3;
+    int grayStep = (width + 3) & ~3;
+    size_t colorSize = (size_t)colorStep * height;
+    size_t graySize = (size_t)grayStep * height;
+    HugePageMode colorGot, grayGot, freshGot;
+
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    unsigned char* color = (unsigned char*)hugePageAlloc(colorSize, mode, &colorGot);
+    unsigned char* gray = (unsigned char*)hugePageAlloc(graySize, mode, &grayGot);
+    unsigned char* fresh = (unsigned char*)hugePageAlloc(graySize, mode, &freshGot);
+    if(times == NULL || color == NULL || gray == NULL || fresh == NULL){
+        printf("%-8s out of memory\n", hugePageModeName(mode));
+        free(times);
+        hugePageFree(color, colorSize);
+        hugePageFree(gray, graySize);
+        hugePageFree(fresh, graySize);
+        return -1;
+    }
+
+    long faults = minorFaults();
+    uint64_t start = latencyNow();
+    memset(color, 0, colorSize);
+    memset(gray, 0, graySize);
+    uint64_t faultNs = latencyNow() - start;
+    faults = minorFaults() - faults;
+
+    fillColor(color, colorStep, height, source);
+
+    start = latencyNow();
+    grayConvert(color, colorStep, fresh, grayStep, width, height);
+    uint64_t firstNs = latencyNow() - start;
+
+    int i;
+    for(i = 0; i < repeats; ++i){
+        start = latencyNow();
+        grayConvert(color, colorStep, gray, grayStep, width, height);
+        times[i] = latencyNow() - start;
+    }
+    uint64_t medianNs = latencyMedian(times, repeats);
+
+    long hugeKB = hugePageResidentKB();
+    printf("%-8s %-8s %10.1f %10ld %10.1f %10.2f %8.0f\n", hugePageModeName(mode),
+           hugePageModeName(colorGot), faultNs / 1e6, faults, firstNs / 1e6,
+           medianNs / 1e6, hugeKB >= 0 ? hugeKB / 1024.0 : -1.0);
+
+    free(times);
+    hugePageFree(color, colorSize);
+    hugePageFree(gray, graySize);
+    hugePageFree(fresh, graySize);
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    int repeats = 10;
+    int width = 12000, height = 9000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &width, &height) != 0){
+                    width = 0;
+                }
+                break;
+            default: width = 0; break;
+        }
+    }
+    if(width == 0 || repeats < 1){
+        printf("Usage: ./benchhuge [-n repeats] [-s widthxheight] [imageName]\n");
+        return -1;
+    }
+
+    IplImage* source = NULL;
+    if(optind < argc){
+        source = cvLoadImage(argv[optind], 1);
+        if(source == NULL){
+            printf("File %s not opened\n", argv[optind]);
+            return -1;
+        }
+        width = source->width;
+        height = source->height;
+    }
+
+    printf("%d x %d (%.1f megapixels), %s kernel, median of %d conversions\n", width, height,
+           width * (double)height / 1e6, grayKernelName(grayKernelBest()), repeats);
+    printf("%-8s %-8s %10s %10s %10s %10s %8s\n", "asked", "got", "fault ms", "faults",
+           "first ms", "convert ms", "huge MB");
+
+    int status = 0;
+    HugePageMode mode;
+    for(mode = HUGEPAGE_OFF; mode <= HUGEPAGE_HUGETLB; mode = (HugePageMode)(mode + 1)){
+        if(benchMode(mode, width, height, repeats, source) != 0){
+            status = -1;
+        }
+    }
+
+    if(source != NULL){
+        cvReleaseImage(&source);
+    }
+    return status;
+}
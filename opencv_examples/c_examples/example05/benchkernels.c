@@ -0,0 +1,217 @@
+/** Filename: benchkernels.c
+*
+*   Description: throughput of the conversion kernels by image width, row padding and
+*   buffer alignment.
+*
+*   Usage: ./benchkernels [-n repeats] [-k kernels] [-w widths] [-p paddings] [-a offsets]
+*
+*   Every list is comma separated. For each kernel, width and padding an image of about a
+*   megapixel (fewer rows if the padded color image would be larger than 16 MB) is
+*   converted with grayConvertWith, the color and gray buffers starting offset bytes past
+*   a 64 byte boundary. Printed is the median throughput of repeats conversions in
+*   megapixels per second, one column per offset.
+*
+*       kernels     scalar, ssse3, avx2 (default: all this CPU runs)
+*       widths      pixels per row (default 1,3,15,16,17,31,32,33,63,64,65,641,1920); a
+*                   width one past a multiple of 16 or 32 shows the cost of the scalar
+*                   tail, which SSSE3 leaves for up to 15 pixels and AVX2 for up to 31
+*       paddings    rows are padded to a multiple of this many bytes (default 1,4,64):
+*                   1 packs the rows, 4 is cvCreateImage's widthStep and 64 starts every
+*                   row on a cache line when the offset is 0
+*       offsets     bytes past a 64 byte boundary (default 0,1,4,16,32); the kernels load
+*                   and store unaligned, so this shows what a misaligned buffer costs them
+*
+*   The buffers are converted once before timing, so page faults stay out of it; the
+*   unpadded color image of about 3 MB fits in the L3 cache of most x86 CPUs.
+*
+*   Needs no OpenCV: make benchkernels
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gray.h"
+#include "latency.h"
+
+#define MAX_LIST 32
+#define TARGET_PIXELS (1 << 20)         /// pixels per conversion
+#define MAX_COLOR_BYTES (16 << 20)      /// fewer rows if padding makes them larger
+#define BASE_ALIGN 64
+
+typedef struct IntList{
+    int count;
+    int values[MAX_LIST];
+} IntList;
+
+
+/** Parse a comma separated list of numbers from min to max. Returns -1 if it is not one. */
+static int parseList(const char* text, int min, int max, IntList* list){
+    const char* p = text;
+
+    list->count = 0;
+    while(*p != '\0'){
+        char* end;
+        long value = strtol(p, &end, 10);
+        if(end == p || value < min || value > max || list->count == MAX_LIST ||
+           (*end != ',' && *end != '\0')){
+            return -1;
+        }
+        list->values[list->count++] = (int)value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+
+/** Parse a comma separated list of kernel names */
+static int parseKernels(const char* text, IntList* list){
+    char copy[256];
+    char* save = NULL;
+    char* name;
+
+    snprintf(copy, sizeof(copy), "%s", text);
+    list->count = 0;
+    for(name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)){
+        int k;
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            if(strcmp(name, grayKernelName((GrayKernel)k)) == 0){
+                break;
+            }
+        }
+        if(k == GRAY_KERNEL_COUNT || list->count == MAX_LIST){
+            return -1;
+        }
+        if(!grayKernelSupported((GrayKernel)k)){
+            printf("This CPU does not run the %s kernel\n", name);
+            return -1;
+        }
+        list->values[list->count++] = k;
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+
+static int roundUp(int bytes, int multiple){
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+
+/** Median megapixels per second of repeats conversions */
+static double timeConvert(GrayKernel kernel, const unsigned char* color, int colorStep,
+                          unsigned char* gray, int grayStep, int width, int height,
+                          uint64_t* times, int repeats){
+    int r;
+
+    grayConvertWith(kernel, color, colorStep, gray, grayStep, width, height);
+    for(r = 0; r < repeats; ++r){
+        uint64_t start = latencyNow();
+        grayConvertWith(kernel, color, colorStep, gray, grayStep, width, height);
+        times[r] = latencyNow() - start;
+    }
+    return width * (double)height / (latencyMedian(times, repeats) / 1e3);
+}
+
+
+static int benchKernel(GrayKernel kernel, const IntList* widths, const IntList* paddings,
+                       const IntList* offsets, uint64_t* times, int repeats){
+    int w, p, a;
+
+    printf("\n%s, MPix/s (median of %d) by offset from a %d byte boundary\n",
+           grayKernelName(kernel), repeats, BASE_ALIGN);
+    printf("%6s %4s %8s %8s", "width", "pad", "step", "rows");
+    for(a = 0; a < offsets->count; ++a){
+        printf(" %7s%-2d", "+", offsets->values[a]);
+    }
+    printf("\n");
+
+    for(w = 0; w < widths->count; ++w){
+        int width = widths->values[w];
+
+        for(p = 0; p < paddings->count; ++p){
+            int colorStep = roundUp(3 * width, paddings->values[p]);
+            int grayStep = roundUp(width, paddings->values[p]);
+            int height = TARGET_PIXELS / width;
+            if(height > MAX_COLOR_BYTES / colorStep){
+                height = MAX_COLOR_BYTES / colorStep;
+            }
+            if(height < 1){
+                height = 1;
+            }
+
+            /** Room for the largest offset; aligned_alloc wants a multiple of the alignment */
+            size_t colorBytes = (size_t)roundUp(colorStep * height + BASE_ALIGN, BASE_ALIGN);
+            size_t grayBytes = (size_t)roundUp(grayStep * height + BASE_ALIGN, BASE_ALIGN);
+            unsigned char* color = (unsigned char*)aligned_alloc(BASE_ALIGN, colorBytes);
+            unsigned char* gray = (unsigned char*)aligned_alloc(BASE_ALIGN, grayBytes);
+            unsigned seed = 1;
+
+            if(color == NULL || gray == NULL){
+                printf("Out of memory\n");
+                free(color);
+                free(gray);
+                return -1;
+            }
+            latencyFillRandom(color, colorBytes, &seed);
+
+            printf("%6d %4d %8d %8d", width, paddings->values[p], colorStep, height);
+            for(a = 0; a < offsets->count; ++a){
+                int offset = offsets->values[a];
+                printf(" %9.1f", timeConvert(kernel, color + offset, colorStep, gray + offset, grayStep,
+                                             width, height, times, repeats));
+            }
+            printf("\n");
+
+            free(color);
+            free(gray);
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    IntList kernels = { 0, { 0 } };
+    IntList widths = { 13, { 1, 3, 15, 16, 17, 31, 32, 33, 63, 64, 65, 641, 1920 } };
+    IntList paddings = { 3, { 1, 4, 64 } };
+    IntList offsets = { 5, { 0, 1, 4, 16, 32 } };
+    int repeats = 15;
+    int bad = 0;
+    int opt, k;
+
+    for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+        if(grayKernelSupported((GrayKernel)k)){
+            kernels.values[kernels.count++] = k;
+        }
+    }
+
+    while((opt = getopt(argc, argv, "n:k:w:p:a:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 'k': bad |= parseKernels(optarg, &kernels); break;
+            case 'w': bad |= parseList(optarg, 1, 1 << 16, &widths); break;
+            case 'p': bad |= parseList(optarg, 1, 4096, &paddings); break;
+            case 'a': bad |= parseList(optarg, 0, BASE_ALIGN - 1, &offsets); break;
+            default: bad = -1; break;
+        }
+    }
+    if(bad != 0 || repeats < 1 || optind < argc){
+        printf("Usage: ./benchkernels [-n repeats] [-k kernels] [-w widths] [-p paddings] [-a offsets]\n");
+        return -1;
+    }
+
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    if(times == NULL){
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    int status = 0;
+    for(k = 0; k < kernels.count && status == 0; ++k){
+        status = benchKernel((GrayKernel)kernels.values[k], &widths, &paddings, &offsets, times, repeats);
+    }
+
+    free(times);
+    return status;
+}
@@ -0,0 +1,238 @@
+/** Filename: benchlinear.c
+*
+*   Description: accuracy and throughput of the linear-light conversion.
+*
+*   Usage: ./benchlinear [-n repeats] [-s widthxheight]
+*
+*   Accuracy: an image holding each of the 2^24 BGR colors once is converted by every
+*   kernel of grayConvertLinear and of the plain grayConvert, and each gray byte is
+*   compared with the linear-light gray computed in doubles with pow. Printed are the
+*   largest difference in gray levels, the share of colors that differ at all and the
+*   mean difference. The plain rows show how far the gamma encoded formula is from the
+*   luminance in linear light.
+*
+*   Throughput: a random image of the given size (default 1920x1080) is converted by
+*   every kernel of both conversions; printed are the median time of repeats runs, the
+*   megapixels and frames per second and the time relative to the fastest plain kernel,
+*   which is what the plain conversion costs example05.
+*
+*   Needs no OpenCV: make benchlinear
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gray.h"
+#include "latency.h"
+
+#define ALL_COLORS_SIDE 4096            /// 4096 x 4096 pixels, one of each color
+
+typedef int (*ConvertFunction)(GrayKernel kernel, const unsigned char* colorData, int colorStep,
+                               unsigned char* grayData, int grayStep, int width, int height);
+
+typedef struct Path{
+    const char* mode;
+    ConvertFunction convert;
+} Path;
+
+static const Path paths[2] = {
+    { "plain", grayConvertWith },
+    { "linear", grayConvertLinearWith }
+};
+
+
+/** Whether path p runs kernel k: supported, and for linear light not mapped to another */
+static int runsKernel(int p, int k){
+    return grayKernelSupported((GrayKernel)k) &&
+           (paths[p].convert != grayConvertLinearWith || grayLinearKernel((GrayKernel)k) == (GrayKernel)k);
+}
+
+
+static double srgbDecode(double v){
+    return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+
+static double srgbEncode(double y){
+    return y <= 0.0031308 ? y * 12.92 : 1.055 * pow(y, 1 / 2.4) - 0.055;
+}
+
+
+/** The linear-light gray of every color, pixel i of the all colors image being color i */
+static unsigned char* referenceGray(const unsigned char* color){
+    size_t n = (size_t)ALL_COLORS_SIDE * ALL_COLORS_SIDE;
+    unsigned char* gray = (unsigned char*)malloc(n);
+    double lin[256];
+    size_t i;
+
+    if(gray == NULL){
+        return NULL;
+    }
+    for(i = 0; i < 256; ++i){
+        lin[i] = srgbDecode(i / 255.0);
+    }
+    for(i = 0; i < n; ++i){
+        const unsigned char* p = color + 3 * i;
+        double y = GRAY_LINEAR_WEIGHT_B * lin[p[0]] + GRAY_LINEAR_WEIGHT_G * lin[p[1]] +
+                   GRAY_LINEAR_WEIGHT_R * lin[p[2]];
+        gray[i] = (unsigned char)(255 * srgbEncode(y < 1 ? y : 1) + 0.5);
+    }
+    return gray;
+}
+
+
+static int benchAccuracy(void){
+    int side = ALL_COLORS_SIDE;
+    size_t n = (size_t)side * side;
+    unsigned char* color = (unsigned char*)malloc(3 * n);
+    unsigned char* gray = (unsigned char*)malloc(n);
+    unsigned char* reference = NULL;
+    size_t i;
+
+    if(color == NULL || gray == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        return -1;
+    }
+    for(i = 0; i < n; ++i){
+        color[3 * i] = (unsigned char)i;
+        color[3 * i + 1] = (unsigned char)(i >> 8);
+        color[3 * i + 2] = (unsigned char)(i >> 16);
+    }
+    reference = referenceGray(color);
+    if(reference == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        return -1;
+    }
+
+    printf("Accuracy over all %zu colors against linear-light gray computed in doubles\n", n);
+    printf("%-16s %10s %10s %10s\n", "path", "max error", "differ", "mean error");
+
+    int p, k;
+    for(p = 0; p < 2; ++p){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            if(!runsKernel(p, k)){
+                continue;
+            }
+            paths[p].convert((GrayKernel)k, color, 3 * side, gray, side, side, side);
+
+            int maxError = 0;
+            size_t differ = 0;
+            double sum = 0;
+            for(i = 0; i < n; ++i){
+                int e = abs((int)gray[i] - (int)reference[i]);
+                if(e > maxError){
+                    maxError = e;
+                }
+                differ += e != 0;
+                sum += e;
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s %s", paths[p].mode, grayKernelName((GrayKernel)k));
+            printf("%-16s %10d %9.3f%% %10.4f\n", name, maxError, 100.0 * differ / n, sum / n);
+        }
+    }
+
+    free(color);
+    free(gray);
+    free(reference);
+    return 0;
+}
+
+
+static int benchThroughput(int width, int height, int repeats){
+    int colorStep = (3 * width + 3) & ~3;
+    int grayStep = (width + 3) & ~3;
+    unsigned char* color = (unsigned char*)malloc((size_t)colorStep * height);
+    unsigned char* gray = (unsigned char*)malloc((size_t)grayStep * height);
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    unsigned seed = 1;
+
+    if(color == NULL || gray == NULL || times == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        free(times);
+        return -1;
+    }
+    latencyFillRandom(color, (size_t)colorStep * height, &seed);
+
+    double mpix = width * (double)height / 1e6;
+    double ns[2][GRAY_KERNEL_COUNT] = {{0}};
+    double plainNs = 0;
+
+    int p, k, r;
+    for(p = 0; p < 2; ++p){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            if(!runsKernel(p, k)){
+                continue;
+            }
+
+            /** The first conversion builds the linear tables and touches the gray image */
+            paths[p].convert((GrayKernel)k, color, colorStep, gray, grayStep, width, height);
+            for(r = 0; r < repeats; ++r){
+                uint64_t start = latencyNow();
+                paths[p].convert((GrayKernel)k, color, colorStep, gray, grayStep, width, height);
+                times[r] = latencyNow() - start;
+            }
+            ns[p][k] = (double)latencyMedian(times, repeats);
+            if(p == 0 && (plainNs == 0 || ns[p][k] < plainNs)){
+                plainNs = ns[p][k];
+            }
+        }
+    }
+
+    printf("\n%d x %d, median of %d conversions\n", width, height, repeats);
+    printf("%-16s %10s %10s %10s %10s\n", "path", "ms", "MPix/s", "frames/s", "vs plain");
+    for(p = 0; p < 2; ++p){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            if(ns[p][k] == 0){
+                continue;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "%s %s", paths[p].mode, grayKernelName((GrayKernel)k));
+            printf("%-16s %10.3f %10.1f %10.1f %9.2fx\n", name, ns[p][k] / 1e6,
+                   mpix / (ns[p][k] / 1e9), 1e9 / ns[p][k], ns[p][k] / plainNs);
+        }
+    }
+
+    free(color);
+    free(gray);
+    free(times);
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    int repeats = 50;
+    int width = 1920, height = 1080;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &width, &height) != 0){
+                    width = 0;
+                }
+                break;
+            default: width = 0; break;
+        }
+    }
+    if(width == 0 || repeats < 1 || optind < argc){
+        printf("Usage: ./benchlinear [-n repeats] [-s widthxheight]\n");
+        return -1;
+    }
+
+    if(benchAccuracy() != 0){
+        return -1;
+    }
+    return benchThroughput(width, height, repeats);
+}
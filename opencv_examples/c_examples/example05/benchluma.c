@@ -0,0 +1,296 @@
+/** Filename: benchluma.c
+*
+*   Description: correctness and throughput of the luma standards of GrayConverter.
+*
+*   Usage: ./benchluma [-n repeats] [-s widthxheight]
+*
+*   Verify: for every standard (BT.601, BT.709, BT.2020 and custom weights) and every
+*   kernel this CPU runs, the converter is checked
+*
+*       reference   against gray values of a few colors worked out by hand from each
+*                   standard's fixed point weights
+*       all colors  against the fixed point formula computed here, one pixel at a time,
+*                   on an image holding each of the 2^24 BGR colors once, and against the
+*                   standard's fractional weights in doubles, which may differ by one level
+*       widths      on rows of every width from 1 to 100, each starting at every offset
+*                   of a 4 byte word, so every tail of the SIMD kernels is run
+*
+*   and the BT.601 converter against grayConvert. The benchmark stops with a nonzero exit
+*   status if any check fails.
+*
+*   Throughput: a random image of the given size (default 1920x1080) is converted with
+*   every standard and kernel; printed are the median time of repeats runs and the time
+*   relative to BT.601 on the same kernel, which should be 1.00 for the three standards.
+*
+*   Needs no OpenCV: make benchluma
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gray.h"
+#include "latency.h"
+
+#define ALL_COLORS_SIDE 4096            /// 4096 x 4096 pixels, one of each color
+#define WIDTHS_MAX 100
+#define REFERENCE_COLORS 8
+
+/** The fractions the standards define; GRAY_STANDARD_CUSTOM is tested with these */
+static const double fractions[GRAY_STANDARD_COUNT][3] = {
+    { 0.299, 0.587, 0.114 },
+    { 0.2126, 0.7152, 0.0722 },
+    { 0.2627, 0.6780, 0.0593 },
+    { 0.25, 0.5, 0.25 }
+};
+
+/** BGR colors and their gray in each standard, with the fixed point weights of gray.h */
+static const unsigned char referenceColors[REFERENCE_COLORS][3] = {
+    { 255, 255, 255 }, { 0, 0, 255 }, { 0, 255, 0 }, { 255, 0, 0 },
+    { 40, 120, 200 }, { 200, 120, 40 }, { 17, 99, 250 }, { 128, 128, 128 }
+};
+
+static const unsigned char referenceGray[GRAY_STANDARD_CUSTOM][REFERENCE_COLORS] = {
+    { 255, 76, 150, 29, 135, 105, 135, 128 },
+    { 255, 54, 182, 18, 131, 109, 125, 128 },
+    { 255, 67, 173, 15, 136, 104, 134, 128 }
+};
+
+
+static int initConverter(GrayConverter* converter, int standard, int kernel){
+    GrayWeights custom;
+    grayWeightsFromFractions(&custom, fractions[standard][0], fractions[standard][1],
+                             fractions[standard][2]);
+    return grayConverterInit(converter, (GrayStandard)standard, &custom, (GrayKernel)kernel);
+}
+
+
+static int verifyReference(const GrayConverter* converter){
+    unsigned char gray[REFERENCE_COLORS];
+    int i;
+
+    if(converter->standard == GRAY_STANDARD_CUSTOM){
+        return 0;
+    }
+
+    grayConverterConvert(converter, &referenceColors[0][0], 3 * REFERENCE_COLORS, gray,
+                         REFERENCE_COLORS, REFERENCE_COLORS, 1);
+    for(i = 0; i < REFERENCE_COLORS; ++i){
+        if(gray[i] != referenceGray[converter->standard][i]){
+            printf("  BGR %d,%d,%d gave %d, expected %d\n", referenceColors[i][0],
+                   referenceColors[i][1], referenceColors[i][2], gray[i],
+                   referenceGray[converter->standard][i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int verifyAllColors(const GrayConverter* converter, const unsigned char* color, unsigned char* gray){
+    const GrayWeights* w = &converter->weights;
+    const double* f = fractions[converter->standard];
+    size_t n = (size_t)ALL_COLORS_SIDE * ALL_COLORS_SIDE;
+    size_t i;
+
+    grayConverterConvert(converter, color, 3 * ALL_COLORS_SIDE, gray, ALL_COLORS_SIDE,
+                         ALL_COLORS_SIDE, ALL_COLORS_SIDE);
+
+    for(i = 0; i < n; ++i){
+        const unsigned char* p = color + 3 * i;
+        int fixed = (w->b * p[0] + w->g * p[1] + w->r * p[2] + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
+        double exact = f[2] * p[0] + f[1] * p[1] + f[0] * p[2];
+
+        if(gray[i] != fixed || gray[i] < exact - 1 || gray[i] > exact + 1){
+            printf("  BGR %d,%d,%d gave %d, fixed point %d, exact %.3f\n", p[0], p[1], p[2],
+                   gray[i], fixed, exact);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int verifyWidths(const GrayConverter* converter, const unsigned char* color){
+    unsigned char gray[WIDTHS_MAX + 4];
+    unsigned char expected[WIDTHS_MAX];
+    int width, offset, col;
+
+    for(width = 1; width <= WIDTHS_MAX; ++width){
+        for(offset = 0; offset < 4; ++offset){
+            const unsigned char* row = color + 3 * 1000 * width + offset;
+
+            /** Byte width of gray must stay untouched */
+            memset(gray, 0xa5, sizeof(gray));
+            grayConverterRows(converter, row, 3 * width, gray + offset, width, width, 0, 1);
+            for(col = 0; col < width; ++col){
+                const GrayWeights* w = &converter->weights;
+                expected[col] = (unsigned char)((w->b * row[3 * col] + w->g * row[3 * col + 1] +
+                                                 w->r * row[3 * col + 2] + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+            }
+            if(memcmp(gray + offset, expected, (size_t)width) != 0 || gray[offset + width] != 0xa5){
+                printf("  width %d at offset %d differs\n", width, offset);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/** The BT.601 converter must give what grayConvert gives */
+static int verifyPlain(const GrayConverter* converter, const unsigned char* color, unsigned char* gray){
+    size_t n = (size_t)ALL_COLORS_SIDE * ALL_COLORS_SIDE;
+    unsigned char* plain = (unsigned char*)malloc(n);
+    int status = 0;
+
+    if(plain == NULL){
+        return -1;
+    }
+    grayConvertWith(converter->kernel, color, 3 * ALL_COLORS_SIDE, plain, ALL_COLORS_SIDE,
+                    ALL_COLORS_SIDE, ALL_COLORS_SIDE);
+    if(memcmp(plain, gray, n) != 0){
+        printf("  differs from grayConvert\n");
+        status = -1;
+    }
+    free(plain);
+    return status;
+}
+
+
+static int verify(void){
+    size_t n = (size_t)ALL_COLORS_SIDE * ALL_COLORS_SIDE;
+    unsigned char* color = (unsigned char*)malloc(3 * n);
+    unsigned char* gray = (unsigned char*)malloc(n);
+    int failed = 0;
+    size_t i;
+
+    if(color == NULL || gray == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        return -1;
+    }
+    for(i = 0; i < n; ++i){
+        color[3 * i] = (unsigned char)i;
+        color[3 * i + 1] = (unsigned char)(i >> 8);
+        color[3 * i + 2] = (unsigned char)(i >> 16);
+    }
+
+    int s, k;
+    for(s = 0; s < GRAY_STANDARD_COUNT; ++s){
+        for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+            GrayConverter converter;
+            if(!grayKernelSupported((GrayKernel)k)){
+                continue;
+            }
+            if(initConverter(&converter, s, k) != GRAY_OK){
+                printf("%-8s %-8s not set up\n", grayStandardName((GrayStandard)s), grayKernelName((GrayKernel)k));
+                ++failed;
+                continue;
+            }
+
+            int bad = verifyReference(&converter) != 0 ||
+                      verifyAllColors(&converter, color, gray) != 0 ||
+                      verifyWidths(&converter, color) != 0 ||
+                      (s == GRAY_STANDARD_BT601 && verifyPlain(&converter, color, gray) != 0);
+            printf("%-8s %-8s weights %5d %5d %5d  %s\n", grayStandardName((GrayStandard)s),
+                   grayKernelName((GrayKernel)k), converter.weights.r, converter.weights.g,
+                   converter.weights.b, bad ? "FAILED" : "ok");
+            failed += bad;
+        }
+    }
+
+    free(color);
+    free(gray);
+    return failed > 0 ? -1 : 0;
+}
+
+
+static int benchThroughput(int width, int height, int repeats){
+    int colorStep = (3 * width + 3) & ~3;
+    int grayStep = (width + 3) & ~3;
+    unsigned char* color = (unsigned char*)malloc((size_t)colorStep * height);
+    unsigned char* gray = (unsigned char*)malloc((size_t)grayStep * height);
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    unsigned seed = 1;
+
+    if(color == NULL || gray == NULL || times == NULL){
+        printf("Out of memory\n");
+        free(color);
+        free(gray);
+        free(times);
+        return -1;
+    }
+    latencyFillRandom(color, (size_t)colorStep * height, &seed);
+
+    printf("\n%d x %d, median of %d conversions, ms (vs bt601 on the same kernel)\n",
+           width, height, repeats);
+    printf("%-8s", "kernel");
+    int s, k, r;
+    for(s = 0; s < GRAY_STANDARD_COUNT; ++s){
+        printf(" %16s", grayStandardName((GrayStandard)s));
+    }
+    printf("\n");
+
+    for(k = GRAY_KERNEL_SCALAR; k < GRAY_KERNEL_COUNT; ++k){
+        double bt601 = 0;
+        if(!grayKernelSupported((GrayKernel)k)){
+            continue;
+        }
+
+        printf("%-8s", grayKernelName((GrayKernel)k));
+        for(s = 0; s < GRAY_STANDARD_COUNT; ++s){
+            GrayConverter converter;
+            initConverter(&converter, s, k);
+
+            grayConverterConvert(&converter, color, colorStep, gray, grayStep, width, height);
+            for(r = 0; r < repeats; ++r){
+                uint64_t start = latencyNow();
+                grayConverterConvert(&converter, color, colorStep, gray, grayStep, width, height);
+                times[r] = latencyNow() - start;
+            }
+            double ms = latencyMedian(times, repeats) / 1e6;
+            if(s == GRAY_STANDARD_BT601){
+                bt601 = ms;
+            }
+            printf(" %8.3f (%4.2fx)", ms, ms / bt601);
+        }
+        printf("\n");
+    }
+
+    free(color);
+    free(gray);
+    free(times);
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    int repeats = 50;
+    int width = 1920, height = 1080;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &width, &height) != 0){
+                    width = 0;
+                }
+                break;
+            default: width = 0; break;
+        }
+    }
+    if(width == 0 || repeats < 1 || optind < argc){
+        printf("Usage: ./benchluma [-n repeats] [-s widthxheight]\n");
+        return -1;
+    }
+
+    if(verify() != 0){
+        printf("Verification failed\n");
+        return -1;
+    }
+    return benchThroughput(width, height, repeats);
+}
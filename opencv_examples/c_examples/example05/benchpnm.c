@@ -0,0 +1,159 @@
+/** Filename: benchpnm.c
+*
+*   Description: the PPM reader and PGM writer of pnm.h against cvLoadImage and cvSaveImage.
+*
+*   Usage: ./benchpnm [-n repeats] [-o outputDir] imageName.ppm
+*
+*   The image is loaded repeats times by each reader and its gray image, converted once,
+*   saved repeats times by each writer as a .pgm file in outputDir (default /tmp).
+*   Printed are the median time of each and pnm's time relative to OpenCV's. The file
+*   stays in the page cache after the first load, so this is the time to parse and copy
+*   the pixels, not to read the disk.
+*
+*   Before timing, the images pnmRead and cvLoadImage load are compared pixel by pixel,
+*   and so are the files the two writers write, read back with cvLoadImage; the benchmark
+*   stops with a nonzero exit status if they differ.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "gray.h"
+#include "latency.h"
+#include "pnm.h"
+
+
+/** Return 1 if the two images have the same size, channels and pixels */
+static int samePixels(const IplImage* a, const IplImage* b){
+    int row;
+
+    if(a == NULL || b == NULL || a->width != b->width || a->height != b->height ||
+       a->nChannels != b->nChannels){
+        return 0;
+    }
+    for(row = 0; row < a->height; ++row){
+        if(memcmp(a->imageData + (size_t)row * a->widthStep, b->imageData + (size_t)row * b->widthStep,
+                  (size_t)a->width * a->nChannels) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/** Read back both gray files and compare them with the image they were written from */
+static int verifySaved(const char* cvPath, const char* pnmPath, const IplImage* gray){
+    IplImage* cvGray = cvLoadImage(cvPath, CV_LOAD_IMAGE_GRAYSCALE);
+    IplImage* pnmGray = cvLoadImage(pnmPath, CV_LOAD_IMAGE_GRAYSCALE);
+    int same = samePixels(cvGray, gray) && samePixels(pnmGray, gray);
+
+    if(cvGray != NULL){
+        cvReleaseImage(&cvGray);
+    }
+    if(pnmGray != NULL){
+        cvReleaseImage(&pnmGray);
+    }
+    return same ? 0 : -1;
+}
+
+
+static double timeLoad(const char* imageName, int pnm, uint64_t* times, int repeats){
+    int r;
+
+    for(r = 0; r < repeats; ++r){
+        uint64_t start = latencyNow();
+        IplImage* img = pnm ? pnmRead(imageName) : cvLoadImage(imageName, CV_LOAD_IMAGE_COLOR);
+        times[r] = latencyNow() - start;
+        cvReleaseImage(&img);
+    }
+    return latencyMedian(times, repeats) / 1e6;
+}
+
+
+static double timeSave(const char* path, const IplImage* gray, int pnm, uint64_t* times, int repeats){
+    int r;
+
+    for(r = 0; r < repeats; ++r){
+        uint64_t start = latencyNow();
+        if(pnm){
+            pnmWriteGray(path, gray);
+        }
+        else{
+            cvSaveImage(path, gray, NULL);
+        }
+        times[r] = latencyNow() - start;
+    }
+    return latencyMedian(times, repeats) / 1e6;
+}
+
+
+int main(int argc, char** argv){
+    const char* outputDir = "/tmp";
+    int repeats = 20;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:o:")) != -1){
+        switch(opt){
+            case 'n': repeats = atoi(optarg); break;
+            case 'o': outputDir = optarg; break;
+            default: repeats = 0; break;
+        }
+    }
+    if(repeats < 1 || optind + 1 != argc){
+        printf("Usage: ./benchpnm [-n repeats] [-o outputDir] imageName.ppm\n");
+        return -1;
+    }
+
+    const char* imageName = argv[optind];
+    IplImage* colorimg = cvLoadImage(imageName, CV_LOAD_IMAGE_COLOR);
+    IplImage* pnmimg = pnmRead(imageName);
+    if(colorimg == NULL || pnmimg == NULL){
+        printf("File %s not opened as a binary PPM file\n", imageName);
+        return -1;
+    }
+    if(!samePixels(colorimg, pnmimg)){
+        printf("pnmRead and cvLoadImage differ on %s\n", imageName);
+        return -1;
+    }
+    cvReleaseImage(&pnmimg);
+
+    IplImage* grayimg = cvCreateImage(cvSize(colorimg->width, colorimg->height), IPL_DEPTH_8U, 1);
+    uint64_t* times = (uint64_t*)malloc((size_t)repeats * sizeof(*times));
+    if(grayimg == NULL || times == NULL){
+        printf("Out of memory\n");
+        return -1;
+    }
+    grayConvert((unsigned char*)colorimg->imageData, colorimg->widthStep,
+                (unsigned char*)grayimg->imageData, grayimg->widthStep,
+                colorimg->width, colorimg->height);
+
+    char cvPath[4096], pnmPath[4096];
+    snprintf(cvPath, sizeof(cvPath), "%s/benchpnm_cv.pgm", outputDir);
+    snprintf(pnmPath, sizeof(pnmPath), "%s/benchpnm_pnm.pgm", outputDir);
+    if(!cvSaveImage(cvPath, grayimg, NULL) || pnmWriteGray(pnmPath, grayimg) != 0 ||
+       verifySaved(cvPath, pnmPath, grayimg) != 0){
+        printf("The gray files in %s differ or were not written\n", outputDir);
+        return -1;
+    }
+
+    double cvLoad = timeLoad(imageName, 0, times, repeats);
+    double pnmLoad = timeLoad(imageName, 1, times, repeats);
+    double cvSave = timeSave(cvPath, grayimg, 0, times, repeats);
+    double pnmSave = timeSave(pnmPath, grayimg, 1, times, repeats);
+
+    printf("%s: %d x %d, median of %d, ms\n", imageName, colorimg->width, colorimg->height, repeats);
+    printf("%-6s %12s %12s %10s\n", "", "OpenCV", "pnm", "pnm/OpenCV");
+    printf("%-6s %12.3f %12.3f %9.2fx\n", "load", cvLoad, pnmLoad, pnmLoad / cvLoad);
+    printf("%-6s %12.3f %12.3f %9.2fx\n", "save", cvSave, pnmSave, pnmSave / cvSave);
+
+    unlink(cvPath);
+    unlink(pnmPath);
+    free(times);
+    cvReleaseImage(&grayimg);
+    cvReleaseImage(&colorimg);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/** Filename: benchthreads.c
+*
+*   Description: nested versus flat parallelism benchmark.
+*
+*   Usage: ./benchthreads [-n conversions] [-s widthxheight] [-g] [imageName]
+*
+*   Runs conversions conversions of the image under each threading policy of
+*   threading.h and prints the throughput and the p50, p99 and max latency of a single
+*   conversion, then the policy example05 -P auto would choose. Conversions use
+*   cvCvtColor, or libgray with -g. Without an image a random image of the given size
+*   (default 1920x1080) is used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "latency.h"
+#include "threading.h"
+
+
+int main(int argc, char** argv){
+    int conversions = 400;
+    int width = 1920, height = 1080;
+    int useOpenCV = 1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:g")) != -1){
+        switch(opt){
+            case 'n': conversions = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &width, &height) != 0){
+                    width = 0;
+                }
+                break;
+            case 'g': useOpenCV = 0; break;
+            default: width = 0; break;
+        }
+    }
+    if(width == 0 || conversions < 1){
+        printf("Usage: ./benchthreads [-n conversions] [-s widthxheight] [-g] [imageName]\n");
+        return -1;
+    }
+
+    IplImage* sample;
+    if(optind < argc){
+        sample = cvLoadImage(argv[optind], 1);
+        if(sample == NULL){
+            printf("File %s not opened\n", argv[optind]);
+            return -1;
+        }
+    }
+    else{
+        sample = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+        if(sample == NULL){
+            printf("No memory allocated for the sample image\n");
+            return -1;
+        }
+        int i;
+        for(i = 0; i < sample->imageSize; ++i){
+            sample->imageData[i] = (char)rand();
+        }
+    }
+
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    ThreadPolicy candidates[THREADING_MAX_CANDIDATES];
+    ThreadTrial trials[THREADING_MAX_CANDIDATES];
+    int n = threadingCandidates(cores, useOpenCV, candidates);
+    int i;
+
+    printf("%d x %d, %d conversions with %s, %d cores\n", sample->width, sample->height,
+           conversions, useOpenCV ? "cvCvtColor" : "libgray", cores);
+    threadingPrint(NULL);
+    for(i = 0; i < n; ++i){
+        if(threadingMeasure(&candidates[i], sample, conversions, &trials[i]) != 0){
+            printf("Policy %s could not be measured\n", candidates[i].name);
+            cvReleaseImage(&sample);
+            return -1;
+        }
+        threadingPrint(&trials[i]);
+    }
+
+    printf("auto would choose: %s\n", trials[threadingChoose(trials, n)].policy.name);
+
+    cvReleaseImage(&sample);
+    return 0;
+}
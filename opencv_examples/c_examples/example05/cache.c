@@ -0,0 +1,579 @@
+/** Filename: cache.c
+*
+*   Description: the content-addressed gray image cache, see cache.h.
+*
+*   The index of the directory is kept in memory: a hash table of the entries, which are
+*   also on a list from the most to the least recently used. It is built from the file
+*   names and modification times when the cache is opened. Files are read and written
+*   without the index lock held; the lock only covers the index, the statistics and the
+*   removal of evicted files.
+*
+*   An entry file is a CacheFileHeader, the width and height of each image as two
+*   uint32_t, and then the gray pixels of each image, width bytes per row.
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_FILE_MAGIC 0x31435247u    /// "GRC1"
+#define CACHE_NAME_LENGTH 38            /// 16 hex digits, '-', 16 hex digits, ".gray"
+#define CACHE_MIN_BUCKETS 1024
+
+#define XXH_PRIME1 11400714785074694791ull
+#define XXH_PRIME2 14029467366897019727ull
+#define XXH_PRIME3 1609587929392839161ull
+#define XXH_PRIME4 9650029242287828579ull
+#define XXH_PRIME5 2870177450012600261ull
+
+
+typedef struct CacheFileHeader{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t hash;              /// the key again, in case two keys share a file name
+    uint64_t size;
+} CacheFileHeader;
+
+typedef struct CacheNode{
+    CacheKey key;
+    uint64_t bytes;
+    uint64_t usedNs;            /// modification time of the file, only used by cacheOpen
+    struct CacheNode* chain;    /// next in the hash bucket
+    struct CacheNode* newer;
+    struct CacheNode* older;
+} CacheNode;
+
+struct Cache{
+    char* dir;
+    pthread_mutex_t lock;
+    CacheNode** buckets;
+    size_t bucketCount;         /// a power of two
+    CacheNode* newest;
+    CacheNode* oldest;
+    CacheStats stats;
+    unsigned tempCounter;
+};
+
+
+static inline uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t read64(const unsigned char* p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static inline uint32_t read32(const unsigned char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input){
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t v){
+    acc ^= xxhRound(0, v);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+
+/** XXH64, reading the input as little endian words as x86 stores them */
+uint64_t cacheHash(const void* data, size_t size, uint64_t seed){
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if(size >= 32){
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        const unsigned char* limit = end - 32;
+
+        do{
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+            p += 32;
+        }while(p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxhMerge(h, v1);
+        h = xxhMerge(h, v2);
+        h = xxhMerge(h, v3);
+        h = xxhMerge(h, v4);
+    }
+    else{
+        h = seed + XXH_PRIME5;
+    }
+
+    h += (uint64_t)size;
+
+    while(p + 8 <= end){
+        h ^= xxhRound(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+        p += 8;
+    }
+    if(p + 4 <= end){
+        h ^= (uint64_t)read32(p) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    while(p < end){
+        h ^= (uint64_t)(*p) * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+CacheKey cacheKey(const void* data, size_t size, uint64_t seed){
+    CacheKey key = { cacheHash(data, size, seed), (uint64_t)size };
+    return key;
+}
+
+
+static void entryPath(const Cache* cache, const CacheKey* key, char* path, size_t pathSize){
+    snprintf(path, pathSize, "%s/%016llx-%016llx.gray", cache->dir,
+             (unsigned long long)key->hash, (unsigned long long)key->size);
+}
+
+
+/** Index functions; the caller holds the lock */
+
+static CacheNode** findSlot(Cache* cache, const CacheKey* key){
+    CacheNode** slot = &cache->buckets[key->hash & (cache->bucketCount - 1)];
+    while(*slot != NULL && ((*slot)->key.hash != key->hash || (*slot)->key.size != key->size)){
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+
+static void unlinkLru(Cache* cache, CacheNode* node){
+    if(node->newer != NULL) node->newer->older = node->older;
+    else cache->newest = node->older;
+    if(node->older != NULL) node->older->newer = node->newer;
+    else cache->oldest = node->newer;
+    node->newer = node->older = NULL;
+}
+
+
+static void pushNewest(Cache* cache, CacheNode* node){
+    node->older = cache->newest;
+    node->newer = NULL;
+    if(cache->newest != NULL) cache->newest->newer = node;
+    else cache->oldest = node;
+    cache->newest = node;
+}
+
+
+/** Double the buckets once there are more entries than buckets */
+static void growBuckets(Cache* cache){
+    size_t count = cache->bucketCount * 2;
+    CacheNode** buckets = (CacheNode**)calloc(count, sizeof(CacheNode*));
+    size_t i;
+
+    if(buckets == NULL){
+        return;                 /// longer chains, but still correct
+    }
+    for(i = 0; i < cache->bucketCount; ++i){
+        CacheNode* node = cache->buckets[i];
+        while(node != NULL){
+            CacheNode* next = node->chain;
+            CacheNode** b = &buckets[node->key.hash & (count - 1)];
+            node->chain = *b;
+            *b = node;
+            node = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucketCount = count;
+}
+
+
+static void insertNode(Cache* cache, CacheNode* node){
+    CacheNode** slot = findSlot(cache, &node->key);
+    node->chain = *slot;
+    *slot = node;
+    pushNewest(cache, node);
+    ++cache->stats.entries;
+    cache->stats.bytes += node->bytes;
+
+    if(cache->stats.entries > cache->bucketCount){
+        growBuckets(cache);
+    }
+}
+
+
+static void removeNode(Cache* cache, CacheNode* node){
+    CacheNode** slot = findSlot(cache, &node->key);
+    *slot = node->chain;
+    unlinkLru(cache, node);
+    --cache->stats.entries;
+    cache->stats.bytes -= node->bytes;
+    free(node);
+}
+
+
+/** Remove the least recently used entries, but not keep, until the cache fits */
+static void evict(Cache* cache, const CacheNode* keep){
+    char path[4096];
+
+    while(cache->stats.bytes > cache->stats.maxBytes && cache->oldest != NULL && cache->oldest != keep){
+        CacheNode* node = cache->oldest;
+        entryPath(cache, &node->key, path, sizeof(path));
+        unlink(path);
+        removeNode(cache, node);
+        ++cache->stats.evictions;
+    }
+}
+
+
+static int compareUsed(const void* a, const void* b){
+    const CacheNode* x = *(const CacheNode* const*)a;
+    const CacheNode* y = *(const CacheNode* const*)b;
+    return x->usedNs < y->usedNs ? -1 : x->usedNs > y->usedNs;
+}
+
+
+/** Index the entry files of the directory, oldest first */
+static int scanDirectory(Cache* cache){
+    DIR* dir = opendir(cache->dir);
+    CacheNode** nodes = NULL;
+    size_t count = 0, capacity = 0, i;
+    struct dirent* e;
+
+    if(dir == NULL){
+        return -1;
+    }
+
+    while((e = readdir(dir)) != NULL){
+        unsigned long long hash, size;
+        int end = 0;
+        struct stat st;
+
+        if(strlen(e->d_name) != CACHE_NAME_LENGTH ||
+           sscanf(e->d_name, "%16llx-%16llx.gray%n", &hash, &size, &end) != 2 || end != CACHE_NAME_LENGTH ||
+           fstatat(dirfd(dir), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)){
+            continue;
+        }
+
+        if(count == capacity){
+            capacity = capacity > 0 ? capacity * 2 : 256;
+            CacheNode** p = (CacheNode**)realloc(nodes, capacity * sizeof(CacheNode*));
+            if(p == NULL){
+                break;
+            }
+            nodes = p;
+        }
+        CacheNode* node = (CacheNode*)calloc(1, sizeof(CacheNode));
+        if(node == NULL){
+            break;
+        }
+        node->key.hash = hash;
+        node->key.size = size;
+        node->bytes = (uint64_t)st.st_size;
+        node->usedNs = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+        nodes[count++] = node;
+    }
+    closedir(dir);
+
+    qsort(nodes, count, sizeof(CacheNode*), compareUsed);
+    for(i = 0; i < count; ++i){
+        insertNode(cache, nodes[i]);
+    }
+    free(nodes);
+    return 0;
+}
+
+
+Cache* cacheOpen(const char* dir, uint64_t maxBytes){
+    Cache* cache = (Cache*)calloc(1, sizeof(Cache));
+    if(cache == NULL){
+        return NULL;
+    }
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+        free(cache);
+        return NULL;
+    }
+
+    cache->dir = strdup(dir);
+    cache->bucketCount = CACHE_MIN_BUCKETS;
+    cache->buckets = (CacheNode**)calloc(cache->bucketCount, sizeof(CacheNode*));
+    cache->stats.maxBytes = maxBytes;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if(cache->dir == NULL || cache->buckets == NULL || scanDirectory(cache) != 0){
+        cacheClose(cache);
+        return NULL;
+    }
+
+    evict(cache, NULL);
+    return cache;
+}
+
+
+/** Read a whole file; returns its size, or -1 */
+static ssize_t readEntryFile(const char* path, unsigned char** data){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    ssize_t done = 0;
+
+    *data = NULL;
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheFileHeader) ||
+       (*data = (unsigned char*)malloc((size_t)st.st_size)) == NULL){
+        close(fd);
+        return -1;
+    }
+
+    while(done < st.st_size){
+        ssize_t n = read(fd, *data + done, (size_t)(st.st_size - done));
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            break;
+        }
+        done += n;
+    }
+
+    /** A hit makes the entry the most recently used for the next run too */
+    futimens(fd, NULL);
+    close(fd);
+
+    if(done != st.st_size){
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+    return done;
+}
+
+
+/** Point entry's planes into data; returns -1 if the file is not an entry for key */
+static int parseEntry(const CacheKey* key, unsigned char* data, size_t size, CacheEntry* entry){
+    CacheFileHeader header;
+    size_t offset = sizeof(header);
+    int i;
+
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != CACHE_FILE_MAGIC || header.hash != key->hash || header.size != key->size ||
+       header.count < 1 || header.count > CACHE_MAX_PLANES ||
+       size < sizeof(header) + 2 * sizeof(uint32_t) * header.count){
+        return -1;
+    }
+
+    const unsigned char* dims = data + offset;
+    offset += 2 * sizeof(uint32_t) * header.count;
+
+    entry->count = (int)header.count;
+    for(i = 0; i < entry->count; ++i){
+        uint32_t width = read32(dims + 8 * i);
+        uint32_t height = read32(dims + 8 * i + 4);
+        uint64_t bytes = (uint64_t)width * height;
+
+        if(width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX || bytes > size - offset){
+            return -1;
+        }
+        entry->planes[i].data = data + offset;
+        entry->planes[i].width = (int)width;
+        entry->planes[i].height = (int)height;
+        entry->planes[i].channels = 1;
+        entry->planes[i].step = (int)width;
+        offset += (size_t)bytes;
+    }
+    return offset == size ? 0 : -1;
+}
+
+
+int cacheGet(Cache* cache, const CacheKey* key, CacheEntry* entry){
+    char path[4096];
+    unsigned char* data;
+
+    memset(entry, 0, sizeof(*entry));
+
+    pthread_mutex_lock(&cache->lock);
+    CacheNode* node = *findSlot(cache, key);
+    if(node == NULL){
+        ++cache->stats.misses;
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    unlinkLru(cache, node);
+    pushNewest(cache, node);
+    pthread_mutex_unlock(&cache->lock);
+
+    entryPath(cache, key, path, sizeof(path));
+    ssize_t size = readEntryFile(path, &data);
+    int valid = size >= 0 && parseEntry(key, data, (size_t)size, entry) == 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if(valid){
+        ++cache->stats.hits;
+    }
+    else{
+        /** Removed by another process, or not a complete entry */
+        ++cache->stats.misses;
+        node = *findSlot(cache, key);
+        if(node != NULL){
+            removeNode(cache, node);
+        }
+        if(size >= 0){
+            unlink(path);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if(!valid){
+        free(data);
+        memset(entry, 0, sizeof(*entry));
+        return 0;
+    }
+    entry->data = data;
+    return 1;
+}
+
+
+void cacheEntryFree(CacheEntry* entry){
+    free(entry->data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+
+static int writeEntryFile(const char* path, const CacheKey* key, const GrayImage* planes, int count){
+    CacheFileHeader header = { CACHE_FILE_MAGIC, (uint32_t)count, key->hash, key->size };
+    FILE* f = fopen(path, "wbx");
+    int i, row, ok;
+
+    if(f == NULL){
+        return -1;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+    ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for(i = 0; i < count && ok; ++i){
+        uint32_t dims[2] = { (uint32_t)planes[i].width, (uint32_t)planes[i].height };
+        ok = fwrite(dims, sizeof(dims), 1, f) == 1;
+    }
+    for(i = 0; i < count && ok; ++i){
+        for(row = 0; row < planes[i].height && ok; ++row){
+            ok = fwrite(planes[i].data + (size_t)row * planes[i].step, 1, (size_t)planes[i].width, f) ==
+                 (size_t)planes[i].width;
+        }
+    }
+
+    if(fclose(f) != 0 || !ok){
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+
+int cachePut(Cache* cache, const CacheKey* key, const GrayImage* planes, int count){
+    char path[4096], temp[4096];
+    uint64_t bytes = sizeof(CacheFileHeader) + 2 * sizeof(uint32_t) * (uint64_t)count;
+    int i;
+
+    if(count < 1 || count > CACHE_MAX_PLANES){
+        return -1;
+    }
+    for(i = 0; i < count; ++i){
+        if(planes[i].data == NULL || planes[i].channels != 1 || planes[i].width <= 0 || planes[i].height <= 0){
+            return -1;
+        }
+        bytes += (uint64_t)planes[i].width * planes[i].height;
+    }
+    if(bytes > cache->stats.maxBytes){
+        return -1;              /// would evict everything and then itself
+    }
+
+    /** Readers only ever see a complete file under the entry's name */
+    entryPath(cache, key, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s/.tmp-%d-%u", cache->dir, (int)getpid(),
+             __atomic_fetch_add(&cache->tempCounter, 1, __ATOMIC_RELAXED));
+    if(writeEntryFile(temp, key, planes, count) != 0){
+        return -1;
+    }
+    if(rename(temp, path) != 0){
+        unlink(temp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    CacheNode* node = *findSlot(cache, key);
+    if(node != NULL){
+        /** Another thread stored the same input meanwhile */
+        cache->stats.bytes = cache->stats.bytes - node->bytes + bytes;
+        node->bytes = bytes;
+        unlinkLru(cache, node);
+        pushNewest(cache, node);
+    }
+    else if((node = (CacheNode*)calloc(1, sizeof(CacheNode))) != NULL){
+        node->key = *key;
+        node->bytes = bytes;
+        insertNode(cache, node);
+    }
+    ++cache->stats.stores;
+    evict(cache, node);
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+
+void cacheStats(Cache* cache, CacheStats* stats){
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+void cacheClose(Cache* cache){
+    if(cache == NULL){
+        return;
+    }
+
+    CacheNode* node = cache->newest;
+    while(node != NULL){
+        CacheNode* older = node->older;
+        free(node);
+        node = older;
+    }
+    free(cache->buckets);
+    free(cache->dir);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
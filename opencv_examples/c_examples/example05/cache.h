@@ -0,0 +1,79 @@
+/** Filename: cache.h
+*
+*   Description: a content-addressed on-disk cache of converted gray images.
+*
+*   An entry is found by the hash of the input file's bytes (XXH64, several GB/s) and its
+*   size, with a seed that stands for everything else the gray pixels depend on: the
+*   conversion weights, the regions of interest and whether cvCvtColor did the conversion.
+*   Two runs over the same bytes with the same settings find the same entry whatever the
+*   file is called, so a hit needs neither a decode nor a conversion.
+*
+*   Each entry is one file in the cache directory holding up to CACHE_MAX_PLANES gray
+*   images without row padding. Entries are written to a temporary file and renamed, so
+*   several processes can share a directory. The directory is kept under maxBytes by
+*   removing the least recently used entries; a hit touches its file, so the order
+*   survives from one run to the next.
+*
+*   All functions may be called from any number of threads.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gray.h"
+
+#define CACHE_MAX_PLANES 64             /// gray images per entry
+#define CACHE_DEFAULT_MB 1024
+
+typedef struct Cache Cache;
+
+typedef struct CacheKey{
+    uint64_t hash;
+    uint64_t size;              /// bytes of input
+} CacheKey;
+
+/** The gray images of a hit, all in one allocation */
+typedef struct CacheEntry{
+    int count;
+    GrayImage planes[CACHE_MAX_PLANES];
+    unsigned char* data;
+} CacheEntry;
+
+typedef struct CacheStats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;             /// in the directory, as far as this process knows
+    uint64_t maxBytes;
+} CacheStats;
+
+/** Return the XXH64 hash of size bytes with seed */
+uint64_t cacheHash(const void* data, size_t size, uint64_t seed);
+
+/** Return the key of an input of size bytes converted with the settings seed stands for */
+CacheKey cacheKey(const void* data, size_t size, uint64_t seed);
+
+/** Open the cache in dir, creating dir if needed, and index the entries already in it.
+*   Returns NULL if dir cannot be used. */
+Cache* cacheOpen(const char* dir, uint64_t maxBytes);
+
+/** Look key up. On a hit fill entry, which the caller frees with cacheEntryFree, and
+*   return 1; return 0 on a miss. */
+int cacheGet(Cache* cache, const CacheKey* key, CacheEntry* entry);
+
+void cacheEntryFree(CacheEntry* entry);
+
+/** Store count gray images (1 channel) under key and evict the least recently used
+*   entries over the size limit. Returns 0, or -1 if the entry was not written. */
+int cachePut(Cache* cache, const CacheKey* key, const GrayImage* planes, int count);
+
+void cacheStats(Cache* cache, CacheStats* stats);
+
+void cacheClose(Cache* cache);
+
+#endif
@@ -0,0 +1,186 @@
+/** Filename: daemon.c
+*
+*   Description: frame daemon mode of example05.
+*
+*   The daemon creates the shared-memory frame ring (framering.h) and converts the frames
+*   producers publish in it on opt->threads threads, each claiming the next frame, until
+*   it is stopped with Ctrl-C or SIGTERM. For every frame it records the time the frame
+*   waited in the ring before a thread claimed it ("queue") and the conversion itself.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "framering.h"
+#include "gray.h"
+#include "latency.h"
+#include "modes.h"
+#include "trace.h"
+
+#define DAEMON_DEFAULT_WIDTH 1920
+#define DAEMON_DEFAULT_HEIGHT 1080
+
+
+typedef struct Daemon{
+    FrameRing* ring;
+    LatencyRecorder queue;
+    LatencyRecorder convert;
+    uint64_t frames;
+    uint64_t rejected;                  /// frames whose slot held a bad geometry
+} Daemon;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+
+static void onSignal(int sig){
+    (void)sig;
+    stopRequested = 1;
+}
+
+
+/** Parse name[:slots[:WxH]] */
+static int parseSpec(const char* spec, char* name, size_t nameSize, int* slots, int* width, int* height){
+    const char* colon = strchr(spec, ':');
+    size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+
+    if(len == 0 || len >= nameSize){
+        return -1;
+    }
+    memcpy(name, spec, len);
+    name[len] = '\0';
+
+    *slots = FRAMERING_DEFAULT_SLOTS;
+    *width = DAEMON_DEFAULT_WIDTH;
+    *height = DAEMON_DEFAULT_HEIGHT;
+    if(colon == NULL){
+        return 0;
+    }
+
+    int n = sscanf(colon + 1, "%d:%dx%d", slots, width, height);
+    return n == 1 || n == 3 ? 0 : -1;
+}
+
+
+static void* daemonWorker(void* arg){
+    Daemon* d = (Daemon*)arg;
+    LatencyHistogram* queueHist = latencyRecorderThread(&d->queue);
+    LatencyHistogram* convertHist = latencyRecorderThread(&d->convert);
+    FrameRingView frame;
+
+    if(queueHist == NULL || convertHist == NULL){
+        printf("No memory allocated for the latency histograms\n");
+        return NULL;
+    }
+
+    traceThreadName("frame daemon");
+
+    int status;
+    while((status = frameRingClaim(d->ring, &frame)) != FRAMERING_STOPPED){
+        if(status == FRAMERING_TOO_LARGE){
+            __atomic_fetch_add(&d->rejected, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /** frameRingClaim checked the frame against the slot size */
+        grayConvertRows(frame.color, frame.colorStep, frame.gray, frame.grayStep,
+                        frame.width, 0, frame.height);
+        frameRingComplete(d->ring, &frame);
+
+        latencyRecord(queueHist, frame.startNs - frame.submitNs);
+        latencyRecord(convertHist, frame.doneNs - frame.startNs);
+        traceSpan("convert frame", frame.startNs);
+        __atomic_fetch_add(&d->frames, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+
+int runDaemon(const Options* opt, const char* spec){
+    char name[256];
+    int slots, width, height;
+    pthread_t threads[LATENCY_MAX_THREADS];
+    Daemon d;
+    int nthreads = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int started, i;
+
+    if(parseSpec(spec, name, sizeof(name), &slots, &width, &height) != 0){
+        printf("Bad ring %s, expected name[:slots[:widthxheight]]\n", spec);
+        return -1;
+    }
+    if(nthreads > LATENCY_MAX_THREADS) nthreads = LATENCY_MAX_THREADS;
+    if(nthreads < 1) nthreads = 1;
+
+    memset(&d, 0, sizeof(d));
+    d.ring = frameRingCreate(name, slots, width, height);
+    if(d.ring == NULL){
+        printf("Frame ring %s not created\n", name);
+        return -1;
+    }
+    latencyRecorderInit(&d.queue, "queue");
+    latencyRecorderInit(&d.convert, "convert");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    LatencyRecorder* recs[2] = { &d.queue, &d.convert };
+    LatencyReporter* reporter = NULL;
+    if(opt->reportSeconds > 0){
+        reporter = latencyReporterStart(recs, 2, opt->reportSeconds, stdout);
+    }
+
+    for(started = 0; started < nthreads; ++started){
+        if(pthread_create(&threads[started], NULL, daemonWorker, &d) != 0){
+            break;
+        }
+    }
+    if(started == 0){
+        printf("Could not start the daemon threads\n");
+        latencyReporterStop(reporter);
+        frameRingClose(d.ring);
+        return -1;
+    }
+
+    printf("Frame daemon: ring %s, %d slots of up to %d x %d, %d threads\n", name, slots,
+           width, height, started);
+    fflush(stdout);
+
+    uint64_t start = latencyNow();
+    while(!stopRequested){
+        usleep(100000);
+    }
+
+    frameRingStop(d.ring);
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (latencyNow() - start) / 1e9;
+    latencyReporterStop(reporter);
+
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(total != NULL){
+        for(i = 0; i < 2; ++i){
+            latencyRecorderSnapshot(recs[i], total);
+            latencyPrint(stdout, recs[i]->name, total);
+            latencyPrintBuckets(stdout, total);
+        }
+        free(total);
+    }
+    printf("%llu frames in %.1f s", (unsigned long long)d.frames, seconds);
+    if(d.rejected > 0){
+        printf(", %llu rejected as larger than a slot", (unsigned long long)d.rejected);
+    }
+    printf("\n");
+
+    latencyRecorderFree(&d.queue);
+    latencyRecorderFree(&d.convert);
+    frameRingClose(d.ring);
+    return 0;
+}
@@ -0,0 +1,242 @@
+/** Filename: display.c
+*
+*   Description: the display thread, see display.h.
+*
+*   The thread polls rather than sleeping on a condition variable, because the GUI toolkit
+*   only handles the window's events (repaints, resizes, key presses) inside cvWaitKey.
+*   While nothing new has been posted, it waits in cvWaitKey(DISPLAY_IDLE_MS), so a new
+*   frame is shown at most that long after it was posted.
+*
+*   The headless build (EXAMPLE05_HEADLESS) has no windows: displayStart returns NULL, so
+*   callers go on without showing frames, and no highgui window function is linked.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "display.h"
+#include "trace.h"
+
+#ifndef EXAMPLE05_HEADLESS
+
+
+typedef struct DisplayWindow{
+    const char* name;
+    IplImage* writing;          /// owned by the processing thread
+    IplImage* ready;            /// the latest complete frame, guarded by the lock
+    IplImage* shown;            /// owned by the display thread
+    int fresh;                  /// ready holds a frame not shown yet
+    int created;                /// the display thread has opened the window
+} DisplayWindow;
+
+struct Display{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    DisplayWindow windows[DISPLAY_MAX_WINDOWS];
+    int windowCount;
+    int key;                    /// last key pressed, -1 for none
+    int stopping;
+    DisplayStats stats;
+};
+
+
+static void* displayMain(void* arg){
+    Display* d = (Display*)arg;
+    int take[DISPLAY_MAX_WINDOWS];
+    int i;
+
+    traceThreadName("display");
+
+    for(;;){
+        int taken = 0;
+
+        pthread_mutex_lock(&d->lock);
+        int stopping = d->stopping;
+        int count = d->windowCount;
+        for(i = 0; i < count; ++i){
+            DisplayWindow* w = &d->windows[i];
+            take[i] = w->fresh;
+            if(w->fresh){
+                IplImage* t = w->shown;
+                w->shown = w->ready;
+                w->ready = t;
+                w->fresh = 0;
+                ++taken;
+            }
+        }
+        pthread_mutex_unlock(&d->lock);
+
+        for(i = 0; i < count; ++i){
+            DisplayWindow* w = &d->windows[i];
+            if(!take[i]){
+                continue;
+            }
+
+            uint64_t start = traceClock();
+            if(!w->created){
+                cvNamedWindow(w->name, CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
+                w->created = 1;
+            }
+            cvShowImage(w->name, w->shown);
+            traceSpan("display", start);
+        }
+
+        if(taken > 0){
+            pthread_mutex_lock(&d->lock);
+            d->stats.shown += (uint64_t)taken;
+            pthread_mutex_unlock(&d->lock);
+        }
+        if(stopping){
+            break;
+        }
+
+        int key = cvWaitKey(taken > 0 ? 1 : DISPLAY_IDLE_MS);
+        if(key >= 0){
+            pthread_mutex_lock(&d->lock);
+            d->key = key;
+            pthread_mutex_unlock(&d->lock);
+        }
+    }
+
+    for(i = 0; i < d->windowCount; ++i){
+        if(d->windows[i].created){
+            cvDestroyWindow(d->windows[i].name);
+        }
+    }
+    return NULL;
+}
+
+
+Display* displayStart(void){
+    Display* d = (Display*)calloc(1, sizeof(Display));
+    if(d == NULL){
+        return NULL;
+    }
+
+    d->key = -1;
+    pthread_mutex_init(&d->lock, NULL);
+    if(pthread_create(&d->thread, NULL, displayMain, d) != 0){
+        pthread_mutex_destroy(&d->lock);
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+
+/** Find the window called name, adding it if it is new. Only the processing thread adds
+*   windows, and a window's name is set before the count includes it. */
+static DisplayWindow* findWindow(Display* d, const char* name){
+    int i;
+    for(i = 0; i < d->windowCount; ++i){
+        if(strcmp(d->windows[i].name, name) == 0){
+            return &d->windows[i];
+        }
+    }
+    if(d->windowCount == DISPLAY_MAX_WINDOWS){
+        return NULL;
+    }
+
+    d->windows[d->windowCount].name = name;
+    pthread_mutex_lock(&d->lock);
+    ++d->windowCount;
+    pthread_mutex_unlock(&d->lock);
+    return &d->windows[d->windowCount - 1];
+}
+
+
+int displayPost(Display* d, const char* name, const IplImage* img){
+    DisplayWindow* w = findWindow(d, name);
+    if(w == NULL){
+        return -1;
+    }
+
+    /** A buffer that comes back from the other threads may have an earlier frame's size */
+    if(w->writing != NULL && (w->writing->width != img->width || w->writing->height != img->height ||
+                              w->writing->nChannels != img->nChannels || w->writing->depth != img->depth)){
+        cvReleaseImage(&w->writing);
+    }
+    if(w->writing == NULL){
+        w->writing = cvCreateImage(cvSize(img->width, img->height), img->depth, img->nChannels);
+        if(w->writing == NULL){
+            return -1;
+        }
+    }
+    cvCopy(img, w->writing, NULL);
+
+    pthread_mutex_lock(&d->lock);
+    IplImage* t = w->ready;
+    w->ready = w->writing;
+    w->writing = t;
+    if(w->fresh){
+        ++d->stats.dropped;
+    }
+    w->fresh = 1;
+    ++d->stats.posted;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+
+int displayKey(Display* d){
+    pthread_mutex_lock(&d->lock);
+    int key = d->key;
+    pthread_mutex_unlock(&d->lock);
+    return key;
+}
+
+
+void displayStop(Display* d, DisplayStats* stats){
+    int i;
+
+    if(d == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    d->stopping = 1;
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+
+    if(stats != NULL){
+        *stats = d->stats;
+    }
+    for(i = 0; i < d->windowCount; ++i){
+        cvReleaseImage(&d->windows[i].writing);
+        cvReleaseImage(&d->windows[i].ready);
+        cvReleaseImage(&d->windows[i].shown);
+    }
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+}
+
+#else
+
+Display* displayStart(void){
+    return NULL;
+}
+
+
+int displayPost(Display* d, const char* name, const IplImage* img){
+    (void)d;
+    (void)name;
+    (void)img;
+    return -1;
+}
+
+
+int displayKey(Display* d){
+    (void)d;
+    return -1;
+}
+
+
+void displayStop(Display* d, DisplayStats* stats){
+    (void)d;
+    (void)stats;
+}
+
+#endif
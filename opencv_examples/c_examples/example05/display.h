@@ -0,0 +1,48 @@
+/** Filename: display.h
+*
+*   Description: a display thread, so showing frames never holds up converting them.
+*
+*   cvShowImage and cvWaitKey take as long as the GUI toolkit needs to draw the window and
+*   handle its events, which at a 60 Hz screen can be most of a frame. The display thread
+*   makes every highgui window call itself. The processing thread hands it frames with
+*   displayPost, which copies the frame and returns at once; the display thread always
+*   shows the latest frame posted to a window, and a frame that is replaced before it was
+*   shown is dropped.
+*
+*   Each window has three buffers: one the processing thread copies into, one holding the
+*   latest complete frame, and one being shown. Posting swaps the first two under a lock,
+*   and the display thread swaps the last two, so neither thread waits for the other.
+*/
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <opencv/cv.h>
+
+#define DISPLAY_MAX_WINDOWS 4
+#define DISPLAY_IDLE_MS 5               /// cvWaitKey time while no new frame is waiting
+
+typedef struct Display Display;
+
+typedef struct DisplayStats{
+    uint64_t posted;
+    uint64_t shown;
+    uint64_t dropped;           /// replaced by a newer frame before they were shown
+} DisplayStats;
+
+/** Start the display thread. No window is opened until a frame is posted to it. Returns
+*   NULL if the thread cannot be started, and always in the headless build. */
+Display* displayStart(void);
+
+/** Copy img to be shown in the window called name, a string that must outlive the
+*   display. Returns 0, or -1 if there was no memory for the copy or no window is left. */
+int displayPost(Display* display, const char* name, const IplImage* img);
+
+/** Return the last key pressed in a window, or -1 if none was pressed */
+int displayKey(Display* display);
+
+/** Show the frames still waiting, close the windows and stop the thread */
+void displayStop(Display* display, DisplayStats* stats);
+
+#endif
@@ -9,34 +9,483 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
+#include "aligned.h"
+#include "cache.h"
+#include "gray.h"
+#include "hugepage.h"
+#include "inplace.h"
+#include "latency.h"
+#include "lowlatency.h"
+#include "modes.h"
+#include "numa.h"
+#include "pnm.h"
+#include "startup.h"
+#include "tiles.h"
+#include "trace.h"
+#include "viewer.h"
+
+#define LOWLATENCY_WARMUP_FRAMES 16     /// frames converted before timing starts
+
+
+static void usage(void){
+    printf("Usage: ./example05 [options] imageName\n"
+           "       ./example05 -b [options] imageName...\n"
+           "       ./example05 -v [options] videoFile|cameraNumber\n"
+           "       ./example05 -w paths|raw [options] < jobs\n"
+           "       ./example05 -D ring[:slots[:WxH]] [options]\n"
+           "       ./example05 -U socket[:batch[:delayus]] [options]\n"
+           "  -L          low-latency mode: convert the image repeatedly on pinned\n"
+           "              spinning threads and report the per-frame latency histogram\n"
+           "  -b          batch mode: load and convert every image named, no display\n"
+           "  -v          video mode: convert and display every frame, Esc stops\n"
+           "  -w format   worker mode: convert jobs read from stdin, one status line\n"
+           "              per job on stdout. paths: lines of 'input<TAB>output';\n"
+           "              raw: 'width height step' lines each followed by the pixels\n"
+           "  -D ring     frame daemon: convert the frames producers write into the\n"
+           "              shared-memory ring (see framegen), until Ctrl-C\n"
+           "  -U socket   conversion server: convert the raw or encoded images clients\n"
+           "              send to a Unix socket (see sockload), in batches of up to\n"
+           "              batch requests (default 16) formed within delayus (500)\n"
+           "  -n frames   frames to time in low-latency mode (default 1000)\n"
+           "  -t threads  bands per frame in low-latency mode, worker threads in batch\n"
+           "              mode (default: one per core)\n"
+           "  -c cpus     cores to pin to, e.g. 2,3,6-9 (default: isolated cores,\n"
+           "              or every core this process may use)\n"
+           "  -s spins    pause iterations before a waiting thread sleeps (default %d)\n"
+           "  -p seconds  in batch and video mode, print the load and convert\n"
+           "              percentiles of the last interval every so many seconds\n"
+           "  -o dir      in batch mode, write the gray images to dir\n"
+           "  -T file     write a Chrome trace (trace_event JSON) of every load,\n"
+           "              conversion band, cvCvtColor, write and wait to file\n"
+           "  -N          no display: never open a window (always on in headless builds)\n"
+           "  -P policy   batch mode threading: flat (a worker per core, OpenCV single\n"
+           "              threaded), nested, serial, W:T (W workers, T OpenCV threads)\n"
+           "              or auto (time them on the first image and use the fastest)\n"
+           "  -C          batch mode converts with cvCvtColor instead of libgray\n"
+           "  -r x,y,w,h  convert only this rectangle; batch mode takes up to %d and\n"
+           "              converts them all in one pass, the demo uses the first\n"
+           "  -I          in place: write the gray pixels over the color image instead\n"
+           "              of allocating gray images (demo and batch mode)\n"
+           "  -H pages    low-latency mode copies the frame into buffers of off (4 KB),\n"
+           "              thp (transparent huge) or hugetlb (reserved 2 MB) pages\n"
+           "  -M          NUMA: convert the image -n times in node-local row bands, or\n"
+           "              in batch mode run a worker group per node; reports per node\n"
+           "  -R ahead    batch mode reads up to ahead files ahead of the workers and\n"
+           "              decodes them from memory; uring:N or threads:N picks how\n"
+           "  -K dir[:MB] batch mode keeps the gray images in a cache in dir, found by\n"
+           "              the hash of the input file, and skips decoding and converting\n"
+           "              the files it finds there (default limit %d MB)\n"
+           "  -Z          show the gray image in the zoom and pan viewer instead of the\n"
+           "              three windows; with -N, time a tour of zooms and pans\n"
+           "  -d tile     video mode converts only the tiles (N or WxH pixels, e.g.\n"
+           "              %d) that changed since the previous frame\n"
+           "  -G          demo and video mode take the luminance in linear light: decode\n"
+           "              sRGB, weigh with the BT.709 weights and encode the sum again\n"
+           "  -S std      luma weights of the demo, batch and video mode: 601 (default,\n"
+           "              as cvCvtColor), 709, 2020, or R,G,B fractions e.g. 0.3,0.6,0.1\n"
+           "  -A bytes    demo and low-latency mode: pad the rows of the color and gray\n"
+           "              images to a multiple of bytes and align them (e.g. %d)\n",
+           LOWLATENCY_DEFAULT_SPINS, MODES_MAX_RECTS, CACHE_DEFAULT_MB, TILES_DEFAULT_SIZE,
+           ALIGNED_DEFAULT_BYTES);
+}
+
+
+/** Parse a rectangle given as x,y,width,height */
+static int parseRect(const char* text, GrayRect* rect){
+    char end;
+    if(sscanf(text, "%d,%d,%d,%d%c", &rect->x, &rect->y, &rect->width, &rect->height, &end) != 4 ||
+       rect->x < 0 || rect->y < 0 || rect->width <= 0 || rect->height <= 0){
+        return -1;
+    }
+    return 0;
+}
+
+
+/** Parse a tile size given as WxH, or N for N x N */
+static int parseTile(const char* text, int* width, int* height){
+    char end;
+    int n = sscanf(text, "%dx%d%c", width, height, &end);
+    if(n == 1){
+        *height = *width;
+    }
+    if((n != 1 && n != 2) || *width <= 0 || *height <= 0){
+        return -1;
+    }
+    return 0;
+}
+
+
+/** Parse a luma standard given as 601, 709 or 2020, or as R,G,B weights, and set up
+*   converter for it */
+static int parseStandard(const char* text, GrayConverter* converter){
+    static const char* const names[GRAY_STANDARD_CUSTOM] = { "601", "709", "2020" };
+    double red, green, blue;
+    GrayWeights weights;
+    char end;
+    int i;
+
+    for(i = 0; i < GRAY_STANDARD_CUSTOM; ++i){
+        if(strcmp(text, names[i]) == 0){
+            return grayConverterInit(converter, (GrayStandard)i, NULL, GRAY_KERNEL_AUTO);
+        }
+    }
+    if(sscanf(text, "%lf,%lf,%lf%c", &red, &green, &blue, &end) != 3 ||
+       grayWeightsFromFractions(&weights, red, green, blue) != GRAY_OK){
+        return -1;
+    }
+    return grayConverterInit(converter, GRAY_STANDARD_CUSTOM, &weights, GRAY_KERNEL_AUTO);
+}
+
+
+/** In-place demo: the color image becomes the gray image, and neither grayimg nor
+*   mygrayimg is allocated */
+static int runInPlace(const Options* opt, IplImage* colorimg, const char* imageName){
+    size_t colorBytes = (size_t)colorimg->imageSize;
+    size_t released;
+
+    uint64_t start = traceClock();
+    int status = inPlaceGray(colorimg, &released);
+    traceSpan("convert in place", start);
+
+    if(status != GRAY_OK){
+        printf("Conversion failed: %s\n", grayStatusString(status));
+        cvReleaseImage(&colorimg);
+        return -1;
+    }
+
+    startupFirstPixel();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\nImage: %s, height: %d, width: %d, converted in place\n", imageName,
+           colorimg->height, colorimg->width);
+    printf("color %zu bytes, gray %d bytes (widthStep %d), %zu bytes given back, peak RSS %ld KB\n",
+           colorBytes, colorimg->imageSize, colorimg->widthStep, released, usage.ru_maxrss);
+
+    if(opt->viewer){
+        int status = viewerRun(colorimg, opt->display);
+        cvReleaseImage(&colorimg);
+        return status;
+    }
+
+#ifndef EXAMPLE05_HEADLESS
+    if(opt->display){
+        cvNamedWindow("mygray", CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
+        cvShowImage("mygray", colorimg);
+        cvWaitKey(0);
+        cvDestroyAllWindows();
+    }
+#else
+    (void)opt;
+#endif
+
+    cvReleaseImage(&colorimg);
+    return 0;
+}
+
+
+/** Low-latency mode. The image is treated as a frame arriving from the inspection line
+*   and converted frames times; the time from handing the frame to the pool until the
+*   last band is written is recorded for every frame. */
+static int runLowLatency(const Options* opt, IplImage* colorimg, IplImage* mygrayimg){
+
+    const char* cpuList = opt->cpuList;
+    int threads = opt->threads;
+    int spins = opt->spins;
+    int cpus[LOWLATENCY_MAX_THREADS];
+    int ncpus = cpuList != NULL ? lowLatencyParseCpus(cpuList, cpus, LOWLATENCY_MAX_THREADS)
+                                : lowLatencyDefaultCpus(cpus, LOWLATENCY_MAX_THREADS);
+    if(ncpus < 0){
+        printf("Bad core list %s\n", cpuList);
+        return -1;
+    }
+    if(threads <= 0){
+        threads = ncpus > 0 ? ncpus : 1;
+    }
+    if(ncpus > 0 && threads > ncpus){
+        /** Two spinning threads on one core take turns instead of converting at once */
+        printf("%d threads on %d cores, using %d threads\n", threads, ncpus, ncpus);
+        threads = ncpus;
+    }
+
+    LowLatencyPool* pool = lowLatencyCreate(threads, cpus, ncpus, spins);
+    if(pool == NULL){
+        printf("Could not start %d low-latency threads\n", threads);
+        return -1;
+    }
+
+    printf("Low-latency mode: %d threads, %d pinned cores, %d spins\n", threads, ncpus, spins);
+
+    /** The histogram is too large for the stack */
+    LatencyHistogram* hist = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(hist == NULL){
+        lowLatencyDestroy(pool);
+        return -1;
+    }
+    latencyReset(hist);
+
+    int i;
+    for(i = -LOWLATENCY_WARMUP_FRAMES; i < opt->frames; ++i){
+        uint64_t start = latencyNow();
+
+        lowLatencyConvert(pool, (unsigned char*)colorimg->imageData, colorimg->widthStep,
+                          (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep,
+                          colorimg->width, colorimg->height);
+
+        if(i >= 0){
+            latencyRecord(hist, latencyNow() - start);
+        }
+    }
+
+    latencyPrint(stdout, "frame latency", hist);
+    latencyPrintBuckets(stdout, hist);
+
+    free(hist);
+    lowLatencyDestroy(pool);
+    return 0;
+}
+
+
+/** Low-latency mode on copies of the frame in huge page buffers (hugepage.h) */
+static int runLowLatencyHuge(const Options* opt, IplImage* colorimg){
+    HugePageMode mode, colorGot, grayGot;
+
+    if(hugePageParse(opt->hugePages, &mode) != 0){
+        printf("Unknown page mode %s\n", opt->hugePages);
+        return -1;
+    }
+
+    CvSize s = cvSize(colorimg->width, colorimg->height);
+    IplImage* color = hugePageCreateImage(s, colorimg->depth, 3, mode, &colorGot);
+    IplImage* gray = hugePageCreateImage(s, colorimg->depth, 1, mode, &grayGot);
+    if(color == NULL || gray == NULL){
+        printf("No memory allocated for the %s page frame buffers\n", opt->hugePages);
+        hugePageReleaseImage(&color);
+        hugePageReleaseImage(&gray);
+        return -1;
+    }
+
+    cvCopy(colorimg, color, NULL);
+    printf("Frame buffers: color %s pages, gray %s pages\n", hugePageModeName(colorGot),
+           hugePageModeName(grayGot));
+
+    int status = runLowLatency(opt, color, gray);
+
+    long hugeKB = hugePageResidentKB();
+    if(hugeKB >= 0){
+        printf("Huge pages in use: %ld KB\n", hugeKB);
+    }
+
+    hugePageReleaseImage(&color);
+    hugePageReleaseImage(&gray);
+    return status;
+}
+
 
 int main(int argc, char** argv){
 
-    /** Two arguments must be passed to the program.
-    *   argv[0] is the name of the executable
-    *   argv[1] is the name of the image file to open
+    Options opt = { .frames = 1000, .spins = LOWLATENCY_DEFAULT_SPINS, .display = 1 };
+    int lowLatency = 0, batch = 0, video = 0;
+    const char* traceFile = NULL;
+    const char* workerFormat = NULL;
+    const char* ringSpec = NULL;
+    const char* socketSpec = NULL;
+    int c;
+
+    grayConverterInit(&opt.converter, GRAY_STANDARD_BT601, NULL, GRAY_KERNEL_AUTO);
+
+    while((c = getopt(argc, argv, "LbvNCIMZGw:n:t:c:s:p:o:T:P:r:H:R:D:U:K:d:S:A:")) != -1){
+        switch(c){
+            case 'L': lowLatency = 1; break;
+            case 'b': batch = 1; break;
+            case 'v': video = 1; break;
+            case 'w': workerFormat = optarg; break;
+            case 'N': opt.display = 0; break;
+            case 'C': opt.useOpenCV = 1; break;
+            case 'I': opt.inPlace = 1; break;
+            case 'H': opt.hugePages = optarg; break;
+            case 'M': opt.numa = 1; break;
+            case 'Z': opt.viewer = 1; break;
+            case 'G': opt.linear = 1; break;
+            case 'S':
+                if(parseStandard(optarg, &opt.converter) != GRAY_OK){
+                    printf("Bad luma standard %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'A':
+                if(alignedParse(optarg, &opt.rowAlign) != 0){
+                    printf("Bad row alignment %s: a power of two from 4 to %d\n", optarg, ALIGNED_MAX_BYTES);
+                    return -1;
+                }
+                break;
+            case 'R': opt.readAhead = optarg; break;
+            case 'K': opt.cacheDir = optarg; break;
+            case 'd':
+                if(parseTile(optarg, &opt.tileWidth, &opt.tileHeight) != 0){
+                    printf("Bad tile size %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'D': ringSpec = optarg; break;
+            case 'U': socketSpec = optarg; break;
+            case 'P': opt.threadPolicy = optarg; break;
+            case 'n': opt.frames = atoi(optarg); break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 'c': opt.cpuList = optarg; break;
+            case 's': opt.spins = atoi(optarg); break;
+            case 'p': opt.reportSeconds = atof(optarg); break;
+            case 'o': opt.outputDir = optarg; break;
+            case 'T': traceFile = optarg; break;
+            case 'r':
+                if(opt.rectCount == MODES_MAX_RECTS || parseRect(optarg, &opt.rects[opt.rectCount]) != 0){
+                    printf("Bad or too many rectangles: %s\n", optarg);
+                    return -1;
+                }
+                ++opt.rectCount;
+                break;
+            default: usage(); return -1;
+        }
+    }
+
+    /** After the options, at least one argument must be passed to the program:
+    *   the name of the image file to open, or the video or camera in video mode.
+    *   Worker mode reads its jobs from stdin, the daemon its frames from the ring and the
+    *   server its images from the socket instead.
     */
-    if(argc < 2){
-        printf("Usage: ./example05 imageName");
+    if(optind >= argc && workerFormat == NULL && ringSpec == NULL && socketSpec == NULL){
+        usage();
+        return -1;
+    }
+
+    /** The trace is written when the program exits, whichever mode ran */
+    if(traceFile != NULL){
+        if(traceStart(traceFile) != 0){
+            printf("Trace file %s not created\n", traceFile);
+            return -1;
+        }
+        atexit(traceFinish);
+        traceThreadName("main");
+    }
+
+    if(opt.rectCount > 0 && (lowLatency || video || workerFormat != NULL || ringSpec != NULL ||
+                             socketSpec != NULL)){
+        printf("-r is only supported by the demo and batch mode\n");
+        return -1;
+    }
+
+    if(opt.inPlace && (opt.rectCount > 0 || opt.useOpenCV || lowLatency || video || workerFormat != NULL ||
+                       ringSpec != NULL || socketSpec != NULL)){
+        printf("-I is only supported by the demo and batch mode, without -r or -C\n");
+        return -1;
+    }
+
+    if(opt.numa && (opt.inPlace || (!batch && opt.rectCount > 0) || lowLatency || video || workerFormat != NULL ||
+                    ringSpec != NULL || socketSpec != NULL)){
+        printf("-M is only supported by the demo and batch mode, without -I (or -r in the demo)\n");
+        return -1;
+    }
+
+    if(opt.viewer && (lowLatency || batch || video || workerFormat != NULL || ringSpec != NULL ||
+                      socketSpec != NULL)){
+        printf("-Z is only supported by the demo\n");
         return -1;
     }
 
+    if(opt.tileWidth > 0 && !video){
+        printf("-d is only supported by video mode\n");
+        return -1;
+    }
+
+    if(opt.linear && (lowLatency || batch || opt.inPlace || opt.numa || opt.tileWidth > 0 ||
+                      workerFormat != NULL || ringSpec != NULL || socketSpec != NULL)){
+        printf("-G is only supported by the demo and video mode, without -L, -I, -M or -d\n");
+        return -1;
+    }
+
+    if(opt.converter.standard != GRAY_STANDARD_BT601 &&
+       (lowLatency || opt.inPlace || opt.numa || opt.useOpenCV || opt.linear || opt.tileWidth > 0 ||
+        (batch && opt.rectCount > 0) || workerFormat != NULL || ringSpec != NULL || socketSpec != NULL)){
+        printf("-S is only supported by the demo, batch and video mode, without -L, -I, -M, -C, -G\n"
+               "or -d (or -r in batch mode)\n");
+        return -1;
+    }
+
+    if(opt.rowAlign > 0 && (opt.hugePages != NULL || batch || video || workerFormat != NULL ||
+                            ringSpec != NULL || socketSpec != NULL)){
+        printf("-A is only supported by the demo and low-latency mode, without -H\n");
+        return -1;
+    }
+
+    if(opt.cacheDir != NULL && !batch){
+        printf("-K is only supported by batch mode\n");
+        return -1;
+    }
+
+    if(ringSpec != NULL){
+        return runDaemon(&opt, ringSpec);
+    }
+    if(socketSpec != NULL){
+        return runServer(&opt, socketSpec);
+    }
+    if(workerFormat != NULL){
+        return runWorker(&opt, workerFormat);
+    }
+    if(batch){
+        return runBatch(&opt, argv + optind, argc - optind);
+    }
+    if(video){
+        return runVideo(&opt, argv[optind]);
+    }
+
+    const char* imageName = argv[optind];
+
     /** Load the input image.
     *   Note: loading the image with this C function dynamically creates memory for the image data.
     *   Later we will need to release the image to free this memory.
     */
-    IplImage* colorimg = cvLoadImage(argv[1],1);
+    uint64_t start = traceClock();
+    IplImage* colorimg = pnmLoadColor(imageName);
+    traceSpanFile("load", start, imageName);
 
     /** The pointer will be NULL if the image was not correctly opened and loaded into memory */
     if(colorimg == NULL){
 
-        printf("File %s not opened, program ending\n", argv[1]);
+        printf("File %s not opened, program ending\n", imageName);
         return -1;
     }
 
+    /** With -A, work on a copy of the image whose rows are padded and aligned (aligned.h) */
+    if(opt.rowAlign > 0){
+        IplImage* aligned = alignedCloneImage(colorimg, opt.rowAlign);
+        cvReleaseImage(&colorimg);
+        if(aligned == NULL){
+            printf("No memory allocated for the aligned color image\n");
+            return -1;
+        }
+        colorimg = aligned;
+    }
+
+#ifdef EXAMPLE05_HEADLESS
+    opt.display = 0;
+#endif
+
+    if(opt.inPlace){
+        return runInPlace(&opt, colorimg, imageName);
+    }
+    if(opt.numa){
+        int status = runNuma(&opt, colorimg);
+        cvReleaseImage(&colorimg);
+        return status;
+    }
+
     /** We want to convert our color image to a grayscale image. First, let's declare two
     *   IplImage pointers for our grayscale images. We will create one grayscale image with
     *   OpenCV's cvCvtColor function and a second grayscale image by accessing and manipulating
@@ -62,9 +511,29 @@ int main(int argc, char** argv){
     *
     */
 
+    /** Often only part of the image is needed, such as a detected face. A region of
+    *   interest (ROI) makes OpenCV functions work on that rectangle only:
+    *
+    *   void cvSetImageROI(IplImage* image, CvRect rect)
+    *
+    *   The ROI is stored in the IplImage struct; imageData and widthStep are unchanged.
+    *   cvGetImageROI returns it, or the whole image when no ROI is set. The gray images
+    *   then only need the size of the ROI.
+    */
+    if(opt.rectCount > 0){
+        GrayRect r = opt.rects[0];
+        if(r.x > colorimg->width - r.width || r.y > colorimg->height - r.height){
+            printf("Rectangle %d,%d,%d,%d is not inside the image\n", r.x, r.y, r.width, r.height);
+            cvReleaseImage(&colorimg);
+            return -1;
+        }
+        cvSetImageROI(colorimg, cvRect(r.x, r.y, r.width, r.height));
+    }
+    CvRect roi = cvGetImageROI(colorimg);
+
     /** Remember, colorimg is a pointer to an IplImage struct. To access the struct's data
     *   members, use the notation -> */
-    CvSize s = cvSize(colorimg->width, colorimg->height);
+    CvSize s = cvSize(roi.width, roi.height);
 
     /** The grayscale image depth will be the same as the color image's depth. Depth refers to
     *   the number of bits of the image pixels. Typically, we will work with 8 bit unsigned
@@ -75,7 +544,7 @@ int main(int argc, char** argv){
     /** Now, let's call the cvCreateImage function, passing our size and depth parameters.
     *   The channel parameter will be 1. Grayscale only has 1 intensity channel for pixel values.
     */
-    grayimg = cvCreateImage(s, d, 1);
+    grayimg = opt.rowAlign > 0 ? alignedCreateImage(s, d, 1, opt.rowAlign) : cvCreateImage(s, d, 1);
 
 
     /** Let's verify memory was allocated. We will terminate the program in this case.
@@ -87,7 +556,7 @@ int main(int argc, char** argv){
     }
 
     /** Create another image to store our grayscale results */
-    mygrayimg = cvCreateImage(s, d, 1);
+    mygrayimg = opt.rowAlign > 0 ? alignedCreateImage(s, d, 1, opt.rowAlign) : cvCreateImage(s, d, 1);
 
     if(mygrayimg == NULL){
         printf("No memory allocated for mygrayimg\n");
@@ -121,7 +590,9 @@ int main(int argc, char** argv){
     *
     */
 
+    start = traceClock();
     cvCvtColor(colorimg, grayimg, CV_BGR2GRAY);
+    traceSpan("cvCvtColor", start);
 
 
     /** Now, let's create a grayscale image by accessing the color image pixel data and then
@@ -152,39 +623,82 @@ int main(int argc, char** argv){
     *
     *   0080        0098        00B0        00C8        00E0        0100
     *   pixel(1,0)  pixel(1,1)  pixel(1,2)  pixel(1,3)  pixel(1,4)  garbage
+    *
+    *   benchkernels measures what the width, the padding and the alignment of the rows cost
+    *   the conversion kernels (readme.txt, section 27).
     */
 
 
     /// Let's display some information about the color image
-    printf("\nImage: %s, height: %d, width: %d, widthStep: %d\n", argv[1], colorimg->height,
+    printf("\nImage: %s, height: %d, width: %d, widthStep: %d\n", imageName, colorimg->height,
             colorimg->width, colorimg->widthStep);
 
     printf("colorimg->width * 24: %d bits, widthStep * 8: %d bits\n", colorimg->width * 24,
             colorimg->widthStep * 8);
 
-    int row, col;
-    unsigned char blue, green, red, gray;
-
     unsigned char* colorData = (unsigned char*)colorimg->imageData;
     unsigned char* grayData = (unsigned char*)mygrayimg->imageData;
 
     int colorstep = colorimg->widthStep/sizeof(uchar);
     int graystep = mygrayimg->widthStep/sizeof(uchar);
-    for(row = 0; row < colorimg->height; ++row){
-        for(col = 0; col < colorimg->width; ++col){
-            /// remember color data is BGR. First byte is blue, second byte is green, ...
-            blue = colorData[row * colorstep + col];
-            green = colorData[row * colorstep + col + 1];
-            red = colorData[row * colorstep + col + 2];
-
-            /// calculate gray = 0.299 * R + 0.587 * G + 0.114 B
-            gray = 0.299 * red + 0.587 * green + 0.114 * blue;
-
-            /// store in mygrayimg data
-            grayData[row * graystep + col] = gray;
-        }
+
+    /** The loop over the rows and columns lives in libgray (gray.h), which checks the
+    *   arguments, picks the fastest kernel for this CPU and can also be used on its own.
+    *   The converter holds the kernel for the weights of the luma standard (-S).
+    *   The ROI starts roi.y rows and 3 * roi.x bytes into imageData, and each row of it
+    *   is colorstep bytes after the one before, like the rows of the whole image; only
+    *   the pixels inside it are read. */
+    const unsigned char* roiData = colorData + (size_t)roi.y * colorstep + 3 * (size_t)roi.x;
+    int status;
+    start = traceClock();
+    if(opt.linear){
+        status = grayConvertLinear(roiData, colorstep, grayData, graystep, roi.width, roi.height);
+    }
+    else{
+        status = grayConverterConvert(&opt.converter, roiData, colorstep, grayData, graystep,
+                                      roi.width, roi.height);
+    }
+    traceSpan("convert", start);
+
+    if(status != GRAY_OK){
+        printf("Conversion failed: %s\n", grayStatusString(status));
+        cvReleaseImage(&colorimg);
+        cvReleaseImage(&grayimg);
+        cvReleaseImage(&mygrayimg);
+        return -1;
     }
 
+    startupFirstPixel();
+
+    if(lowLatency){
+        status = opt.hugePages != NULL ? runLowLatencyHuge(&opt, colorimg)
+                                       : runLowLatency(&opt, colorimg, mygrayimg);
+        cvReleaseImage(&colorimg);
+        cvReleaseImage(&grayimg);
+        cvReleaseImage(&mygrayimg);
+        return status;
+    }
+
+    /** A large image is better shown a window at a time. The viewer builds its pyramid
+    *   from the gray image, so the other two images are not needed for it. */
+    if(opt.viewer){
+        cvReleaseImage(&colorimg);
+        cvReleaseImage(&grayimg);
+        status = viewerRun(mygrayimg, opt.display);
+        cvReleaseImage(&mygrayimg);
+        return status;
+    }
+
+    /** The GUI toolkit is initialized by the first cvNamedWindow call, which can take
+    *   longer than everything above. Without a display it is never initialized. */
+    if(!opt.display){
+        cvReleaseImage(&colorimg);
+        cvReleaseImage(&grayimg);
+        cvReleaseImage(&mygrayimg);
+        return 0;
+    }
+
+#ifndef EXAMPLE05_HEADLESS
     /** Display the images */
     cvNamedWindow("color", CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
     cvNamedWindow("gray", CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
@@ -205,15 +719,16 @@ int main(int argc, char** argv){
 
     cvShowImage("color", colorimg);
     cvShowImage("gray", grayimg);
-    cvShowImage("mygray", grayimg);
+    cvShowImage("mygray", mygrayimg);
 
     cvWaitKey(0);         /// Display images until user presses a key
 
     /** Free memory, or as the OpenCV book says: Don't be a piggy, clean up */
     cvReleaseImage(&colorimg);
-    cvReleaseImage(&colorimg);
+    cvReleaseImage(&grayimg);
+    cvReleaseImage(&mygrayimg);
     cvDestroyAllWindows();
-
+#endif
 
     return 0;
 }
@@ -0,0 +1,89 @@
+/** Filename: example05mat.cpp
+*
+*   Description: example05 ported to OpenCV's C++ API.
+*
+*   The legacy C API of example05.c (IplImage, cvLoadImage, cvCvtColor) was removed in
+*   OpenCV 4, and since OpenCV 3 cv::cvtColor converts with universal intrinsics (SIMD)
+*   and splits the image across threads with parallel_for_. This program does the same
+*   as example05's demo with cv::Mat: it loads the image, converts it with cv::cvtColor
+*   and with libgray, counts the pixels where the two differ and displays the results.
+*
+*   Every image has exactly one owner (MatImage or gray::Image) and is freed when the
+*   owner goes out of scope, so there is nothing to release by hand.
+*
+*   Usage: ./example05-mat [-N] imageName
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "gray.hpp"
+#include "matimage.hpp"
+
+
+int main(int argc, char** argv){
+    bool display = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "N")) != -1){
+        switch(opt){
+            case 'N': display = false; break;
+            default:
+                printf("Usage: ./example05-mat [-N] imageName\n");
+                return -1;
+        }
+    }
+    if(optind >= argc){
+        printf("Usage: ./example05-mat [-N] imageName\n");
+        return -1;
+    }
+    const char* imageName = argv[optind];
+
+    try{
+        MatImage color = loadColor(imageName);
+        const cv::Mat& c = color.mat();
+
+        printf("\nImage: %s, height: %d, width: %d, step: %d\n", imageName, c.rows, c.cols,
+               static_cast<int>(c.step));
+
+        /** OpenCV's conversion */
+        MatImage gray(c.rows, c.cols, CV_8UC1);
+        cv::cvtColor(c, gray.mat(), cv::COLOR_BGR2GRAY);
+
+        /** Our conversion, straight from the cv::Mat pixels */
+        gray::Image mygray(c.cols, c.rows, 1);
+        gray::convert(c.data, static_cast<int>(c.step), mygray.data(), mygray.step(), c.cols, c.rows);
+
+        int differ = 0;
+        for(int row = 0; row < c.rows; ++row){
+            const unsigned char* a = gray.mat().ptr(row);
+            const unsigned char* b = mygray.row(row);
+            for(int col = 0; col < c.cols; ++col){
+                differ += a[col] != b[col];
+            }
+        }
+        printf("cv::cvtColor and libgray differ in %d of %d pixels\n", differ, c.rows * c.cols);
+
+        if(display){
+            cv::namedWindow("color", cv::WINDOW_NORMAL | cv::WINDOW_KEEPRATIO);
+            cv::namedWindow("gray", cv::WINDOW_NORMAL | cv::WINDOW_KEEPRATIO);
+            cv::namedWindow("mygray", cv::WINDOW_NORMAL | cv::WINDOW_KEEPRATIO);
+            cv::imshow("color", c);
+            cv::imshow("gray", gray.mat());
+            cv::imshow("mygray", matView(mygray));
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
+    }
+    catch(const std::exception& e){             /// cv::Exception, gray::Error, std::runtime_error
+        printf("%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,250 @@
+/** Filename: framegen.c
+*
+*   Description: load generator for the frame daemon (example05 -D).
+*
+*   Usage: ./framegen [-n frames] [-r fps] [-c consumers] [-s widthxheight] [-V] ring
+*
+*   A producer thread writes frames (one of four random images, in turn) into the ring
+*   at fps frames per second, or as fast as the daemon takes them with -r 0, and
+*   consumer threads each read every gray frame. Reported are the producer's frame rate
+*   and, as histograms, the time from publishing a frame until the daemon finished it
+*   ("daemon") and until a consumer saw it ("consumer"), plus the frames consumers lost to
+*   being lapped. With -V the consumers compare every gray frame with a conversion done
+*   locally.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "framering.h"
+#include "gray.h"
+#include "latency.h"
+
+#define FRAMEGEN_IMAGES 4
+#define FRAMEGEN_MAX_CONSUMERS 64
+
+
+typedef struct Generator{
+    FrameRing* ring;
+    int frames;
+    double fps;
+    int verify;
+    int width, height, colorStep, grayStep;
+    unsigned char* color[FRAMEGEN_IMAGES];
+    unsigned char* gray[FRAMEGEN_IMAGES];      /// expected results
+    uint64_t firstSeq;
+    LatencyRecorder daemon;
+    LatencyRecorder consumer;
+    int lapped;
+    int torn;                   /// frames that changed while being read
+    int wrong;                  /// frames that did not match the expected gray
+    int rejected;               /// frames the daemon found larger than a slot
+} Generator;
+
+
+static void* consumerMain(void* arg){
+    Generator* g = (Generator*)arg;
+    LatencyHistogram* daemonHist = latencyRecorderThread(&g->daemon);
+    LatencyHistogram* consumerHist = latencyRecorderThread(&g->consumer);
+    FrameRingView frame;
+    int i;
+
+    if(daemonHist == NULL || consumerHist == NULL){
+        return NULL;
+    }
+
+    for(i = 0; i < g->frames; ++i){
+        uint64_t seq = g->firstSeq + (uint64_t)i;
+        int status = frameRingWaitGray(g->ring, seq, &frame);
+        if(status == FRAMERING_LAPPED){
+            __atomic_fetch_add(&g->lapped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(status == FRAMERING_TOO_LARGE){
+            __atomic_fetch_add(&g->rejected, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(status != FRAMERING_OK){
+            break;
+        }
+
+        uint64_t seen = latencyNow();
+        int wrong = 0;
+        if(g->verify){
+            const unsigned char* expected = g->gray[i % FRAMEGEN_IMAGES];
+            int row;
+            for(row = 0; row < frame.height && !wrong; ++row){
+                wrong = memcmp(frame.gray + (size_t)row * frame.grayStep,
+                               expected + (size_t)row * g->grayStep, (size_t)frame.width) != 0;
+            }
+        }
+
+        if(!frameRingStillValid(g->ring, seq)){
+            __atomic_fetch_add(&g->torn, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(wrong){
+            __atomic_fetch_add(&g->wrong, 1, __ATOMIC_RELAXED);
+        }
+        latencyRecord(daemonHist, frame.doneNs - frame.submitNs);
+        latencyRecord(consumerHist, seen - frame.submitNs);
+    }
+
+    return NULL;
+}
+
+
+/** Write the frames, pacing them at g->fps */
+static int produce(Generator* g){
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long periodNs = g->fps > 0 ? (long)(1e9 / g->fps) : 0;
+    int i;
+
+    for(i = 0; i < g->frames; ++i){
+        unsigned char* color;
+        uint64_t seq;
+        int status = frameRingAcquire(g->ring, g->width, g->height, g->colorStep, &color, &seq);
+        if(status != FRAMERING_OK){
+            printf("Frame %d not written: %s\n", i,
+                   status == FRAMERING_TOO_LARGE ? "larger than a slot" : "the daemon stopped");
+            return -1;
+        }
+
+        memcpy(color, g->color[i % FRAMEGEN_IMAGES], (size_t)g->colorStep * g->height);
+        frameRingPublish(g->ring, seq);
+
+        if(periodNs > 0){
+            next.tv_nsec += periodNs;
+            while(next.tv_nsec >= 1000000000){
+                next.tv_nsec -= 1000000000;
+                ++next.tv_sec;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    Generator g;
+    int consumers = 1;
+    int opt, i;
+
+    memset(&g, 0, sizeof(g));
+    g.frames = 1000;
+    g.fps = 0;
+    g.width = 1920;
+    g.height = 1080;
+
+    while((opt = getopt(argc, argv, "n:r:c:s:V")) != -1){
+        switch(opt){
+            case 'n': g.frames = atoi(optarg); break;
+            case 'r': g.fps = atof(optarg); break;
+            case 'c': consumers = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &g.width, &g.height) != 0){
+                    g.width = 0;
+                }
+                break;
+            case 'V': g.verify = 1; break;
+            default: g.width = 0; break;
+        }
+    }
+    if(optind >= argc || g.width == 0 || g.frames < 1 || consumers < 0 || consumers > FRAMEGEN_MAX_CONSUMERS){
+        printf("Usage: ./framegen [-n frames] [-r fps] [-c consumers] [-s widthxheight] [-V] ring\n");
+        return -1;
+    }
+
+    g.ring = frameRingOpen(argv[optind]);
+    if(g.ring == NULL){
+        printf("Frame ring %s not found; start example05 -D %s first\n", argv[optind], argv[optind]);
+        return -1;
+    }
+
+    /** Checked before any consumer starts, as they would wait for frames never written */
+    int maxWidth, maxHeight;
+    frameRingMaxSize(g.ring, &maxWidth, &maxHeight);
+    if(g.width > maxWidth || g.height > maxHeight){
+        printf("Frames of %d x %d do not fit in ring %s, whose slots hold up to %d x %d\n",
+               g.width, g.height, argv[optind], maxWidth, maxHeight);
+        frameRingClose(g.ring);
+        return -1;
+    }
+
+    g.colorStep = (3 * g.width + 3) & ~3;
+    g.grayStep = (g.width + 3) & ~3;
+    for(i = 0; i < FRAMEGEN_IMAGES; ++i){
+        size_t n;
+        g.color[i] = (unsigned char*)malloc((size_t)g.colorStep * g.height);
+        g.gray[i] = (unsigned char*)malloc((size_t)g.grayStep * g.height);
+        if(g.color[i] == NULL || g.gray[i] == NULL){
+            printf("No memory allocated for the frames\n");
+            return -1;
+        }
+        for(n = 0; n < (size_t)g.colorStep * g.height; ++n){
+            g.color[i][n] = (unsigned char)rand();
+        }
+        grayConvert(g.color[i], g.colorStep, g.gray[i], g.grayStep, g.width, g.height);
+    }
+
+    latencyRecorderInit(&g.daemon, "daemon");
+    latencyRecorderInit(&g.consumer, "consumer");
+
+    /** Consumers start at the frame the producer will write first */
+    g.firstSeq = frameRingHead(g.ring);
+
+    pthread_t threads[FRAMEGEN_MAX_CONSUMERS];
+    int started;
+    for(started = 0; started < consumers; ++started){
+        if(pthread_create(&threads[started], NULL, consumerMain, &g) != 0){
+            break;
+        }
+    }
+
+    printf("%d frames of %d x %d, %s, %d consumers\n", g.frames, g.width, g.height,
+           g.fps > 0 ? "paced" : "as fast as possible", started);
+    uint64_t start = latencyNow();
+    int status = produce(&g);
+    double seconds = (latencyNow() - start) / 1e9;
+
+    /** The consumers are waiting for frames the producer gave up on */
+    if(status != 0){
+        frameRingCancel(g.ring);
+    }
+
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("producer: %.1f frames/s\n", g.frames / seconds);
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(total != NULL && started > 0){
+        latencyRecorderSnapshot(&g.daemon, total);
+        latencyPrint(stdout, "daemon", total);
+        latencyRecorderSnapshot(&g.consumer, total);
+        latencyPrint(stdout, "consumer", total);
+        latencyPrintBuckets(stdout, total);
+        printf("consumers: %d frames lapped, %d torn, %d rejected", g.lapped, g.torn, g.rejected);
+        if(g.verify){
+            printf(", %d wrong", g.wrong);
+        }
+        printf("\n");
+    }
+    free(total);
+
+    for(i = 0; i < FRAMEGEN_IMAGES; ++i){
+        free(g.color[i]);
+        free(g.gray[i]);
+    }
+    latencyRecorderFree(&g.daemon);
+    latencyRecorderFree(&g.consumer);
+    frameRingClose(g.ring);
+    return status == 0 && g.wrong == 0 && g.rejected == 0 ? 0 : -1;
+}
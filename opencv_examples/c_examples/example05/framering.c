@@ -0,0 +1,434 @@
+/** Filename: framering.c
+*
+*   Description: a shared-memory ring of frame slots. See framering.h.
+*
+*   Layout of the shared memory object: the header and the slot descriptors, then the
+*   color pixels of every slot, then the gray pixels of every slot, each region starting
+*   on a page boundary.
+*
+*   Slot protocol. turn is the frame allowed to take the slot next, initially the slot's
+*   index. A producer with frame n waits until turn is n, sets the state to WRITING and
+*   seq to n, writes the pixels and sets the state to READY. The daemon thread claiming
+*   frame n waits until seq is n and the state READY, sets CONVERTING, converts, sets
+*   DONE and finally advances turn to n + slots. A consumer of frame n waits until seq is
+*   n and the state DONE, reads the gray pixels and then checks that both are unchanged;
+*   a producer taking the slot for a later frame changes them before anything is
+*   overwritten, so a changed slot means the read may have been torn.
+*
+*   All the process-shared waits are futex waits on one of two counters, published and
+*   completed, with a timeout so that a stop or a cancel is noticed. A process that dies
+*   is not: if a producer dies between frameRingAcquire and frameRingPublish, the daemon
+*   waits for its frame, and every later frame behind it, until the ring is recreated.
+*/
+
+#define _GNU_SOURCE
+#include "framering.h"
+#include "latency.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpuRelax() _mm_pause()
+#else
+#define cpuRelax() ((void)0)
+#endif
+
+#define FRAMERING_MAGIC 0x31524746u     /// "FGR1"
+#define FRAMERING_SPINS 20000           /// pause iterations before a waiter sleeps
+#define FRAMERING_WAIT_NS 100000000     /// futex timeout, to notice a stop or cancel
+#define FRAMERING_PAGE 4096
+
+enum { SLOT_FREE, SLOT_WRITING, SLOT_READY, SLOT_CONVERTING, SLOT_DONE };
+
+typedef struct Slot{
+    _Alignas(64) _Atomic uint64_t turn;
+    _Atomic uint64_t seq;
+    atomic_uint state;
+
+    /** Written by whoever holds the slot, published by the following state change */
+    int width, height, colorStep, grayStep;
+    int rejected;                       /// the daemon found the frame larger than the slot
+    uint64_t submitNs, startNs, doneNs;
+} Slot;
+
+typedef struct Shared{
+    uint32_t magic;
+    uint32_t slots;
+    int32_t maxWidth;
+    int32_t maxHeight;
+    uint64_t colorBytes;                /// per slot
+    uint64_t grayBytes;
+    uint64_t colorOffset;
+    uint64_t grayOffset;
+    uint64_t size;
+
+    _Alignas(64) _Atomic uint64_t head;         /// next frame for a producer
+    _Alignas(64) _Atomic uint64_t claimNext;    /// next frame for the daemon
+    _Alignas(64) atomic_uint published;         /// bumped by every publish
+    atomic_int publishSleepers;
+    _Alignas(64) atomic_uint completed;         /// bumped by every complete
+    atomic_int completeSleepers;
+    atomic_uint stop;
+
+    Slot slot[];
+} Shared;
+
+struct FrameRing{
+    Shared* shm;
+    unsigned char* base;
+    size_t size;
+    int owner;
+    atomic_int cancelled;               /// this attachment only, see frameRingCancel
+    char name[NAME_MAX];
+};
+
+
+static size_t pageRound(size_t n){
+    return (n + FRAMERING_PAGE - 1) & ~(size_t)(FRAMERING_PAGE - 1);
+}
+
+
+/** Wait while *word is value: spin, then sleep on the futex. Futexes on shared memory
+*   must not use the PRIVATE operations. */
+static void waitWhileEqual(atomic_uint* word, unsigned value, atomic_int* sleepers){
+    int i;
+
+    for(i = 0; i < FRAMERING_SPINS; ++i){
+        if(atomic_load_explicit(word, memory_order_acquire) != value){
+            return;
+        }
+        cpuRelax();
+    }
+
+    struct timespec timeout = { 0, FRAMERING_WAIT_NS };
+    atomic_fetch_add(sleepers, 1);
+    if(atomic_load(word) == value){
+        syscall(SYS_futex, (unsigned*)word, FUTEX_WAIT, value, &timeout, NULL, 0);
+    }
+    atomic_fetch_sub(sleepers, 1);
+}
+
+
+/** Whether a wait should give up: the daemon stopped or this attachment was cancelled */
+static int stopped(FrameRing* ring){
+    return atomic_load(&ring->shm->stop) || atomic_load(&ring->cancelled);
+}
+
+
+static void bumpAndWake(atomic_uint* word, atomic_int* sleepers){
+    atomic_fetch_add(word, 1);
+    if(atomic_load(sleepers) > 0){
+        syscall(SYS_futex, (unsigned*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+
+static FrameRing* mapRing(const char* name, int fd, size_t size, int owner){
+    FrameRing* ring = (FrameRing*)calloc(1, sizeof(FrameRing));
+    if(ring == NULL){
+        return NULL;
+    }
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED){
+        free(ring);
+        return NULL;
+    }
+
+    ring->shm = (Shared*)p;
+    ring->base = (unsigned char*)p;
+    ring->size = size;
+    ring->owner = owner;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    return ring;
+}
+
+
+FrameRing* frameRingCreate(const char* name, int slots, int maxWidth, int maxHeight){
+    if(slots < 1 || slots > FRAMERING_MAX_SLOTS || maxWidth < 1 || maxHeight < 1 ||
+       maxWidth > INT_MAX / 3 - 3){
+        return NULL;
+    }
+
+    size_t header = pageRound(sizeof(Shared) + (size_t)slots * sizeof(Slot));
+    size_t colorBytes = pageRound((size_t)((3 * maxWidth + 3) & ~3) * (size_t)maxHeight);
+    size_t grayBytes = pageRound((size_t)((maxWidth + 3) & ~3) * (size_t)maxHeight);
+    size_t size = header + (size_t)slots * (colorBytes + grayBytes);
+
+    /** Replace a ring left behind by a daemon that did not exit cleanly */
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0){
+        return NULL;
+    }
+    if(ftruncate(fd, (off_t)size) != 0){
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    FrameRing* ring = mapRing(name, fd, size, 1);
+    close(fd);
+    if(ring == NULL){
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /** ftruncate zero filled the object, so only the non-zero fields need setting */
+    Shared* shm = ring->shm;
+    shm->slots = (uint32_t)slots;
+    shm->maxWidth = maxWidth;
+    shm->maxHeight = maxHeight;
+    shm->colorBytes = colorBytes;
+    shm->grayBytes = grayBytes;
+    shm->colorOffset = header;
+    shm->grayOffset = header + (size_t)slots * colorBytes;
+    shm->size = size;
+
+    int i;
+    for(i = 0; i < slots; ++i){
+        atomic_store(&shm->slot[i].turn, (uint64_t)i);
+    }
+
+    /** Clients check the magic number last, so they never see a half built header */
+    atomic_thread_fence(memory_order_release);
+    shm->magic = FRAMERING_MAGIC;
+    return ring;
+}
+
+
+FrameRing* frameRingOpen(const char* name){
+    struct stat st;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Shared)){
+        close(fd);
+        return NULL;
+    }
+
+    FrameRing* ring = mapRing(name, fd, (size_t)st.st_size, 0);
+    close(fd);
+    if(ring == NULL){
+        return NULL;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    if(ring->shm->magic != FRAMERING_MAGIC || ring->shm->size != ring->size){
+        frameRingClose(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+
+void frameRingClose(FrameRing* ring){
+    if(ring == NULL){
+        return;
+    }
+    munmap(ring->base, ring->size);
+    if(ring->owner){
+        shm_unlink(ring->name);
+    }
+    free(ring);
+}
+
+
+int frameRingSlots(const FrameRing* ring){
+    return (int)ring->shm->slots;
+}
+
+
+void frameRingMaxSize(const FrameRing* ring, int* width, int* height){
+    *width = ring->shm->maxWidth;
+    *height = ring->shm->maxHeight;
+}
+
+
+static Slot* slotOf(FrameRing* ring, uint64_t seq){
+    return &ring->shm->slot[seq % ring->shm->slots];
+}
+
+
+/** Fill a view of the frame in the slot */
+static void viewOf(FrameRing* ring, uint64_t seq, FrameRingView* view){
+    Shared* shm = ring->shm;
+    Slot* slot = slotOf(ring, seq);
+    size_t index = seq % shm->slots;
+
+    view->seq = seq;
+    view->width = slot->width;
+    view->height = slot->height;
+    view->color = ring->base + shm->colorOffset + index * shm->colorBytes;
+    view->colorStep = slot->colorStep;
+    view->gray = ring->base + shm->grayOffset + index * shm->grayBytes;
+    view->grayStep = slot->grayStep;
+    view->submitNs = slot->submitNs;
+    view->startNs = slot->startNs;
+    view->doneNs = slot->doneNs;
+}
+
+
+int frameRingAcquire(FrameRing* ring, int width, int height, int colorStep,
+                     unsigned char** color, uint64_t* seq){
+    Shared* shm = ring->shm;
+
+    if(width < 1 || height < 1 || width > shm->maxWidth || height > shm->maxHeight ||
+       colorStep < 3 * width || (uint64_t)colorStep * (uint64_t)height > shm->colorBytes){
+        return FRAMERING_TOO_LARGE;
+    }
+
+    uint64_t n = atomic_fetch_add(&shm->head, 1);
+    Slot* slot = slotOf(ring, n);
+
+    /** Wait for frame n - slots to be converted */
+    for(;;){
+        unsigned completed = atomic_load(&shm->completed);
+        if(atomic_load_explicit(&slot->turn, memory_order_acquire) == n){
+            break;
+        }
+        if(stopped(ring)){
+            return FRAMERING_STOPPED;
+        }
+        waitWhileEqual(&shm->completed, completed, &shm->completeSleepers);
+    }
+
+    /** Consumers still reading frame n - slots see the slot change and drop it */
+    atomic_store(&slot->state, SLOT_WRITING);
+    atomic_store(&slot->seq, n);
+    slot->width = width;
+    slot->height = height;
+    slot->colorStep = colorStep;
+    slot->grayStep = (width + 3) & ~3;
+    slot->rejected = 0;
+
+    *color = ring->base + shm->colorOffset + (n % shm->slots) * shm->colorBytes;
+    *seq = n;
+    return FRAMERING_OK;
+}
+
+
+void frameRingPublish(FrameRing* ring, uint64_t seq){
+    Slot* slot = slotOf(ring, seq);
+
+    slot->submitNs = latencyNow();
+    atomic_store_explicit(&slot->state, SLOT_READY, memory_order_release);
+    bumpAndWake(&ring->shm->published, &ring->shm->publishSleepers);
+}
+
+
+int frameRingClaim(FrameRing* ring, FrameRingView* view){
+    Shared* shm = ring->shm;
+    uint64_t n = atomic_fetch_add(&shm->claimNext, 1);
+    Slot* slot = slotOf(ring, n);
+
+    for(;;){
+        unsigned published = atomic_load(&shm->published);
+        if(atomic_load_explicit(&slot->seq, memory_order_acquire) == n &&
+           atomic_load_explicit(&slot->state, memory_order_acquire) == SLOT_READY){
+            break;
+        }
+        if(stopped(ring)){
+            return FRAMERING_STOPPED;
+        }
+        waitWhileEqual(&shm->published, published, &shm->publishSleepers);
+    }
+
+    /** The state change must be visible before the first gray byte is overwritten */
+    atomic_store(&slot->state, SLOT_CONVERTING);
+    atomic_thread_fence(memory_order_release);
+    slot->startNs = latencyNow();
+    viewOf(ring, n, view);
+
+    /** Any process attached to the ring can write the slot, so the geometry the view
+    *   copied is checked again before the daemon converts with it */
+    if(view->width < 1 || view->height < 1 || view->width > shm->maxWidth ||
+       view->height > shm->maxHeight || view->colorStep < 3 * view->width ||
+       (uint64_t)view->colorStep * (uint64_t)view->height > shm->colorBytes ||
+       view->grayStep < view->width ||
+       (uint64_t)view->grayStep * (uint64_t)view->height > shm->grayBytes){
+        slot->rejected = 1;
+        frameRingComplete(ring, view);
+        return FRAMERING_TOO_LARGE;
+    }
+    return FRAMERING_OK;
+}
+
+
+void frameRingComplete(FrameRing* ring, FrameRingView* view){
+    Shared* shm = ring->shm;
+    Slot* slot = slotOf(ring, view->seq);
+
+    slot->doneNs = view->doneNs = latencyNow();
+    atomic_store_explicit(&slot->state, SLOT_DONE, memory_order_release);
+    atomic_store_explicit(&slot->turn, view->seq + shm->slots, memory_order_release);
+    bumpAndWake(&shm->completed, &shm->completeSleepers);
+}
+
+
+int frameRingWaitGray(FrameRing* ring, uint64_t seq, FrameRingView* view){
+    Shared* shm = ring->shm;
+    Slot* slot = slotOf(ring, seq);
+
+    for(;;){
+        unsigned completed = atomic_load(&shm->completed);
+        uint64_t s = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        unsigned state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+        if(s == seq && state == SLOT_DONE){
+            viewOf(ring, seq, view);
+            return slot->rejected ? FRAMERING_TOO_LARGE : FRAMERING_OK;
+        }
+        if(s > seq){
+            return FRAMERING_LAPPED;
+        }
+        if(stopped(ring)){
+            return FRAMERING_STOPPED;
+        }
+        waitWhileEqual(&shm->completed, completed, &shm->completeSleepers);
+    }
+}
+
+
+int frameRingStillValid(FrameRing* ring, uint64_t seq){
+    Slot* slot = slotOf(ring, seq);
+
+    /** The reads of the pixels must not move after these loads */
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load(&slot->seq) == seq && atomic_load(&slot->state) == SLOT_DONE;
+}
+
+
+uint64_t frameRingHead(FrameRing* ring){
+    return atomic_load(&ring->shm->head);
+}
+
+
+void frameRingCancel(FrameRing* ring){
+    atomic_store(&ring->cancelled, 1);
+}
+
+
+void frameRingStop(FrameRing* ring){
+    Shared* shm = ring->shm;
+
+    atomic_store(&shm->stop, 1);
+    atomic_fetch_add(&shm->published, 1);
+    atomic_fetch_add(&shm->completed, 1);
+    syscall(SYS_futex, (unsigned*)&shm->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    syscall(SYS_futex, (unsigned*)&shm->completed, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,113 @@
+/** Filename: framering.h
+*
+*   Description: a shared-memory ring of frame slots between producers, the frame daemon
+*   and consumers.
+*
+*   The ring lives in a POSIX shared memory object (/dev/shm) created by the daemon
+*   (example05 -D). Each slot holds one BGR frame, written by a producer with its own
+*   widthStep, and the gray frame the daemon converts from it. Frames are numbered in the
+*   order producers acquire them, and frame n uses slot n % slots. Nothing is copied and
+*   no lock is taken: producers and consumers work on the slot memory directly, and the
+*   slots are handed between the processes through atomic state words, with a futex to
+*   sleep on once spinning has not paid off.
+*
+*   Frame n goes through
+*
+*       producer: frameRingAcquire, write the BGR pixels, frameRingPublish
+*       daemon:   frameRingClaim, convert, frameRingComplete
+*       consumer: frameRingWaitGray, read the gray pixels, frameRingStillValid
+*
+*   A producer acquiring frame n waits until frame n - slots has been converted, so the
+*   daemon applies back-pressure to producers. Consumers never hold producers up: a slow
+*   consumer may find its frame already replaced by a later one, which frameRingWaitGray
+*   and frameRingStillValid report, as a seqlock reader would.
+*/
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdint.h>
+
+#define FRAMERING_DEFAULT_SLOTS 8
+#define FRAMERING_MAX_SLOTS 1024
+
+typedef struct FrameRing FrameRing;
+
+/** What a wait returns */
+enum{
+    FRAMERING_OK = 0,
+    FRAMERING_STOPPED = -1,             /// the daemon has stopped
+    FRAMERING_LAPPED = -2,              /// the frame was replaced by a later one
+    FRAMERING_TOO_LARGE = -3            /// the frame does not fit in a slot
+};
+
+/** A frame as the daemon or a consumer sees it */
+typedef struct FrameRingView{
+    uint64_t seq;
+    int width;
+    int height;
+    const unsigned char* color;
+    int colorStep;
+    unsigned char* gray;
+    int grayStep;
+    uint64_t submitNs;                  /// latencyNow() at frameRingPublish
+    uint64_t startNs;                   /// when the daemon claimed it
+    uint64_t doneNs;                    /// when the daemon completed it
+} FrameRingView;
+
+/** Create the shared memory object name (such as "/example05") holding slots slots for
+*   frames of up to maxWidth x maxHeight. An existing object of that name is replaced.
+*   Returns NULL on failure. */
+FrameRing* frameRingCreate(const char* name, int slots, int maxWidth, int maxHeight);
+
+/** Attach to the ring a daemon created. Returns NULL if there is none. */
+FrameRing* frameRingOpen(const char* name);
+
+/** Detach from the ring; the creator also removes the shared memory object */
+void frameRingClose(FrameRing* ring);
+
+/** Number of slots, and the largest frame a slot holds */
+int frameRingSlots(const FrameRing* ring);
+void frameRingMaxSize(const FrameRing* ring, int* width, int* height);
+
+/** Producer: reserve the next frame for a width x height image with rows colorStep bytes
+*   apart, waiting while its slot is still in use. color receives where to write the BGR
+*   pixels and seq the frame number. Returns FRAMERING_OK, FRAMERING_TOO_LARGE or
+*   FRAMERING_STOPPED. */
+int frameRingAcquire(FrameRing* ring, int width, int height, int colorStep,
+                     unsigned char** color, uint64_t* seq);
+
+/** Producer: hand frame seq, whose pixels have been written, to the daemon */
+void frameRingPublish(FrameRing* ring, uint64_t seq);
+
+/** Daemon: wait for the next published frame and claim it. Several threads may claim
+*   frames at once. Returns FRAMERING_OK, FRAMERING_STOPPED, or FRAMERING_TOO_LARGE if
+*   the frame's geometry in the slot does not fit the slot, in which case the frame has
+*   already been completed unconverted and the caller claims the next one. */
+int frameRingClaim(FrameRing* ring, FrameRingView* view);
+
+/** Daemon: mark a claimed frame converted and wake the consumers */
+void frameRingComplete(FrameRing* ring, FrameRingView* view);
+
+/** Consumer: wait until frame seq has been converted. Returns FRAMERING_OK,
+*   FRAMERING_LAPPED if the slot already holds a later frame, FRAMERING_TOO_LARGE if the
+*   daemon rejected the frame unconverted, or FRAMERING_STOPPED. */
+int frameRingWaitGray(FrameRing* ring, uint64_t seq, FrameRingView* view);
+
+/** Consumer: after reading the gray pixels of frame seq, return 1 if they were not
+*   overwritten meanwhile, 0 if the frame must be dropped */
+int frameRingStillValid(FrameRing* ring, uint64_t seq);
+
+/** The number of the next frame a producer will get; a consumer joining late starts here */
+uint64_t frameRingHead(FrameRing* ring);
+
+/** Make the waits of this attachment return FRAMERING_STOPPED, as if the daemon had
+*   stopped, without affecting the daemon or other processes. A thread already asleep in
+*   a wait notices within the futex timeout (0.1 s). For a producer that gives up, so its
+*   own consumers do not wait for frames it will never write. */
+void frameRingCancel(FrameRing* ring);
+
+/** Daemon: tell everyone attached to stop, waking all waiters */
+void frameRingStop(FrameRing* ring);
+
+#endif
@@ -0,0 +1,550 @@
+/** Filename: gray.c
+*
+*   Description: libgray, the color to grayscale conversion library behind example05.
+*
+*   This file holds the parts of the library around the kernels: checking arguments,
+*   allocating images and choosing the kernel for this CPU and standard.
+*/
+
+#include "gray.h"
+#include "graykernels.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char* const kernelNames[GRAY_KERNEL_COUNT] = { "auto", "scalar", "ssse3", "avx2" };
+static const char* const standardNames[GRAY_STANDARD_COUNT] = { "bt601", "bt709", "bt2020", "custom" };
+
+static const GrayWeights standardWeights[GRAY_STANDARD_CUSTOM] = {
+    { GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R },
+    { GRAY_BT709_WEIGHT_B, GRAY_BT709_WEIGHT_G, GRAY_BT709_WEIGHT_R },
+    { GRAY_BT2020_WEIGHT_B, GRAY_BT2020_WEIGHT_G, GRAY_BT2020_WEIGHT_R }
+};
+
+/** The specialized kernels, [standard][kernel], and the kernels taking weights */
+static const GrayRowKernel standardKernels[GRAY_STANDARD_CUSTOM][GRAY_KERNEL_COUNT] = {
+#ifdef GRAY_HAVE_X86
+    { grayRowScalar, grayRowScalar, grayRowSsse3, grayRowAvx2 },
+    { grayRowScalarBt709, grayRowScalarBt709, grayRowSsse3Bt709, grayRowAvx2Bt709 },
+    { grayRowScalarBt2020, grayRowScalarBt2020, grayRowSsse3Bt2020, grayRowAvx2Bt2020 }
+#else
+    { grayRowScalar, grayRowScalar },
+    { grayRowScalarBt709, grayRowScalarBt709 },
+    { grayRowScalarBt2020, grayRowScalarBt2020 }
+#endif
+};
+
+static const GrayRowKernelWeights weightKernels[GRAY_KERNEL_COUNT] = {
+#ifdef GRAY_HAVE_X86
+    grayRowScalarWeights, grayRowScalarWeights, grayRowSsse3Weights, grayRowAvx2Weights
+#else
+    grayRowScalarWeights, grayRowScalarWeights
+#endif
+};
+
+/** The kernel GRAY_KERNEL_AUTO resolves to. Several threads may resolve it at once;
+*   they all store the same value, so the race is harmless. */
+static int bestKernel = GRAY_KERNEL_AUTO;
+
+
+const char* grayStatusString(int status){
+    switch(status){
+        case GRAY_OK: return "ok";
+        case GRAY_ERR_NULL: return "pixel pointer is NULL";
+        case GRAY_ERR_SIZE: return "width or height out of range";
+        case GRAY_ERR_STEP: return "row step smaller than a row";
+        case GRAY_ERR_OVERLAP: return "color and gray pixels overlap";
+        case GRAY_ERR_NOMEM: return "out of memory";
+        case GRAY_ERR_KERNEL: return "kernel not supported by this CPU";
+        case GRAY_ERR_RECT: return "rectangle not inside the image";
+        case GRAY_ERR_WEIGHTS: return "weights negative or above 1 in all";
+        default: return "unknown error";
+    }
+}
+
+
+const char* grayKernelName(GrayKernel kernel){
+    if((int)kernel < 0 || (int)kernel >= GRAY_KERNEL_COUNT){
+        return "unknown";
+    }
+    return kernelNames[kernel];
+}
+
+
+const char* grayStandardName(GrayStandard standard){
+    if((int)standard < 0 || (int)standard >= GRAY_STANDARD_COUNT){
+        return "unknown";
+    }
+    return standardNames[standard];
+}
+
+
+int grayKernelSupported(GrayKernel kernel){
+    switch(kernel){
+        case GRAY_KERNEL_AUTO:
+        case GRAY_KERNEL_SCALAR:
+            return 1;
+#ifdef GRAY_HAVE_X86
+        case GRAY_KERNEL_SSSE3:
+            return __builtin_cpu_supports("ssse3") ? 1 : 0;
+        case GRAY_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+
+GrayKernel grayKernelBest(void){
+    int k = __atomic_load_n(&bestKernel, __ATOMIC_RELAXED);
+
+    if(k == GRAY_KERNEL_AUTO){
+        for(k = GRAY_KERNEL_COUNT - 1; k > GRAY_KERNEL_SCALAR; --k){
+            if(grayKernelSupported((GrayKernel)k)){
+                break;
+            }
+        }
+        __atomic_store_n(&bestKernel, k, __ATOMIC_RELAXED);
+    }
+
+    return (GrayKernel)k;
+}
+
+
+static GrayRowKernel rowKernel(GrayKernel kernel){
+    if(kernel == GRAY_KERNEL_AUTO){
+        kernel = grayKernelBest();
+    }
+
+    switch(kernel){
+#ifdef GRAY_HAVE_X86
+        case GRAY_KERNEL_SSSE3: return grayRowSsse3;
+        case GRAY_KERNEL_AVX2: return grayRowAvx2;
+#endif
+        default: return grayRowScalar;
+    }
+}
+
+
+int grayStandardWeights(GrayStandard standard, GrayWeights* weights){
+    if(weights == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if((int)standard < 0 || standard >= GRAY_STANDARD_CUSTOM){
+        return GRAY_ERR_WEIGHTS;
+    }
+
+    *weights = standardWeights[standard];
+    return GRAY_OK;
+}
+
+
+int grayWeightsFromFractions(GrayWeights* weights, double red, double green, double blue){
+    const int one = 1 << GRAY_SHIFT;
+
+    if(weights == NULL){
+        return GRAY_ERR_NULL;
+    }
+    /** Written so NaN fails too */
+    if(!(red >= 0 && green >= 0 && blue >= 0 && red + green + blue <= 1.0 + 1e-9)){
+        return GRAY_ERR_WEIGHTS;
+    }
+
+    weights->b = (int)(blue * one + 0.5);
+    weights->g = (int)(green * one + 0.5);
+    weights->r = (int)(red * one + 0.5);
+
+    /** Rounding up all three can add up to more than one; take it from the largest */
+    int excess = weights->b + weights->g + weights->r - one;
+    if(excess > 0){
+        int* largest = weights->g >= weights->r ? &weights->g : &weights->r;
+        if(weights->b > *largest){
+            largest = &weights->b;
+        }
+        *largest -= excess;
+    }
+    return GRAY_OK;
+}
+
+
+int grayConverterInit(GrayConverter* converter, GrayStandard standard, const GrayWeights* weights,
+                      GrayKernel kernel){
+    if(converter == NULL){
+        return GRAY_ERR_NULL;
+    }
+    memset(converter, 0, sizeof(*converter));
+
+    if(!grayKernelSupported(kernel)){
+        return GRAY_ERR_KERNEL;
+    }
+    if(kernel == GRAY_KERNEL_AUTO){
+        kernel = grayKernelBest();
+    }
+
+    if(standard == GRAY_STANDARD_CUSTOM){
+        if(weights == NULL){
+            return GRAY_ERR_NULL;
+        }
+        if(weights->b < 0 || weights->g < 0 || weights->r < 0 ||
+           weights->b + weights->g + weights->r > 1 << GRAY_SHIFT){
+            return GRAY_ERR_WEIGHTS;
+        }
+        converter->weights = *weights;
+        converter->rowWeights = weightKernels[kernel];
+    }
+    else{
+        int status = grayStandardWeights(standard, &converter->weights);
+        if(status != GRAY_OK){
+            return status;
+        }
+        converter->row = standardKernels[standard][kernel];
+    }
+
+    converter->standard = standard;
+    converter->kernel = kernel;
+    return GRAY_OK;
+}
+
+
+int grayConverterConvert(const GrayConverter* converter,
+                         const unsigned char* colorData, int colorStep,
+                         unsigned char* grayData, int grayStep,
+                         int width, int height){
+    if(converter == NULL){
+        return GRAY_ERR_NULL;
+    }
+
+    int status = grayValidate(colorData, colorStep, grayData, grayStep, width, height);
+    if(status != GRAY_OK){
+        return status;
+    }
+
+    grayConverterRows(converter, colorData, colorStep, grayData, grayStep, width, 0, height);
+    return GRAY_OK;
+}
+
+
+void grayConverterRows(const GrayConverter* converter,
+                       const unsigned char* colorData, int colorStep,
+                       unsigned char* grayData, int grayStep,
+                       int width, int rowStart, int rowEnd){
+    int row;
+
+    if(converter->row != NULL){
+        GrayRowKernel convertRow = converter->row;
+        for(row = rowStart; row < rowEnd; ++row){
+            convertRow(colorData + (size_t)row * colorStep, grayData + (size_t)row * grayStep, width);
+        }
+    }
+    else{
+        GrayRowKernelWeights convertRow = converter->rowWeights;
+        for(row = rowStart; row < rowEnd; ++row){
+            convertRow(colorData + (size_t)row * colorStep, grayData + (size_t)row * grayStep, width,
+                       &converter->weights);
+        }
+    }
+}
+
+
+int grayImageCreate(GrayImage* img, int width, int height, int channels){
+    if(img == NULL){
+        return GRAY_ERR_NULL;
+    }
+    memset(img, 0, sizeof(*img));
+
+    if(width <= 0 || height <= 0 || channels <= 0 || width > INT32_MAX / 4 / channels){
+        return GRAY_ERR_SIZE;
+    }
+
+    int step = (width * channels + 3) & ~3;
+    if((size_t)step * (size_t)height > SIZE_MAX / 2){
+        return GRAY_ERR_SIZE;
+    }
+
+    img->data = (unsigned char*)malloc((size_t)step * (size_t)height);
+    if(img->data == NULL){
+        return GRAY_ERR_NOMEM;
+    }
+
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    img->step = step;
+    return GRAY_OK;
+}
+
+
+void grayImageRelease(GrayImage* img){
+    if(img != NULL){
+        free(img->data);
+        memset(img, 0, sizeof(*img));
+    }
+}
+
+
+int grayValidate(const unsigned char* colorData, int colorStep,
+                 const unsigned char* grayData, int grayStep,
+                 int width, int height){
+
+    if(colorData == NULL || grayData == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(width <= 0 || height <= 0 || width > INT32_MAX / 3){
+        return GRAY_ERR_SIZE;
+    }
+    if(colorStep < 3 * width || grayStep < width){
+        return GRAY_ERR_STEP;
+    }
+
+    /** The byte ranges from the first pixel to one past the last pixel must not overlap */
+    uintptr_t colorBegin = (uintptr_t)colorData;
+    uintptr_t colorEnd = colorBegin + (uintptr_t)colorStep * (uintptr_t)(height - 1) + 3 * (uintptr_t)width;
+    uintptr_t grayBegin = (uintptr_t)grayData;
+    uintptr_t grayEnd = grayBegin + (uintptr_t)grayStep * (uintptr_t)(height - 1) + (uintptr_t)width;
+    if(colorEnd < colorBegin || grayEnd < grayBegin){
+        return GRAY_ERR_SIZE;
+    }
+    if(colorBegin < grayEnd && grayBegin < colorEnd){
+        return GRAY_ERR_OVERLAP;
+    }
+
+    return GRAY_OK;
+}
+
+
+int grayConvertWith(GrayKernel kernel,
+                    const unsigned char* colorData, int colorStep,
+                    unsigned char* grayData, int grayStep,
+                    int width, int height){
+
+    int status = grayValidate(colorData, colorStep, grayData, grayStep, width, height);
+    if(status != GRAY_OK){
+        return status;
+    }
+    if(!grayKernelSupported(kernel)){
+        return GRAY_ERR_KERNEL;
+    }
+
+    grayConvertRowsWith(kernel, colorData, colorStep, grayData, grayStep, width, 0, height);
+    return GRAY_OK;
+}
+
+
+int grayConvert(const unsigned char* colorData, int colorStep,
+                unsigned char* grayData, int grayStep,
+                int width, int height){
+
+    return grayConvertWith(GRAY_KERNEL_AUTO, colorData, colorStep, grayData, grayStep, width, height);
+}
+
+
+int grayConvertImage(const GrayImage* src, GrayImage* dst){
+    if(src == NULL || dst == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(src->channels != 3 || dst->channels != 1 ||
+       src->width != dst->width || src->height != dst->height){
+        return GRAY_ERR_SIZE;
+    }
+
+    return grayConvert(src->data, src->step, dst->data, dst->step, src->width, src->height);
+}
+
+
+/** Check that rect lies inside the image and that its gray buffer can hold it */
+static int validateRect(const unsigned char* colorData, int colorStep, int width, int height,
+                        GrayRect rect, const unsigned char* grayData, int grayStep){
+
+    if(colorData == NULL || grayData == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(width <= 0 || height <= 0 || width > INT32_MAX / 3){
+        return GRAY_ERR_SIZE;
+    }
+    if(colorStep < 3 * width){
+        return GRAY_ERR_STEP;
+    }
+    if(rect.width <= 0 || rect.height <= 0 || rect.x < 0 || rect.y < 0 ||
+       rect.x > width - rect.width || rect.y > height - rect.height){
+        return GRAY_ERR_RECT;
+    }
+
+    return grayValidate(colorData + (size_t)rect.y * colorStep + 3 * (size_t)rect.x, colorStep,
+                        grayData, grayStep, rect.width, rect.height);
+}
+
+
+int grayConvertRect(const unsigned char* colorData, int colorStep, int width, int height,
+                    GrayRect rect, unsigned char* grayData, int grayStep){
+
+    int status = validateRect(colorData, colorStep, width, height, rect, grayData, grayStep);
+    if(status != GRAY_OK){
+        return status;
+    }
+
+    /** Column rect.x of a row is 3 * rect.x bytes after its first pixel */
+    grayConvertRows(colorData + (size_t)rect.y * colorStep + 3 * (size_t)rect.x, colorStep,
+                    grayData, grayStep, rect.width, 0, rect.height);
+    return GRAY_OK;
+}
+
+
+typedef struct RectOrder{
+    int y;
+    int index;
+} RectOrder;
+
+
+static int compareRectOrder(const void* a, const void* b){
+    const RectOrder* ra = (const RectOrder*)a;
+    const RectOrder* rb = (const RectOrder*)b;
+    return ra->y != rb->y ? (ra->y < rb->y ? -1 : 1) : ra->index - rb->index;
+}
+
+
+int grayConvertRects(const unsigned char* colorData, int colorStep, int width, int height,
+                     const GrayRect* rects, int count,
+                     unsigned char* const* grayData, const int* grayStep){
+
+    if(count <= 0){
+        return GRAY_OK;
+    }
+    if(rects == NULL || grayData == NULL || grayStep == NULL){
+        return GRAY_ERR_NULL;
+    }
+
+    int i;
+    for(i = 0; i < count; ++i){
+        int status = validateRect(colorData, colorStep, width, height, rects[i],
+                                  grayData[i], grayStep[i]);
+        if(status != GRAY_OK){
+            return status;
+        }
+    }
+
+    /** Sorted by their top row, the rectangles crossing a row are among those from first
+    *   up to the first one starting below the row */
+    RectOrder* order = (RectOrder*)malloc((size_t)count * sizeof(*order));
+    if(order == NULL){
+        return GRAY_ERR_NOMEM;
+    }
+    for(i = 0; i < count; ++i){
+        order[i].y = rects[i].y;
+        order[i].index = i;
+    }
+    qsort(order, (size_t)count, sizeof(*order), compareRectOrder);
+
+    GrayRowKernel convertRow = rowKernel(GRAY_KERNEL_AUTO);
+    int first = 0;              /// rectangles before first end above the current row
+    int row = order[0].y;
+
+    while(first < count){
+        const unsigned char* colorRow = colorData + (size_t)row * colorStep;
+        int next = height;      /// the next row crossed by any rectangle
+
+        for(i = first; i < count && order[i].y <= row; ++i){
+            const GrayRect* r = &rects[order[i].index];
+            if(row < r->y + r->height){
+                convertRow(colorRow + 3 * (size_t)r->x,
+                           grayData[order[i].index] + (size_t)(row - r->y) * grayStep[order[i].index],
+                           r->width);
+                next = row + 1;
+            }
+        }
+        if(i < count && order[i].y < next){
+            next = order[i].y;  /// skip the rows between rectangles
+        }
+
+        /** Drop finished rectangles from the front; one finished behind an unfinished one is
+        *   skipped by the row test above until the front catches up */
+        while(first < count && rects[order[first].index].y + rects[order[first].index].height <= next){
+            ++first;
+        }
+        row = next;
+    }
+
+    free(order);
+    return GRAY_OK;
+}
+
+
+int grayConvertInPlace(unsigned char* data, int colorStep, int width, int height, int* grayStep){
+    if(data == NULL || grayStep == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(width <= 0 || height <= 0 || width > INT32_MAX / 3){
+        return GRAY_ERR_SIZE;
+    }
+    if(colorStep < 3 * width){
+        return GRAY_ERR_STEP;
+    }
+
+    int step = (width + 3) & ~3;
+    if(step > colorStep){
+        step = colorStep;
+    }
+
+    /** Gray pixel col of row r goes to r * step + col, color pixel col of row r starts at
+    *   r * colorStep + 3 * col, which is never before it */
+    GrayRowKernel convertRow = rowKernel(GRAY_KERNEL_AUTO);
+    int row;
+    for(row = 0; row < height; ++row){
+        convertRow(data + (size_t)row * colorStep, data + (size_t)row * step, width);
+    }
+
+    *grayStep = step;
+    return GRAY_OK;
+}
+
+
+int grayImageToGray(GrayImage* img){
+    if(img == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(img->channels != 3){
+        return GRAY_ERR_SIZE;
+    }
+
+    int step;
+    int status = grayConvertInPlace(img->data, img->step, img->width, img->height, &step);
+    if(status != GRAY_OK){
+        return status;
+    }
+
+    /** Shrinking cannot fail in a way that loses the pixels: on failure the larger block
+    *   is still valid */
+    unsigned char* data = (unsigned char*)realloc(img->data, (size_t)step * (size_t)img->height);
+    if(data != NULL){
+        img->data = data;
+    }
+    img->channels = 1;
+    img->step = step;
+    return GRAY_OK;
+}
+
+
+void grayConvertRowsWith(GrayKernel kernel,
+                         const unsigned char* colorData, int colorStep,
+                         unsigned char* grayData, int grayStep,
+                         int width, int rowStart, int rowEnd){
+
+    GrayRowKernel convertRow = rowKernel(kernel);
+    int row;
+
+    for(row = rowStart; row < rowEnd; ++row){
+        /** Each row starts widthStep bytes after the previous one */
+        convertRow(colorData + (size_t)row * colorStep, grayData + (size_t)row * grayStep, width);
+    }
+}
+
+
+void grayConvertRows(const unsigned char* colorData, int colorStep,
+                     unsigned char* grayData, int grayStep,
+                     int width, int rowStart, int rowEnd){
+
+    grayConvertRowsWith(GRAY_KERNEL_AUTO, colorData, colorStep, grayData, grayStep,
+                        width, rowStart, rowEnd);
+}
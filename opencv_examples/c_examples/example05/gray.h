@@ -0,0 +1,276 @@
+/** Filename: gray.h
+*
+*   Description: libgray, the color to grayscale conversion library behind example05.
+*
+*   The library works on raw pixel pointers, row steps and sizes instead of IplImage
+*   structs, so it can be called from any program and on any band of rows by any thread.
+*   See example05.c for an explanation of widthStep and how the pixel data is laid out in
+*   memory. Every function is reentrant: the library has no state besides the kernel
+*   chosen for this CPU, which never changes once chosen.
+*
+*   Gray is computed as OpenCV's cvCvtColor(CV_BGR2GRAY) computes it for 8 bit images,
+*
+*       gray = (1868 * B + 9617 * G + 4899 * R + 8192) >> 14
+*
+*   which is 0.114 * B + 0.587 * G + 0.299 * R in 14 bit fixed point, rounded. Every kernel
+*   gives exactly the same result.
+*
+*   Those are the BT.601 weights. HD video uses the BT.709 weights and UHD the BT.2020
+*   weights; a GrayConverter converts with the weights of any of the three standards, or
+*   with weights of the caller's, and gives the same result as the formula above with
+*   those weights in 14 bit fixed point. Every other function uses the BT.601 weights.
+*
+*   The formula weighs the gamma encoded sRGB bytes. grayConvertLinear weighs the light
+*   intensities instead: it decodes each channel to linear light, takes the luminance with
+*   the sRGB (BT.709) weights below and encodes it back to an sRGB byte.
+*
+*   Functions that can fail return GRAY_OK or one of the negative GrayStatus codes.
+*   C++ programs can use gray.hpp instead, which turns the codes into exceptions.
+*/
+
+#ifndef GRAY_H
+#define GRAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GRAY_SHIFT 14                   /// fixed point fraction bits
+#define GRAY_WEIGHT_B 1868              /// 0.114 * 2^14
+#define GRAY_WEIGHT_G 9617              /// 0.587 * 2^14
+#define GRAY_WEIGHT_R 4899              /// 0.299 * 2^14
+
+#define GRAY_BT709_WEIGHT_B 1183        /// 0.0722 * 2^14
+#define GRAY_BT709_WEIGHT_G 11718       /// 0.7152 * 2^14
+#define GRAY_BT709_WEIGHT_R 3483        /// 0.2126 * 2^14
+
+#define GRAY_BT2020_WEIGHT_B 972        /// 0.0593 * 2^14
+#define GRAY_BT2020_WEIGHT_G 11108      /// 0.6780 * 2^14
+#define GRAY_BT2020_WEIGHT_R 4304       /// 0.2627 * 2^14
+
+#define GRAY_LINEAR_WEIGHT_B 0.0722     /// luminance of linear sRGB
+#define GRAY_LINEAR_WEIGHT_G 0.7152
+#define GRAY_LINEAR_WEIGHT_R 0.2126
+
+typedef enum GrayStatus{
+    GRAY_OK = 0,
+    GRAY_ERR_NULL = -1,                 /// a pixel pointer is NULL
+    GRAY_ERR_SIZE = -2,                 /// width or height is not positive, or too large
+    GRAY_ERR_STEP = -3,                 /// a row step is smaller than a row of pixels
+    GRAY_ERR_OVERLAP = -4,              /// the color and gray pixels overlap
+    GRAY_ERR_NOMEM = -5,                /// memory could not be allocated
+    GRAY_ERR_KERNEL = -6,               /// the kernel is not supported by this CPU
+    GRAY_ERR_RECT = -7,                 /// a rectangle is empty or not inside the image
+    GRAY_ERR_WEIGHTS = -8               /// a weight is negative or they add up to more than 1
+} GrayStatus;
+
+/** The implementations of the conversion. GRAY_KERNEL_AUTO picks the fastest one this
+*   CPU supports. */
+typedef enum GrayKernel{
+    GRAY_KERNEL_AUTO = 0,
+    GRAY_KERNEL_SCALAR,                 /// plain C, one pixel at a time
+    GRAY_KERNEL_SSSE3,                  /// 16 pixels at a time, x86 with SSSE3
+    GRAY_KERNEL_AVX2,                   /// 32 pixels at a time, x86 with AVX2
+    GRAY_KERNEL_COUNT
+} GrayKernel;
+
+/** The luma coefficients a GrayConverter can convert with */
+typedef enum GrayStandard{
+    GRAY_STANDARD_BT601 = 0,            /// 0.299 R + 0.587 G + 0.114 B, SD video and cvCvtColor
+    GRAY_STANDARD_BT709,                /// 0.2126 R + 0.7152 G + 0.0722 B, HD video
+    GRAY_STANDARD_BT2020,               /// 0.2627 R + 0.6780 G + 0.0593 B, UHD video
+    GRAY_STANDARD_CUSTOM,               /// weights given by the caller
+    GRAY_STANDARD_COUNT
+} GrayStandard;
+
+/** The weights of the channels in GRAY_SHIFT bit fixed point */
+typedef struct GrayWeights{
+    int b;
+    int g;
+    int r;
+} GrayWeights;
+
+/** A conversion with chosen weights and kernel, set up by grayConverterInit. The three
+*   standards have their own kernels with the weights compiled in, so converting with
+*   any of them costs the same; custom weights use kernels that take them as an argument.
+*   A converter is never changed by converting and may be used by any number of threads. */
+typedef struct GrayConverter{
+    GrayStandard standard;
+    GrayKernel kernel;                  /// never GRAY_KERNEL_AUTO
+    GrayWeights weights;
+    void (*row)(const unsigned char* color, unsigned char* gray, int width);
+    void (*rowWeights)(const unsigned char* color, unsigned char* gray, int width,
+                       const GrayWeights* weights);
+} GrayConverter;
+
+/** An image whose pixel memory is owned by the library */
+typedef struct GrayImage{
+    unsigned char* data;                /// row 0, column 0
+    int width;
+    int height;
+    int channels;                       /// 3 for BGR, 1 for gray
+    int step;                           /// bytes between successive rows
+} GrayImage;
+
+/** A region of interest: the pixels [x, x + width) of rows [y, y + height) */
+typedef struct GrayRect{
+    int x;
+    int y;
+    int width;
+    int height;
+} GrayRect;
+
+/** Return a short description of a GrayStatus code */
+const char* grayStatusString(int status);
+
+/** Return the name of a kernel, such as "avx2" */
+const char* grayKernelName(GrayKernel kernel);
+
+/** Return the name of a standard, such as "bt709" */
+const char* grayStandardName(GrayStandard standard);
+
+/** Return 1 if this CPU can run the kernel, 0 if not */
+int grayKernelSupported(GrayKernel kernel);
+
+/** Return the kernel GRAY_KERNEL_AUTO stands for on this CPU */
+GrayKernel grayKernelBest(void);
+
+/** Allocate the pixels of an image. Rows are padded to a multiple of 4 bytes, as
+*   cvCreateImage does. The pixel values are not initialized. */
+int grayImageCreate(GrayImage* img, int width, int height, int channels);
+
+/** Free the pixels of an image created by grayImageCreate and zero the struct */
+void grayImageRelease(GrayImage* img);
+
+/** Check the arguments of a conversion without converting anything */
+int grayValidate(const unsigned char* colorData, int colorStep,
+                 const unsigned char* grayData, int grayStep,
+                 int width, int height);
+
+/** Convert a BGR image to gray with the fastest kernel, after checking the arguments.
+*
+*   Parameters:
+*       colorData – pointer to the first byte of the color image (row 0, column 0)
+*       colorStep – number of bytes between successive color rows (widthStep)
+*       grayData – pointer to the first byte of the gray image
+*       grayStep – number of bytes between successive gray rows (widthStep)
+*       width – number of pixels in each row
+*       height – number of rows
+*/
+int grayConvert(const unsigned char* colorData, int colorStep,
+                unsigned char* grayData, int grayStep,
+                int width, int height);
+
+/** As grayConvert, with the given kernel */
+int grayConvertWith(GrayKernel kernel,
+                    const unsigned char* colorData, int colorStep,
+                    unsigned char* grayData, int grayStep,
+                    int width, int height);
+
+/** Convert the BGR image src into the gray image dst, which must have the same size */
+int grayConvertImage(const GrayImage* src, GrayImage* dst);
+
+/** Convert only the pixels inside rect of a width x height BGR image. The gray image is
+*   rect.width x rect.height; grayData points at its first pixel, which is the gray of
+*   pixel (rect.x, rect.y). Nothing outside the rectangle is read. */
+int grayConvertRect(const unsigned char* colorData, int colorStep, int width, int height,
+                    GrayRect rect, unsigned char* grayData, int grayStep);
+
+/** Convert count rectangles of one image, rectangle i into grayData[i] with row step
+*   grayStep[i], as grayConvertRect does. The rectangles may overlap. The conversion makes
+*   a single pass from the top to the bottom of the rectangles and converts every
+*   rectangle crossing a row while the row is in the cache; rows outside all of them are
+*   never read. */
+int grayConvertRects(const unsigned char* colorData, int colorStep, int width, int height,
+                     const GrayRect* rects, int count,
+                     unsigned char* const* grayData, const int* grayStep);
+
+/** Convert a BGR image to gray in its own buffer. Gray row r is written at
+*   data + r * *grayStep, where *grayStep is width rounded up to a multiple of 4, as
+*   cvCreateImage pads rows, but at most colorStep. The gray image then fills the first
+*   *grayStep * height bytes of the buffer and the rest is no longer needed.
+*
+*   Every gray byte is written at or before the color bytes it is computed from, after
+*   they have been read, so no color pixel is overwritten before it is converted. The rows
+*   are converted in order on the calling thread: converting them on several threads
+*   could overwrite color rows another thread has not read yet. */
+int grayConvertInPlace(unsigned char* data, int colorStep, int width, int height, int* grayStep);
+
+/** Convert the BGR image img to gray in place and shrink its allocation to the gray
+*   image. On success img is a 1 channel image. */
+int grayImageToGray(GrayImage* img);
+
+/** Convert rows [rowStart, rowEnd) with the fastest kernel. The arguments are not checked;
+*   this is the inner call for programs that split an image into bands and have already
+*   validated the whole image. */
+void grayConvertRows(const unsigned char* colorData, int colorStep,
+                     unsigned char* grayData, int grayStep,
+                     int width, int rowStart, int rowEnd);
+
+/** As grayConvertRows, with the given kernel, which must be supported */
+void grayConvertRowsWith(GrayKernel kernel,
+                         const unsigned char* colorData, int colorStep,
+                         unsigned char* grayData, int grayStep,
+                         int width, int rowStart, int rowEnd);
+
+/** Set weights to the weights of a standard other than GRAY_STANDARD_CUSTOM */
+int grayStandardWeights(GrayStandard standard, GrayWeights* weights);
+
+/** Set weights from fractions such as 0.2126, 0.7152, 0.0722, rounded to fixed point. The
+*   fractions must not be negative or add up to more than 1, so no gray value can exceed
+*   255. */
+int grayWeightsFromFractions(GrayWeights* weights, double red, double green, double blue);
+
+/** Set up a conversion with the weights of standard, or with *weights for
+*   GRAY_STANDARD_CUSTOM (weights is ignored otherwise), on the given kernel */
+int grayConverterInit(GrayConverter* converter, GrayStandard standard, const GrayWeights* weights,
+                      GrayKernel kernel);
+
+/** As grayConvert, with the converter's weights and kernel */
+int grayConverterConvert(const GrayConverter* converter,
+                         const unsigned char* colorData, int colorStep,
+                         unsigned char* grayData, int grayStep,
+                         int width, int height);
+
+/** As grayConvertRows, with the converter's weights and kernel */
+void grayConverterRows(const GrayConverter* converter,
+                       const unsigned char* colorData, int colorStep,
+                       unsigned char* grayData, int grayStep,
+                       int width, int rowStart, int rowEnd);
+
+/** Convert a BGR image to gray in linear light, after checking the arguments: each
+*   channel is decoded from sRGB with a table, weighed with the GRAY_LINEAR_WEIGHT_*
+*   in 16 bit fixed point and the sum encoded back to sRGB with a second table. The
+*   result is within one gray level of the exact computation in doubles. Every kernel
+*   runs the scalar kernel here: the table reads, not the arithmetic, set its speed. The
+*   tables are built by the first call. */
+int grayConvertLinear(const unsigned char* colorData, int colorStep,
+                      unsigned char* grayData, int grayStep,
+                      int width, int height);
+
+/** Return the kernel the linear-light conversion runs for kernel, which is
+*   GRAY_KERNEL_SCALAR for every kernel */
+GrayKernel grayLinearKernel(GrayKernel kernel);
+
+/** As grayConvertLinear, with the given kernel */
+int grayConvertLinearWith(GrayKernel kernel,
+                          const unsigned char* colorData, int colorStep,
+                          unsigned char* grayData, int grayStep,
+                          int width, int height);
+
+/** As grayConvertRows, in linear light */
+void grayConvertLinearRows(const unsigned char* colorData, int colorStep,
+                           unsigned char* grayData, int grayStep,
+                           int width, int rowStart, int rowEnd);
+
+/** As grayConvertRowsWith, in linear light */
+void grayConvertLinearRowsWith(GrayKernel kernel,
+                               const unsigned char* colorData, int colorStep,
+                               unsigned char* grayData, int grayStep,
+                               int width, int rowStart, int rowEnd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
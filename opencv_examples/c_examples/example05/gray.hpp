@@ -0,0 +1,129 @@
+/** Filename: gray.hpp
+*
+*   Description: C++ interface to libgray.
+*
+*   A thin layer over gray.h: gray::Image owns its pixels and frees them when it goes
+*   out of scope, and errors are thrown as gray::Error instead of returned as codes.
+*   Image can be moved but not copied, so exactly one Image owns each pixel buffer.
+*/
+
+#ifndef GRAY_HPP
+#define GRAY_HPP
+
+#include <stdexcept>
+#include <string>
+
+#include "gray.h"
+
+namespace gray {
+
+class Error : public std::runtime_error {
+public:
+    explicit Error(int status)
+        : std::runtime_error(std::string("libgray: ") + grayStatusString(status)), status_(status) {}
+
+    int status() const { return status_; }
+
+private:
+    int status_;
+};
+
+inline void check(int status){
+    if(status != GRAY_OK){
+        throw Error(status);
+    }
+}
+
+class Image {
+public:
+    Image() : img_() {}
+
+    Image(int width, int height, int channels) : img_() {
+        check(grayImageCreate(&img_, width, height, channels));
+    }
+
+    ~Image() { grayImageRelease(&img_); }
+
+    Image(Image&& other) : img_(other.img_) { other.img_ = GrayImage(); }
+
+    Image& operator=(Image&& other){
+        if(this != &other){
+            grayImageRelease(&img_);
+            img_ = other.img_;
+            other.img_ = GrayImage();
+        }
+        return *this;
+    }
+
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
+    bool empty() const { return img_.data == nullptr; }
+    int width() const { return img_.width; }
+    int height() const { return img_.height; }
+    int channels() const { return img_.channels; }
+    int step() const { return img_.step; }
+    unsigned char* data() { return img_.data; }
+    const unsigned char* data() const { return img_.data; }
+    unsigned char* row(int r) { return img_.data + static_cast<size_t>(r) * img_.step; }
+    const unsigned char* row(int r) const { return img_.data + static_cast<size_t>(r) * img_.step; }
+
+    /** The underlying C struct, for calling gray.h functions directly */
+    GrayImage* c() { return &img_; }
+    const GrayImage* c() const { return &img_; }
+
+private:
+    GrayImage img_;
+};
+
+/** Convert raw BGR pixels to gray; see grayConvertWith */
+inline void convert(const unsigned char* colorData, int colorStep,
+                    unsigned char* grayData, int grayStep,
+                    int width, int height, GrayKernel kernel = GRAY_KERNEL_AUTO){
+    check(grayConvertWith(kernel, colorData, colorStep, grayData, grayStep, width, height));
+}
+
+/** Convert raw BGR pixels to gray in linear light; see grayConvertLinearWith */
+inline void convertLinear(const unsigned char* colorData, int colorStep,
+                          unsigned char* grayData, int grayStep,
+                          int width, int height, GrayKernel kernel = GRAY_KERNEL_AUTO){
+    check(grayConvertLinearWith(kernel, colorData, colorStep, grayData, grayStep, width, height));
+}
+
+/** Convert a BGR image into a gray image of the same size */
+inline void convert(const Image& color, Image& gray){
+    check(grayConvertImage(color.c(), gray.c()));
+}
+
+/** Convert the pixels of a BGR image inside rect into a gray image of the rect's size */
+inline void convert(const Image& color, const GrayRect& rect, Image& gray){
+    if(color.channels() != 3 || gray.channels() != 1 ||
+       gray.width() != rect.width || gray.height() != rect.height){
+        check(GRAY_ERR_SIZE);
+    }
+    check(grayConvertRect(color.data(), color.step(), color.width(), color.height(),
+                          rect, gray.data(), gray.step()));
+}
+
+/** Return a new gray image converted from a BGR image */
+inline Image toGray(const Image& color){
+    Image gray(color.width(), color.height(), 1);
+    convert(color, gray);
+    return gray;
+}
+
+/** Convert a BGR image to gray in its own pixel buffer, which shrinks to the gray size */
+inline void toGrayInPlace(Image& image){
+    check(grayImageToGray(image.c()));
+}
+
+/** Return a new gray image converted from the pixels of a BGR image inside rect */
+inline Image toGray(const Image& color, const GrayRect& rect){
+    Image gray(rect.width, rect.height, 1);
+    convert(color, rect, gray);
+    return gray;
+}
+
+} // namespace gray
+
+#endif
@@ -0,0 +1,244 @@
+/** Filename: graykernels.c
+*
+*   Description: the row kernels of libgray.
+*
+*   The scalar kernel is the reference: it reads one BGR pixel, applies the fixed point
+*   formula from gray.h and writes one gray byte.
+*
+*   The SIMD kernels compute the same formula on blocks of pixels.
+*
+*   1. Deinterleave. Three 16 byte loads hold 16 BGR pixels. pshufb moves the blue bytes
+*      of each load to their pixel positions and zeroes the rest; OR-ing the three
+*      results gives the 16 blue bytes in order. Green and red are gathered the same way.
+*
+*   2. Weigh. The bytes are widened to 16 bit and interleaved into (B, G) and (R, 1)
+*      pairs. pmaddwd multiplies each pair by (1868, 9617) or (4899, 8192) and adds the
+*      two products into 32 bits, so two pmaddwd and one add give
+*      1868 * B + 9617 * G + 4899 * R + 8192 for 4 pixels.
+*
+*   3. Shift right by 14 and pack the 32 bit sums back down to bytes.
+*
+*   The AVX2 kernel puts two blocks of 16 pixels in the two 128 bit lanes of each
+*   register. pshufb, the unpacks and the packs all work within a lane, so the same
+*   shuffle masks work and the 32 results come out in pixel order.
+*
+*   Each kernel is written once, as an always inlined function of the three weights, and
+*   instantiated by GRAY_DEFINE_KERNELS for every standard of GrayStandard with the
+*   weights as constants, the way a C++ template would be. The weights then become
+*   immediates and constant loads just as they were when they were hard coded, so every
+*   standard runs exactly as fast as BT.601. The *Weights kernels take the weights from a
+*   GrayWeights instead, for weights only known at run time.
+*/
+
+#include "gray.h"
+#include "graykernels.h"
+
+#define GRAY_ROUND (1 << (GRAY_SHIFT - 1))
+
+
+#define GRAY_INLINE static inline __attribute__((always_inline))
+
+
+GRAY_INLINE void rowScalar(const unsigned char* color, unsigned char* gray, int width,
+                           int weightB, int weightG, int weightR){
+    int col;
+    unsigned blue, green, red;
+
+    for(col = 0; col < width; ++col){
+        /// remember color data is BGR. First byte is blue, second byte is green, ...
+        blue = color[3 * col];
+        green = color[3 * col + 1];
+        red = color[3 * col + 2];
+
+        /// calculate gray = wR * R + wG * G + wB * B in fixed point, rounded
+        gray[col] = (unsigned char)((weightB * blue + weightG * green +
+                                     weightR * red + GRAY_ROUND) >> GRAY_SHIFT);
+    }
+}
+
+
+#ifdef GRAY_HAVE_X86
+
+#include <immintrin.h>
+
+/** pshufb masks: [channel][load] selects the bytes of one channel (B, G, R) from one
+*   of the three 16 byte loads of a block of 16 pixels. -1 writes a zero. */
+static const signed char deinterleaveMask[3][3][16] __attribute__((aligned(16))) = {
+    { { 0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13} },
+    { { 1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14} },
+    { { 2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1},
+      {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15} }
+};
+
+#define MASK128(c, v) _mm_load_si128((const __m128i*)deinterleaveMask[c][v])
+#define MASK256(c, v) _mm256_broadcastsi128_si256(MASK128(c, v))
+
+
+__attribute__((target("ssse3")))
+GRAY_INLINE __m128i weigh4Ssse3(__m128i bg, __m128i r1, int weightB, int weightG, int weightR){
+    const __m128i wBG = _mm_set1_epi32((weightG << 16) | weightB);
+    const __m128i wR1 = _mm_set1_epi32((GRAY_ROUND << 16) | weightR);
+
+    return _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(bg, wBG), _mm_madd_epi16(r1, wR1)), GRAY_SHIFT);
+}
+
+
+__attribute__((target("ssse3")))
+GRAY_INLINE void rowSsse3(const unsigned char* color, unsigned char* gray, int width,
+                          int weightB, int weightG, int weightR){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    int col;
+
+    for(col = 0; col + 16 <= width; col += 16){
+        const unsigned char* p = color + 3 * col;
+        __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, MASK128(0, 0)),
+                                              _mm_shuffle_epi8(v1, MASK128(0, 1))),
+                                 _mm_shuffle_epi8(v2, MASK128(0, 2)));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, MASK128(1, 0)),
+                                              _mm_shuffle_epi8(v1, MASK128(1, 1))),
+                                 _mm_shuffle_epi8(v2, MASK128(1, 2)));
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, MASK128(2, 0)),
+                                              _mm_shuffle_epi8(v1, MASK128(2, 1))),
+                                 _mm_shuffle_epi8(v2, MASK128(2, 2)));
+
+        /** Pixels 0-7 and 8-15 widened to 16 bit */
+        __m128i bl = _mm_unpacklo_epi8(b, zero), bh = _mm_unpackhi_epi8(b, zero);
+        __m128i gl = _mm_unpacklo_epi8(g, zero), gh = _mm_unpackhi_epi8(g, zero);
+        __m128i rl = _mm_unpacklo_epi8(r, zero), rh = _mm_unpackhi_epi8(r, zero);
+
+        __m128i s0 = weigh4Ssse3(_mm_unpacklo_epi16(bl, gl), _mm_unpacklo_epi16(rl, one),
+                                 weightB, weightG, weightR);
+        __m128i s1 = weigh4Ssse3(_mm_unpackhi_epi16(bl, gl), _mm_unpackhi_epi16(rl, one),
+                                 weightB, weightG, weightR);
+        __m128i s2 = weigh4Ssse3(_mm_unpacklo_epi16(bh, gh), _mm_unpacklo_epi16(rh, one),
+                                 weightB, weightG, weightR);
+        __m128i s3 = weigh4Ssse3(_mm_unpackhi_epi16(bh, gh), _mm_unpackhi_epi16(rh, one),
+                                 weightB, weightG, weightR);
+
+        __m128i y = _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+        _mm_storeu_si128((__m128i*)(gray + col), y);
+    }
+
+    rowScalar(color + 3 * col, gray + col, width - col, weightB, weightG, weightR);
+}
+
+
+__attribute__((target("avx2")))
+GRAY_INLINE __m256i weigh4Avx2(__m256i bg, __m256i r1, int weightB, int weightG, int weightR){
+    const __m256i wBG = _mm256_set1_epi32((weightG << 16) | weightB);
+    const __m256i wR1 = _mm256_set1_epi32((GRAY_ROUND << 16) | weightR);
+
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(bg, wBG), _mm256_madd_epi16(r1, wR1)), GRAY_SHIFT);
+}
+
+
+/** Load 16 bytes at p into the low lane and 16 bytes at q into the high lane */
+#define LOAD2(p, q) _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p))), \
+                                            _mm_loadu_si128((const __m128i*)(q)), 1)
+
+
+__attribute__((target("avx2")))
+GRAY_INLINE void rowAvx2(const unsigned char* color, unsigned char* gray, int width,
+                         int weightB, int weightG, int weightR){
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    int col;
+
+    for(col = 0; col + 32 <= width; col += 32){
+        /** Pixels col to col + 15 go in the low lanes, col + 16 to col + 31 in the high */
+        const unsigned char* p = color + 3 * col;
+        __m256i v0 = LOAD2(p, p + 48);
+        __m256i v1 = LOAD2(p + 16, p + 64);
+        __m256i v2 = LOAD2(p + 32, p + 80);
+
+        __m256i b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, MASK256(0, 0)),
+                                                    _mm256_shuffle_epi8(v1, MASK256(0, 1))),
+                                    _mm256_shuffle_epi8(v2, MASK256(0, 2)));
+        __m256i g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, MASK256(1, 0)),
+                                                    _mm256_shuffle_epi8(v1, MASK256(1, 1))),
+                                    _mm256_shuffle_epi8(v2, MASK256(1, 2)));
+        __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, MASK256(2, 0)),
+                                                    _mm256_shuffle_epi8(v1, MASK256(2, 1))),
+                                    _mm256_shuffle_epi8(v2, MASK256(2, 2)));
+
+        __m256i bl = _mm256_unpacklo_epi8(b, zero), bh = _mm256_unpackhi_epi8(b, zero);
+        __m256i gl = _mm256_unpacklo_epi8(g, zero), gh = _mm256_unpackhi_epi8(g, zero);
+        __m256i rl = _mm256_unpacklo_epi8(r, zero), rh = _mm256_unpackhi_epi8(r, zero);
+
+        __m256i s0 = weigh4Avx2(_mm256_unpacklo_epi16(bl, gl), _mm256_unpacklo_epi16(rl, one),
+                                weightB, weightG, weightR);
+        __m256i s1 = weigh4Avx2(_mm256_unpackhi_epi16(bl, gl), _mm256_unpackhi_epi16(rl, one),
+                                weightB, weightG, weightR);
+        __m256i s2 = weigh4Avx2(_mm256_unpacklo_epi16(bh, gh), _mm256_unpacklo_epi16(rh, one),
+                                weightB, weightG, weightR);
+        __m256i s3 = weigh4Avx2(_mm256_unpackhi_epi16(bh, gh), _mm256_unpackhi_epi16(rh, one),
+                                weightB, weightG, weightR);
+
+        __m256i y = _mm256_packus_epi16(_mm256_packs_epi32(s0, s1), _mm256_packs_epi32(s2, s3));
+        _mm256_storeu_si256((__m256i*)(gray + col), y);
+    }
+
+    rowSsse3(color + 3 * col, gray + col, width - col, weightB, weightG, weightR);
+}
+
+#endif
+
+
+/** The kernels of one standard: grayRowScalar##name, grayRowSsse3##name, grayRowAvx2##name */
+#define GRAY_DEFINE_SCALAR(name, weightB, weightG, weightR) \
+    void grayRowScalar##name(const unsigned char* color, unsigned char* gray, int width){ \
+        rowScalar(color, gray, width, weightB, weightG, weightR); \
+    }
+
+#ifdef GRAY_HAVE_X86
+#define GRAY_DEFINE_KERNELS(name, weightB, weightG, weightR) \
+    GRAY_DEFINE_SCALAR(name, weightB, weightG, weightR) \
+    __attribute__((target("ssse3"))) \
+    void grayRowSsse3##name(const unsigned char* color, unsigned char* gray, int width){ \
+        rowSsse3(color, gray, width, weightB, weightG, weightR); \
+    } \
+    __attribute__((target("avx2"))) \
+    void grayRowAvx2##name(const unsigned char* color, unsigned char* gray, int width){ \
+        rowAvx2(color, gray, width, weightB, weightG, weightR); \
+    }
+#else
+#define GRAY_DEFINE_KERNELS GRAY_DEFINE_SCALAR
+#endif
+
+GRAY_DEFINE_KERNELS(, GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R)
+GRAY_DEFINE_KERNELS(Bt709, GRAY_BT709_WEIGHT_B, GRAY_BT709_WEIGHT_G, GRAY_BT709_WEIGHT_R)
+GRAY_DEFINE_KERNELS(Bt2020, GRAY_BT2020_WEIGHT_B, GRAY_BT2020_WEIGHT_G, GRAY_BT2020_WEIGHT_R)
+
+
+void grayRowScalarWeights(const unsigned char* color, unsigned char* gray, int width,
+                          const GrayWeights* weights){
+    rowScalar(color, gray, width, weights->b, weights->g, weights->r);
+}
+
+
+#ifdef GRAY_HAVE_X86
+
+__attribute__((target("ssse3")))
+void grayRowSsse3Weights(const unsigned char* color, unsigned char* gray, int width,
+                         const GrayWeights* weights){
+    rowSsse3(color, gray, width, weights->b, weights->g, weights->r);
+}
+
+
+__attribute__((target("avx2")))
+void grayRowAvx2Weights(const unsigned char* color, unsigned char* gray, int width,
+                        const GrayWeights* weights){
+    rowAvx2(color, gray, width, weights->b, weights->g, weights->r);
+}
+
+#endif
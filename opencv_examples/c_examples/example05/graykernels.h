@@ -0,0 +1,46 @@
+/** Filename: graykernels.h
+*
+*   Description: the row kernels of libgray. Internal to the library.
+*
+*   A row kernel converts width BGR pixels starting at color into width gray bytes
+*   starting at gray. The SIMD kernels convert whole blocks of pixels and hand the last
+*   width % block pixels to the scalar kernel, so no kernel reads or writes past the end
+*   of a row. Every kernel loads a block before it stores the block's gray bytes and moves
+*   forward through the row, so gray may start at color (grayConvertInPlace).
+*
+*   grayRowScalar, grayRowSsse3 and grayRowAvx2 are the BT.601 kernels; the kernels of the
+*   other standards have the standard's name appended, and the *Weights kernels take the
+*   weights as an argument.
+*/
+
+#ifndef GRAYKERNELS_H
+#define GRAYKERNELS_H
+
+#include "gray.h"
+
+typedef void (*GrayRowKernel)(const unsigned char* color, unsigned char* gray, int width);
+typedef void (*GrayRowKernelWeights)(const unsigned char* color, unsigned char* gray, int width,
+                                     const GrayWeights* weights);
+
+void grayRowScalar(const unsigned char* color, unsigned char* gray, int width);
+void grayRowScalarBt709(const unsigned char* color, unsigned char* gray, int width);
+void grayRowScalarBt2020(const unsigned char* color, unsigned char* gray, int width);
+void grayRowScalarWeights(const unsigned char* color, unsigned char* gray, int width,
+                          const GrayWeights* weights);
+void grayLinearRowScalar(const unsigned char* color, unsigned char* gray, int width);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GRAY_HAVE_X86 1
+void grayRowSsse3(const unsigned char* color, unsigned char* gray, int width);
+void grayRowSsse3Bt709(const unsigned char* color, unsigned char* gray, int width);
+void grayRowSsse3Bt2020(const unsigned char* color, unsigned char* gray, int width);
+void grayRowSsse3Weights(const unsigned char* color, unsigned char* gray, int width,
+                         const GrayWeights* weights);
+void grayRowAvx2(const unsigned char* color, unsigned char* gray, int width);
+void grayRowAvx2Bt709(const unsigned char* color, unsigned char* gray, int width);
+void grayRowAvx2Bt2020(const unsigned char* color, unsigned char* gray, int width);
+void grayRowAvx2Weights(const unsigned char* color, unsigned char* gray, int width,
+                        const GrayWeights* weights);
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/** Filename: graylinear.c
+*
+*   Description: libgray's linear-light conversion, see grayConvertLinear in gray.h.
+*
+*   sRGB bytes are gamma encoded: a byte v stands for the light intensity
+*
+*       lin(v) = v / 255 / 12.92                        for v / 255 <= 0.04045
+*       lin(v) = ((v / 255 + 0.055) / 1.055) ^ 2.4      otherwise
+*
+*   Luminance is a weighted sum of the intensities, and the gray byte is the sum encoded
+*   back the same way. Both curves are tables built the first time a linear conversion is
+*   called, so a pixel costs four table reads and two adds, and no pow:
+*
+*   1. Decode. decode[c][v] is the weight of channel c times lin(v) in 16 bit fixed point
+*      (65535 is full intensity). The three weighted values of a pixel add up to at most
+*      65536, the luminance Y.
+*
+*   2. Encode. encode[Y >> 2] is the gray byte of the middle of the 4 values of Y sharing
+*      an entry. A 16 KB table stays in the L1 cache; near black, where the curve is
+*      steepest, 4 values of Y are a fifth of a gray level apart.
+*
+*   There is only the scalar kernel: every kernel maps to it. A pixel's cost is its four
+*   table reads, and an AVX2 kernel reading the tables with vpgatherdd ran no faster than
+*   these single loads, so it was dropped.
+*/
+
+#include "gray.h"
+#include "graykernels.h"
+
+#include <math.h>
+#include <pthread.h>
+
+#define LINEAR_ONE 65535                /// full intensity in the decode tables
+#define LINEAR_ENCODE_SHIFT 2
+#define LINEAR_ENCODE_SIZE (((LINEAR_ONE + 1) >> LINEAR_ENCODE_SHIFT) + 1)
+
+typedef struct LinearTables{
+    int decode[3][256];                 /// B, G, R: weight * lin(v) * LINEAR_ONE
+    unsigned char encode[LINEAR_ENCODE_SIZE];
+} LinearTables;
+
+static LinearTables tables __attribute__((aligned(64)));
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+
+static double srgbDecode(double v){
+    return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+
+static double srgbEncode(double y){
+    return y <= 0.0031308 ? y * 12.92 : 1.055 * pow(y, 1 / 2.4) - 0.055;
+}
+
+
+static void buildTables(void){
+    static const double weights[3] = { GRAY_LINEAR_WEIGHT_B, GRAY_LINEAR_WEIGHT_G, GRAY_LINEAR_WEIGHT_R };
+    int c, i;
+
+    for(c = 0; c < 3; ++c){
+        for(i = 0; i < 256; ++i){
+            tables.decode[c][i] = (int)(weights[c] * srgbDecode(i / 255.0) * LINEAR_ONE + 0.5);
+        }
+    }
+
+    for(i = 0; i < LINEAR_ENCODE_SIZE; ++i){
+        double y = ((i << LINEAR_ENCODE_SHIFT) + 0.5 * ((1 << LINEAR_ENCODE_SHIFT) - 1)) / LINEAR_ONE;
+        tables.encode[i] = (unsigned char)(255 * srgbEncode(y < 1 ? y : 1) + 0.5);
+    }
+}
+
+
+void grayLinearRowScalar(const unsigned char* color, unsigned char* gray, int width){
+    int col;
+
+    for(col = 0; col < width; ++col){
+        int y = tables.decode[0][color[3 * col]] + tables.decode[1][color[3 * col + 1]] +
+                tables.decode[2][color[3 * col + 2]];
+        gray[col] = tables.encode[y >> LINEAR_ENCODE_SHIFT];
+    }
+}
+
+
+
+GrayKernel grayLinearKernel(GrayKernel kernel){
+    (void)kernel;
+    return GRAY_KERNEL_SCALAR;
+}
+
+
+void grayConvertLinearRowsWith(GrayKernel kernel,
+                               const unsigned char* colorData, int colorStep,
+                               unsigned char* grayData, int grayStep,
+                               int width, int rowStart, int rowEnd){
+
+    int row;
+
+    (void)kernel;
+    pthread_once(&tablesOnce, buildTables);
+    for(row = rowStart; row < rowEnd; ++row){
+        grayLinearRowScalar(colorData + (size_t)row * colorStep, grayData + (size_t)row * grayStep, width);
+    }
+}
+
+
+void grayConvertLinearRows(const unsigned char* colorData, int colorStep,
+                           unsigned char* grayData, int grayStep,
+                           int width, int rowStart, int rowEnd){
+
+    grayConvertLinearRowsWith(GRAY_KERNEL_AUTO, colorData, colorStep, grayData, grayStep,
+                              width, rowStart, rowEnd);
+}
+
+
+int grayConvertLinearWith(GrayKernel kernel,
+                          const unsigned char* colorData, int colorStep,
+                          unsigned char* grayData, int grayStep,
+                          int width, int height){
+
+    int status = grayValidate(colorData, colorStep, grayData, grayStep, width, height);
+    if(status != GRAY_OK){
+        return status;
+    }
+    if(!grayKernelSupported(kernel)){
+        return GRAY_ERR_KERNEL;
+    }
+
+    grayConvertLinearRowsWith(kernel, colorData, colorStep, grayData, grayStep, width, 0, height);
+    return GRAY_OK;
+}
+
+
+int grayConvertLinear(const unsigned char* colorData, int colorStep,
+                      unsigned char* grayData, int grayStep,
+                      int width, int height){
+
+    return grayConvertLinearWith(GRAY_KERNEL_AUTO, colorData, colorStep, grayData, grayStep,
+                                 width, height);
+}
@@ -0,0 +1,150 @@
+/** Filename: hugepage.c
+*
+*   Description: image buffers backed by 2 MB huge pages. See hugepage.h.
+*/
+
+#include "hugepage.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+
+static const char* const modeNames[] = { "off", "thp", "hugetlb" };
+
+
+int hugePageParse(const char* name, HugePageMode* mode){
+    int i;
+    for(i = 0; i <= HUGEPAGE_HUGETLB; ++i){
+        if(strcmp(name, modeNames[i]) == 0){
+            *mode = (HugePageMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+const char* hugePageModeName(HugePageMode mode){
+    return (int)mode >= 0 && mode <= HUGEPAGE_HUGETLB ? modeNames[mode] : "unknown";
+}
+
+
+static size_t mappedSize(size_t size){
+    return (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+}
+
+
+/** Map length bytes starting on a HUGEPAGE_SIZE boundary, so that every 2 MB of the range
+*   can be a huge page. mmap only promises 4 KB alignment, so map an extra 2 MB and unmap
+*   the ends. */
+static void* mapAligned(size_t length){
+    size_t extra = length + HUGEPAGE_SIZE;
+    unsigned char* p = (unsigned char*)mmap(NULL, extra, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+        return NULL;
+    }
+
+    uintptr_t begin = ((uintptr_t)p + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1);
+    size_t head = begin - (uintptr_t)p;
+    if(head > 0){
+        munmap(p, head);
+    }
+    munmap((void*)(begin + length), extra - head - length);
+    return (void*)begin;
+}
+
+
+void* hugePageAlloc(size_t size, HugePageMode mode, HugePageMode* got){
+    size_t length = mappedSize(size);
+    void* p;
+
+    if(mode == HUGEPAGE_HUGETLB){
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED){
+            if(got != NULL){
+                *got = HUGEPAGE_HUGETLB;
+            }
+            return p;
+        }
+        mode = HUGEPAGE_THP;            /// no reserved huge pages free
+    }
+
+    p = mapAligned(length);
+    if(p == NULL){
+        return NULL;
+    }
+
+    if(mode == HUGEPAGE_THP && madvise(p, length, MADV_HUGEPAGE) != 0){
+        mode = HUGEPAGE_OFF;            /// transparent huge pages are not available
+    }
+    if(mode == HUGEPAGE_OFF){
+        madvise(p, length, MADV_NOHUGEPAGE);
+    }
+
+    if(got != NULL){
+        *got = mode;
+    }
+    return p;
+}
+
+
+void hugePageFree(void* data, size_t size){
+    if(data != NULL){
+        munmap(data, mappedSize(size));
+    }
+}
+
+
+IplImage* hugePageCreateImage(CvSize size, int depth, int channels, HugePageMode mode, HugePageMode* got){
+    IplImage* img = cvCreateImageHeader(size, depth, channels);
+    if(img == NULL){
+        return NULL;
+    }
+
+    void* data = hugePageAlloc((size_t)img->imageSize, mode, got);
+    if(data == NULL){
+        cvReleaseImageHeader(&img);
+        return NULL;
+    }
+
+    /** The header keeps the widthStep cvCreateImageHeader chose */
+    cvSetData(img, data, img->widthStep);
+    return img;
+}
+
+
+void hugePageReleaseImage(IplImage** img){
+    if(img != NULL && *img != NULL){
+        hugePageFree((*img)->imageData, (size_t)(*img)->imageSize);
+        cvReleaseImageHeader(img);
+    }
+}
+
+
+long hugePageResidentKB(void){
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long total = 0, kb;
+    int found = 0;
+
+    if(f == NULL){
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL){
+        if(sscanf(line, "AnonHugePages: %ld kB", &kb) == 1 ||
+           sscanf(line, "Private_Hugetlb: %ld kB", &kb) == 1 ||
+           sscanf(line, "Shared_Hugetlb: %ld kB", &kb) == 1){
+            total += kb;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found ? total : -1;
+}
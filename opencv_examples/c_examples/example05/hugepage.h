@@ -0,0 +1,56 @@
+/** Filename: hugepage.h
+*
+*   Description: image buffers backed by 2 MB huge pages.
+*
+*   A 100 megapixel BGR image spans about 75000 pages of 4 KB, far more than the TLB holds,
+*   so a conversion takes a TLB miss every few rows and a page fault on the first touch of
+*   every page. With 2 MB pages the same image spans about 150 pages.
+*
+*   HUGEPAGE_HUGETLB maps pages from the pool reserved in /proc/sys/vm/nr_hugepages
+*   (MAP_HUGETLB). When none are free it falls back to HUGEPAGE_THP, which maps a 2 MB
+*   aligned range and asks for transparent huge pages with madvise(MADV_HUGEPAGE); the
+*   kernel then backs it with huge pages when it can. When transparent huge pages are
+*   disabled it falls back to HUGEPAGE_OFF, plain 4 KB pages, which are also mapped with
+*   mmap but with MADV_NOHUGEPAGE, so that OFF is never given huge pages behind our back.
+*/
+
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stddef.h>
+#include <opencv/cv.h>
+
+#define HUGEPAGE_SIZE ((size_t)2 << 20)
+
+typedef enum HugePageMode{
+    HUGEPAGE_OFF = 0,                   /// 4 KB pages
+    HUGEPAGE_THP,                       /// transparent huge pages, madvise(MADV_HUGEPAGE)
+    HUGEPAGE_HUGETLB                    /// reserved huge pages, MAP_HUGETLB
+} HugePageMode;
+
+/** Parse "off", "thp" or "hugetlb". Returns 0, or -1 for an unknown name. */
+int hugePageParse(const char* name, HugePageMode* mode);
+
+/** Return the name of a mode */
+const char* hugePageModeName(HugePageMode mode);
+
+/** Map size bytes, rounded up to a multiple of HUGEPAGE_SIZE. The mode actually used,
+*   after falling back, is stored in got if not NULL. Returns NULL if out of memory. */
+void* hugePageAlloc(size_t size, HugePageMode mode, HugePageMode* got);
+
+/** Unmap memory returned by hugePageAlloc for size bytes */
+void hugePageFree(void* data, size_t size);
+
+/** Create an image as cvCreateImage does, with its pixels from hugePageAlloc. It must be
+*   released with hugePageReleaseImage, not cvReleaseImage, and its header must not be
+*   changed, since imageSize gives the size to unmap. */
+IplImage* hugePageCreateImage(CvSize size, int depth, int channels, HugePageMode mode, HugePageMode* got);
+
+/** Release an image created by hugePageCreateImage and set *img to NULL */
+void hugePageReleaseImage(IplImage** img);
+
+/** Return the kilobytes of this process currently backed by huge pages, transparent or
+*   reserved, from /proc/self/smaps_rollup, or -1 if it cannot be read */
+long hugePageResidentKB(void);
+
+#endif
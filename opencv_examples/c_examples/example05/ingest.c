@@ -0,0 +1,503 @@
+/** Filename: ingest.c
+*
+*   Description: read-ahead of input files for batch mode. See ingest.h.
+*
+*   io_uring is used through its system calls directly, so no liburing is needed. The
+*   submission and completion rings are shared with the kernel: the submitter writes a
+*   read request (SQE) into the next free slot and publishes it by advancing the ring's
+*   tail with a release store; the kernel does the same with completions (CQEs), which
+*   the submitter consumes by advancing the completion head.
+*
+*   Every file is opened and sized with fstat on the submitting thread, then read in one
+*   request, resubmitted from where it stopped if the read comes back short. Opening is
+*   usually cheap next to reading, since directories stay cached.
+*/
+
+#define _GNU_SOURCE
+#include "ingest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#define INGEST_HAVE_URING 1
+#endif
+
+#define INGEST_MAX_THREADS 64
+
+enum { FILE_PENDING, FILE_READING, FILE_READY, FILE_FAILED, FILE_TAKEN };
+
+typedef struct IngestFile{
+    unsigned char* data;
+    size_t size;
+    size_t done;                /// bytes read so far
+    int fd;
+    int state;
+    int error;                  /// errno of a failed file
+} IngestFile;
+
+#ifdef INGEST_HAVE_URING
+typedef struct Uring{
+    int fd;
+    unsigned entries;
+    void* sqMap;
+    size_t sqMapSize;
+    void* cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+} Uring;
+#endif
+
+struct Ingest{
+    char** paths;
+    int count;
+    int depth;
+    IngestMethod method;
+    IngestFile* files;
+    int nextRead;               /// the next file to start reading
+    int outstanding;            /// files started but not yet taken
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       /// a file finished
+    pthread_cond_t space;       /// a file was taken
+    pthread_t threads[INGEST_MAX_THREADS];
+    int started;
+#ifdef INGEST_HAVE_URING
+    Uring ring;
+#endif
+};
+
+
+static const char* const methodNames[] = { "auto", "io_uring", "threads" };
+
+
+int ingestParse(const char* spec, IngestMethod* method, int* depth){
+    const char* colon = strchr(spec, ':');
+    char* end;
+
+    *method = INGEST_AUTO;
+    if(colon != NULL){
+        if(strncmp(spec, "uring", (size_t)(colon - spec)) == 0 && colon - spec == 5){
+            *method = INGEST_URING;
+        }
+        else if(strncmp(spec, "threads", (size_t)(colon - spec)) == 0 && colon - spec == 7){
+            *method = INGEST_THREADS;
+        }
+        else{
+            return -1;
+        }
+        spec = colon + 1;
+    }
+
+    long n = strtol(spec, &end, 10);
+    if(end == spec || *end != '\0' || n < 1 || n > 4096){
+        return -1;
+    }
+    *depth = (int)n;
+    return 0;
+}
+
+
+IngestMethod ingestMethod(const Ingest* ingest){
+    return ingest->method;
+}
+
+
+const char* ingestMethodName(IngestMethod method){
+    return (int)method >= 0 && method <= INGEST_THREADS ? methodNames[method] : "unknown";
+}
+
+
+/** Open file index and allocate its buffer. Returns 0, or an errno value. */
+static int openFile(Ingest* ingest, int index){
+    IngestFile* f = &ingest->files[index];
+    struct stat st;
+
+    f->fd = open(ingest->paths[index], O_RDONLY | O_CLOEXEC);
+    if(f->fd < 0){
+        return errno;
+    }
+    if(fstat(f->fd, &st) != 0){
+        return errno;
+    }
+    if(st.st_size <= 0 || st.st_size > INT32_MAX){
+        return EINVAL;                  /// cvDecodeImage takes the size as an int
+    }
+    f->data = (unsigned char*)malloc((size_t)st.st_size);
+    if(f->data == NULL){
+        return ENOMEM;
+    }
+
+    f->size = (size_t)st.st_size;
+    f->done = 0;
+    return 0;
+}
+
+
+/** Record the end of a file's reads, under the lock */
+static void finishFile(Ingest* ingest, IngestFile* f, int error){
+    if(f->fd >= 0){
+        close(f->fd);
+        f->fd = -1;
+    }
+    if(error != 0){
+        free(f->data);
+        f->data = NULL;
+        f->error = error;
+        f->state = FILE_FAILED;
+    }
+    else{
+        f->state = FILE_READY;
+    }
+    pthread_cond_broadcast(&ingest->ready);
+}
+
+
+/** Thread fallback: each thread reads one file at a time */
+static void* readerMain(void* arg){
+    Ingest* ingest = (Ingest*)arg;
+
+    pthread_mutex_lock(&ingest->lock);
+    for(;;){
+        while(!ingest->stop && ingest->nextRead < ingest->count && ingest->outstanding >= ingest->depth){
+            pthread_cond_wait(&ingest->space, &ingest->lock);
+        }
+        if(ingest->stop || ingest->nextRead >= ingest->count){
+            break;
+        }
+
+        int index = ingest->nextRead++;
+        ++ingest->outstanding;
+        IngestFile* f = &ingest->files[index];
+        f->state = FILE_READING;
+        pthread_mutex_unlock(&ingest->lock);
+
+        int error = openFile(ingest, index);
+        if(error == 0){
+            while(f->done < f->size){
+                ssize_t n = read(f->fd, f->data + f->done, f->size - f->done);
+                if(n < 0 && errno == EINTR){
+                    continue;
+                }
+                if(n <= 0){
+                    error = n < 0 ? errno : EIO;    /// the file shrank
+                    break;
+                }
+                f->done += (size_t)n;
+            }
+        }
+
+        pthread_mutex_lock(&ingest->lock);
+        finishFile(ingest, f, error);
+    }
+    pthread_mutex_unlock(&ingest->lock);
+    return NULL;
+}
+
+
+#ifdef INGEST_HAVE_URING
+
+static int uringSetup(Uring* ring, unsigned entries){
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(ring->fd < 0){
+        return -1;
+    }
+
+    ring->entries = p.sq_entries;
+    ring->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cqMapSize > ring->sqMapSize){
+            ring->sqMapSize = ring->cqMapSize;
+        }
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sqMap == MAP_FAILED){
+        close(ring->fd);
+        return -1;
+    }
+
+    /** With a single mmap the completion ring shares the submission ring's mapping */
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cqMap = ring->sqMap;
+        ring->cqMapSize = 0;
+    }
+    else{
+        ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cqMap == MAP_FAILED){
+            munmap(ring->sqMap, ring->sqMapSize);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        if(ring->cqMapSize > 0){
+            munmap(ring->cqMap, ring->cqMapSize);
+        }
+        munmap(ring->sqMap, ring->sqMapSize);
+        close(ring->fd);
+        return -1;
+    }
+
+    unsigned char* sq = (unsigned char*)ring->sqMap;
+    unsigned char* cq = (unsigned char*)ring->cqMap;
+    ring->sqHead = (unsigned*)(sq + p.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + p.sq_off.array);
+    ring->cqHead = (unsigned*)(cq + p.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+
+static void uringClose(Uring* ring){
+    munmap(ring->sqes, ring->sqesSize);
+    if(ring->cqMapSize > 0){
+        munmap(ring->cqMap, ring->cqMapSize);
+    }
+    munmap(ring->sqMap, ring->sqMapSize);
+    close(ring->fd);
+}
+
+
+/** Queue a read of the rest of file index. The ring has an entry per outstanding file, so
+*   there is always a free slot. */
+static void uringQueueRead(Uring* ring, IngestFile* f, int index){
+    unsigned tail = *ring->sqTail;
+    unsigned slot = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = f->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(f->data + f->done);
+    sqe->len = (unsigned)(f->size - f->done);
+    sqe->off = f->done;
+    sqe->user_data = (uint64_t)index;
+
+    ring->sqArray[slot] = slot;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/** io_uring: one thread keeps up to depth files in flight */
+static void* uringMain(void* arg){
+    Ingest* ingest = (Ingest*)arg;
+    Uring* ring = &ingest->ring;
+    int inFlight = 0;
+    unsigned toSubmit = 0;
+
+    pthread_mutex_lock(&ingest->lock);
+    for(;;){
+        while(!ingest->stop && ingest->nextRead < ingest->count && ingest->outstanding < ingest->depth){
+            int index = ingest->nextRead++;
+            IngestFile* f = &ingest->files[index];
+            ++ingest->outstanding;
+            f->state = FILE_READING;
+
+            /** open is synchronous, only the reads are asynchronous */
+            int error = openFile(ingest, index);
+            if(error == 0){
+                uringQueueRead(ring, f, index);
+                ++toSubmit;
+                ++inFlight;
+            }
+            else{
+                finishFile(ingest, f, error);
+            }
+        }
+
+        if(inFlight == 0){
+            if(ingest->stop || ingest->nextRead >= ingest->count){
+                break;
+            }
+            pthread_cond_wait(&ingest->space, &ingest->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ingest->lock);
+
+        /** Submit the queued reads and wait for at least one to complete */
+        long n = syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(n >= 0){
+            toSubmit -= (unsigned)n < toSubmit ? (unsigned)n : toSubmit;
+        }
+
+        pthread_mutex_lock(&ingest->lock);
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head){
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+            IngestFile* f = &ingest->files[cqe->user_data];
+
+            if(cqe->res < 0 || (cqe->res == 0 && f->done < f->size)){
+                finishFile(ingest, f, cqe->res < 0 ? -cqe->res : EIO);
+                --inFlight;
+                continue;
+            }
+            f->done += (size_t)cqe->res;
+            if(f->done < f->size){
+                uringQueueRead(ring, f, (int)cqe->user_data);   /// short read: read the rest
+                ++toSubmit;
+            }
+            else{
+                finishFile(ingest, f, 0);
+                --inFlight;
+            }
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ingest->lock);
+    return NULL;
+}
+
+#endif
+
+
+Ingest* ingestStart(char** paths, int count, IngestMethod method, int depth){
+    Ingest* ingest = (Ingest*)calloc(1, sizeof(Ingest));
+    if(ingest == NULL || count < 1 || depth < 1){
+        free(ingest);
+        return NULL;
+    }
+
+    ingest->files = (IngestFile*)calloc((size_t)count, sizeof(IngestFile));
+    if(ingest->files == NULL){
+        free(ingest);
+        return NULL;
+    }
+
+    ingest->paths = paths;
+    ingest->count = count;
+    ingest->depth = depth;
+    pthread_mutex_init(&ingest->lock, NULL);
+    pthread_cond_init(&ingest->ready, NULL);
+    pthread_cond_init(&ingest->space, NULL);
+
+    int i;
+    for(i = 0; i < count; ++i){
+        ingest->files[i].fd = -1;
+    }
+
+#ifdef INGEST_HAVE_URING
+    if(method != INGEST_THREADS && uringSetup(&ingest->ring, (unsigned)depth) == 0){
+        if(pthread_create(&ingest->threads[0], NULL, uringMain, ingest) == 0){
+            ingest->method = INGEST_URING;
+            ingest->started = 1;
+            return ingest;
+        }
+        uringClose(&ingest->ring);
+    }
+#endif
+
+    /** The fallback, also used when io_uring was asked for but is not available */
+    ingest->method = INGEST_THREADS;
+    int threads = depth < INGEST_MAX_THREADS ? depth : INGEST_MAX_THREADS;
+    for(i = 0; i < threads; ++i){
+        if(pthread_create(&ingest->threads[i], NULL, readerMain, ingest) != 0){
+            break;
+        }
+        ingest->started = i + 1;
+    }
+    if(ingest->started == 0){
+        ingestStop(ingest);
+        return NULL;
+    }
+    return ingest;
+}
+
+
+int ingestTake(Ingest* ingest, int index, unsigned char** data, size_t* size){
+    IngestFile* f = &ingest->files[index];
+    int status = 0;
+
+    pthread_mutex_lock(&ingest->lock);
+    while(f->state == FILE_PENDING || f->state == FILE_READING){
+        pthread_cond_wait(&ingest->ready, &ingest->lock);
+    }
+
+    if(f->state == FILE_READY){
+        *data = f->data;
+        *size = f->size;
+    }
+    else{
+        *data = NULL;
+        *size = 0;
+        errno = f->error;
+        status = -1;
+    }
+    f->data = NULL;
+    f->state = FILE_TAKEN;
+
+    --ingest->outstanding;
+    pthread_cond_broadcast(&ingest->space);
+    pthread_mutex_unlock(&ingest->lock);
+    return status;
+}
+
+
+void ingestStop(Ingest* ingest){
+    int i;
+
+    if(ingest == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&ingest->lock);
+    ingest->stop = 1;
+    pthread_cond_broadcast(&ingest->space);
+    pthread_mutex_unlock(&ingest->lock);
+
+    for(i = 0; i < ingest->started; ++i){
+        pthread_join(ingest->threads[i], NULL);
+    }
+
+#ifdef INGEST_HAVE_URING
+    if(ingest->method == INGEST_URING){
+        uringClose(&ingest->ring);
+    }
+#endif
+
+    for(i = 0; i < ingest->count; ++i){
+        free(ingest->files[i].data);
+        if(ingest->files[i].fd >= 0){
+            close(ingest->files[i].fd);
+        }
+    }
+    pthread_cond_destroy(&ingest->ready);
+    pthread_cond_destroy(&ingest->space);
+    pthread_mutex_destroy(&ingest->lock);
+    free(ingest->files);
+    free(ingest);
+}
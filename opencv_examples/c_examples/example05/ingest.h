@@ -0,0 +1,51 @@
+/** Filename: ingest.h
+*
+*   Description: read-ahead of input files for batch mode.
+*
+*   cvLoadImage opens and reads the file and then decodes it on the same thread, so a
+*   worker waiting for the disk does no decoding and a cold-cache batch runs at the speed
+*   of one read at a time per worker. The ingest stage instead reads the upcoming files,
+*   in order, into memory buffers with up to depth files outstanding, and the workers
+*   decode the buffers with cvDecodeImage.
+*
+*   The reads go through io_uring: one thread submits reads for many files at once and
+*   collects them as they complete. Where io_uring is not available (older kernels, or
+*   disabled by the administrator or a seccomp filter), depth threads each read one file
+*   at a time with plain read calls.
+*/
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+
+typedef struct Ingest Ingest;
+
+typedef enum IngestMethod{
+    INGEST_AUTO = 0,                    /// io_uring if available, else threads
+    INGEST_URING,
+    INGEST_THREADS
+} IngestMethod;
+
+/** Parse "N", "uring:N" or "threads:N" into a method and a depth. Returns 0, or -1. */
+int ingestParse(const char* spec, IngestMethod* method, int* depth);
+
+/** Start reading the count files named in paths, keeping up to depth of them read or
+*   being read but not yet taken. Returns NULL on failure. */
+Ingest* ingestStart(char** paths, int count, IngestMethod method, int depth);
+
+/** Return the method actually used, INGEST_URING or INGEST_THREADS */
+IngestMethod ingestMethod(const Ingest* ingest);
+
+/** Return the name of a method */
+const char* ingestMethodName(IngestMethod method);
+
+/** Wait until file index has been read and take its contents, which the caller frees
+*   with free(). Each index must be taken exactly once. Returns 0, or -1 if the file
+*   could not be read; errno tells why. */
+int ingestTake(Ingest* ingest, int index, unsigned char** data, size_t* size);
+
+/** Stop reading, wait for the reads in flight and free the files not taken */
+void ingestStop(Ingest* ingest);
+
+#endif
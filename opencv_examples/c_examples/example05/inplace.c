@@ -0,0 +1,59 @@
+/** Filename: inplace.c
+*
+*   Description: in-place conversion of an IplImage from BGR to gray.
+*
+*   The converted image keeps the pixel buffer of the color image, so no second buffer is
+*   ever allocated and the peak memory of a conversion is the color image alone, 3 bytes
+*   per pixel, instead of 4 or more. The buffer was allocated by OpenCV (cvLoadImage,
+*   cvCreateImage) and is freed by cvReleaseImage, so it cannot be shrunk with realloc.
+*   Instead the whole pages past the gray pixels are returned with madvise(MADV_DONTNEED):
+*   the address range stays valid and cvReleaseImage frees the block as usual, but the
+*   pages no longer take up memory. Large images are allocated with mmap, so nearly all of
+*   the color image beyond the first third is returned.
+*/
+
+#include "inplace.h"
+#include "gray.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+int inPlaceGray(IplImage* img, size_t* released){
+    if(released != NULL){
+        *released = 0;
+    }
+    if(img == NULL){
+        return GRAY_ERR_NULL;
+    }
+    if(img->nChannels != 3 || img->depth != IPL_DEPTH_8U || img->roi != NULL){
+        return GRAY_ERR_SIZE;
+    }
+
+    int grayStep;
+    int status = grayConvertInPlace((unsigned char*)img->imageData, img->widthStep,
+                                    img->width, img->height, &grayStep);
+    if(status != GRAY_OK){
+        return status;
+    }
+
+    /** The header now describes a gray image in the same buffer */
+    uintptr_t colorEnd = (uintptr_t)img->imageData + (uintptr_t)img->imageSize;
+    img->nChannels = 1;
+    img->widthStep = grayStep;
+    img->imageSize = grayStep * img->height;
+    memcpy(img->colorModel, "GRAY", 4);
+    memcpy(img->channelSeq, "GRAY", 4);
+
+    /** Only pages lying entirely past the gray pixels are returned */
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)img->imageData + (uintptr_t)img->imageSize + page - 1) & ~(page - 1);
+    uintptr_t end = colorEnd & ~(page - 1);
+    if(end > begin && madvise((void*)begin, end - begin, MADV_DONTNEED) == 0 && released != NULL){
+        *released = end - begin;
+    }
+
+    return GRAY_OK;
+}
@@ -0,0 +1,19 @@
+/** Filename: inplace.h
+*
+*   Description: in-place conversion of an IplImage from BGR to gray.
+*/
+
+#ifndef INPLACE_H
+#define INPLACE_H
+
+#include <stddef.h>
+#include <opencv/cv.h>
+
+/** Convert the 8 bit BGR image img to gray in its own pixel buffer with
+*   grayConvertInPlace and turn it into a 1 channel IplImage with the gray widthStep.
+*   The memory after the gray pixels is given back to the operating system, whole pages
+*   at a time, and the number of bytes given back is stored in released if not NULL.
+*   The image must not have an ROI. Returns GRAY_OK or a GrayStatus code. */
+int inPlaceGray(IplImage* img, size_t* released);
+
+#endif
@@ -0,0 +1,393 @@
+/** Filename: latency.c
+*
+*   Description: HDR-style latency histograms for per-frame timings.
+*
+*   Bucket layout. Let b be the number of bits a value has above the top half of the
+*   sub-buckets, b = max(0, msb(v) - (LATENCY_SUB_BUCKET_BITS - 1)). Then v >> b lies in
+*   [0, LATENCY_SUB_BUCKETS) and the bucket index is b * LATENCY_SUB_BUCKETS / 2 + (v >> b).
+*   For b = 0 this is the value itself; for b > 0, v >> b lies in the upper half of the
+*   sub-buckets, and successive b follow each other without gaps.
+*
+*   The owner thread updates a histogram with relaxed atomic loads and stores instead of
+*   read-modify-write instructions: nobody else writes to it, and readers only need each
+*   64 bit counter to be read whole.
+*/
+
+#include "latency.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HALF_SUB_BUCKETS (LATENCY_SUB_BUCKETS / 2)
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+
+uint64_t latencyNow(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+static int compareNs(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+uint64_t latencyMedian(uint64_t* ns, int count){
+    qsort(ns, (size_t)count, sizeof(*ns), compareNs);
+    return ns[count / 2];
+}
+
+
+int latencyParseSize(const char* text, int* width, int* height){
+    int w, h;
+
+    if(sscanf(text, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0){
+        return -1;
+    }
+    *width = w;
+    *height = h;
+    return 0;
+}
+
+
+void latencyFillRandom(unsigned char* data, size_t size, unsigned* seed){
+    unsigned s = *seed;
+    size_t i;
+
+    for(i = 0; i < size; ++i){
+        s = s * 1103515245 + 12345;
+        data[i] = (unsigned char)(s >> 16);
+    }
+    *seed = s;
+}
+
+
+static int bucketIndex(uint64_t v){
+    if(v >= (uint64_t)1 << LATENCY_MAX_BITS){
+        return LATENCY_COUNTS - 1;
+    }
+
+    int msb = v == 0 ? 0 : 63 - __builtin_clzll(v);
+    int b = msb - (LATENCY_SUB_BUCKET_BITS - 1);
+    if(b < 0) b = 0;
+
+    return b * HALF_SUB_BUCKETS + (int)(v >> b);
+}
+
+
+/** The range of values [lowest, highest] counted in bucket i */
+static void bucketRange(int i, uint64_t* lowest, uint64_t* highest){
+    int b = i < LATENCY_SUB_BUCKETS ? 0 : i / HALF_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(i - b * HALF_SUB_BUCKETS);
+
+    *lowest = sub << b;
+    *highest = *lowest + ((uint64_t)1 << b) - 1;
+}
+
+
+void latencyReset(LatencyHistogram* h){
+    memset(h, 0, sizeof(*h));
+    h->minNs = UINT64_MAX;
+}
+
+
+void latencyRecord(LatencyHistogram* h, uint64_t ns){
+    int i = bucketIndex(ns);
+
+    STORE(h->counts[i], LOAD(h->counts[i]) + 1);
+    STORE(h->sumNs, LOAD(h->sumNs) + ns);
+    if(ns < LOAD(h->minNs)) STORE(h->minNs, ns);
+    if(ns > LOAD(h->maxNs)) STORE(h->maxNs, ns);
+
+    /** count last, with release, so a reader that sees the count also sees the bucket */
+    __atomic_store_n(&h->count, LOAD(h->count) + 1, __ATOMIC_RELEASE);
+}
+
+
+void latencyMerge(LatencyHistogram* dst, const LatencyHistogram* src){
+    uint64_t count = __atomic_load_n(&src->count, __ATOMIC_ACQUIRE);
+    uint64_t v;
+    int i;
+
+    if(count == 0){
+        return;
+    }
+
+    for(i = 0; i < LATENCY_COUNTS; ++i){
+        dst->counts[i] += LOAD(src->counts[i]);
+    }
+
+    /** Samples recorded while we copied the buckets are in the counts, so take the
+    *   total from them rather than from the count read above */
+    dst->count = 0;
+    for(i = 0; i < LATENCY_COUNTS; ++i){
+        dst->count += dst->counts[i];
+    }
+
+    dst->sumNs += LOAD(src->sumNs);
+    v = LOAD(src->minNs);
+    if(v < dst->minNs) dst->minNs = v;
+    v = LOAD(src->maxNs);
+    if(v > dst->maxNs) dst->maxNs = v;
+}
+
+
+void latencyDelta(LatencyHistogram* out, const LatencyHistogram* now, const LatencyHistogram* before){
+    uint64_t lowest, highest;
+    int i;
+
+    latencyReset(out);
+    for(i = 0; i < LATENCY_COUNTS; ++i){
+        uint64_t n = now->counts[i] - before->counts[i];
+        if(n == 0) continue;
+
+        out->counts[i] = n;
+        out->count += n;
+        bucketRange(i, &lowest, &highest);
+        if(lowest < out->minNs) out->minNs = lowest;
+        if(highest > out->maxNs) out->maxNs = highest;
+    }
+    out->sumNs = now->sumNs - before->sumNs;
+
+    /** The exact extremes are better whenever they fall inside the interval */
+    if(out->count > 0){
+        if(now->maxNs > before->maxNs) out->maxNs = now->maxNs;
+        if(now->minNs < before->minNs) out->minNs = now->minNs;
+    }
+}
+
+
+uint64_t latencyPercentile(const LatencyHistogram* h, double percent){
+    if(h->count == 0){
+        return 0;
+    }
+
+    /** rank is the 1-based position of the sample we are looking for, rounded up so that
+    *   p99.9 of 1000 samples is the 999th sample, not the 998th */
+    uint64_t rank = (uint64_t)(percent / 100.0 * (double)h->count + 0.999999);
+    if(rank < 1) rank = 1;
+    if(rank > h->count) rank = h->count;
+
+    uint64_t seen = 0, lowest, highest;
+    int i;
+    for(i = 0; i < LATENCY_COUNTS; ++i){
+        seen += h->counts[i];
+        if(seen >= rank){
+            bucketRange(i, &lowest, &highest);
+            return highest < h->maxNs ? highest : h->maxNs;
+        }
+    }
+
+    return h->maxNs;
+}
+
+
+void latencyPrint(FILE* out, const char* label, const LatencyHistogram* h){
+    if(h->count == 0){
+        fprintf(out, "%s: no samples\n", label);
+        return;
+    }
+
+    fprintf(out, "%s: n=%llu min=%.1f mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n",
+            label, (unsigned long long)h->count,
+            h->minNs / 1000.0,
+            (double)h->sumNs / (double)h->count / 1000.0,
+            latencyPercentile(h, 50.0) / 1000.0,
+            latencyPercentile(h, 90.0) / 1000.0,
+            latencyPercentile(h, 99.0) / 1000.0,
+            latencyPercentile(h, 99.9) / 1000.0,
+            h->maxNs / 1000.0);
+}
+
+
+void latencyPrintBuckets(FILE* out, const LatencyHistogram* h){
+    uint64_t ranges[LATENCY_MAX_BITS + 1] = {0};
+    uint64_t lowest, highest, peak = 0;
+    int i, r;
+
+    /** Sum the buckets into power of two ranges of microseconds: range 0 is [0, 1) us,
+    *   range r is [2^(r-1), 2^r) us */
+    for(i = 0; i < LATENCY_COUNTS; ++i){
+        if(h->counts[i] == 0) continue;
+        bucketRange(i, &lowest, &highest);
+        uint64_t us = lowest / 1000;
+        r = us == 0 ? 0 : 64 - __builtin_clzll(us);
+        ranges[r] += h->counts[i];
+    }
+    for(r = 0; r <= LATENCY_MAX_BITS; ++r){
+        if(ranges[r] > peak) peak = ranges[r];
+    }
+
+    for(r = 0; r <= LATENCY_MAX_BITS; ++r){
+        if(ranges[r] == 0) continue;
+        fprintf(out, "  [%8llu, %8llu) us %10llu %.*s\n",
+                r == 0 ? 0ull : 1ull << (r - 1), 1ull << r,
+                (unsigned long long)ranges[r], (int)(50 * ranges[r] / peak),
+                "##################################################");
+    }
+}
+
+
+void latencyRecorderInit(LatencyRecorder* rec, const char* name){
+    memset(rec, 0, sizeof(*rec));
+    rec->name = name;
+}
+
+
+LatencyHistogram* latencyRecorderThread(LatencyRecorder* rec){
+    LatencyHistogram* h = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(h == NULL){
+        return NULL;
+    }
+    latencyReset(h);
+
+    int slot = __atomic_fetch_add(&rec->threads, 1, __ATOMIC_ACQ_REL);
+    if(slot >= LATENCY_MAX_THREADS){
+        free(h);
+        return NULL;
+    }
+
+    __atomic_store_n(&rec->histograms[slot], h, __ATOMIC_RELEASE);
+    return h;
+}
+
+
+void latencyRecorderSnapshot(LatencyRecorder* rec, LatencyHistogram* out){
+    int n = __atomic_load_n(&rec->threads, __ATOMIC_ACQUIRE);
+    int i;
+
+    latencyReset(out);
+    if(n > LATENCY_MAX_THREADS) n = LATENCY_MAX_THREADS;
+
+    for(i = 0; i < n; ++i){
+        /** A slot may be claimed but not yet filled in */
+        LatencyHistogram* h = __atomic_load_n(&rec->histograms[i], __ATOMIC_ACQUIRE);
+        if(h != NULL){
+            latencyMerge(out, h);
+        }
+    }
+}
+
+
+void latencyRecorderFree(LatencyRecorder* rec){
+    int i;
+    for(i = 0; i < LATENCY_MAX_THREADS; ++i){
+        free(rec->histograms[i]);
+        rec->histograms[i] = NULL;
+    }
+    rec->threads = 0;
+}
+
+
+struct LatencyReporter{
+    LatencyRecorder** recs;
+    int count;
+    double seconds;
+    FILE* out;
+    LatencyHistogram* previous;         /// one per recorder, the totals at the last report
+    LatencyHistogram scratch[2];        /// current totals and the interval
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+};
+
+
+static void* reporterMain(void* arg){
+    LatencyReporter* rep = (LatencyReporter*)arg;
+    struct timespec deadline;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    pthread_mutex_lock(&rep->lock);
+    while(!rep->stop){
+        uint64_t ns = (uint64_t)(rep->seconds * 1e9);
+        deadline.tv_sec += (time_t)(ns / 1000000000u);
+        deadline.tv_nsec += (long)(ns % 1000000000u);
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while(!rep->stop && pthread_cond_timedwait(&rep->wake, &rep->lock, &deadline) != ETIMEDOUT){
+        }
+        if(rep->stop){
+            break;
+        }
+
+        for(i = 0; i < rep->count; ++i){
+            latencyRecorderSnapshot(rep->recs[i], &rep->scratch[0]);
+            latencyDelta(&rep->scratch[1], &rep->scratch[0], &rep->previous[i]);
+            rep->previous[i] = rep->scratch[0];
+
+            char label[64];
+            snprintf(label, sizeof(label), "[last %gs] %s", rep->seconds, rep->recs[i]->name);
+            latencyPrint(rep->out, label, &rep->scratch[1]);
+        }
+        fflush(rep->out);
+    }
+    pthread_mutex_unlock(&rep->lock);
+
+    return NULL;
+}
+
+
+LatencyReporter* latencyReporterStart(LatencyRecorder** recs, int count, double seconds, FILE* out){
+    LatencyReporter* rep = (LatencyReporter*)calloc(1, sizeof(LatencyReporter));
+    if(rep == NULL){
+        return NULL;
+    }
+
+    rep->previous = (LatencyHistogram*)malloc(count * sizeof(LatencyHistogram));
+    if(rep->previous == NULL){
+        free(rep);
+        return NULL;
+    }
+
+    int i;
+    for(i = 0; i < count; ++i){
+        latencyReset(&rep->previous[i]);
+    }
+
+    rep->recs = recs;
+    rep->count = count;
+    rep->seconds = seconds;
+    rep->out = out;
+    pthread_mutex_init(&rep->lock, NULL);
+    pthread_cond_init(&rep->wake, NULL);
+
+    if(pthread_create(&rep->thread, NULL, reporterMain, rep) != 0){
+        free(rep->previous);
+        free(rep);
+        return NULL;
+    }
+
+    return rep;
+}
+
+
+void latencyReporterStop(LatencyReporter* rep){
+    if(rep == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&rep->lock);
+    rep->stop = 1;
+    pthread_cond_signal(&rep->wake);
+    pthread_mutex_unlock(&rep->lock);
+
+    pthread_join(rep->thread, NULL);
+    pthread_mutex_destroy(&rep->lock);
+    pthread_cond_destroy(&rep->wake);
+    free(rep->previous);
+    free(rep);
+}
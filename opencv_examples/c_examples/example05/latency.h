@@ -0,0 +1,112 @@
+/** Filename: latency.h
+*
+*   Description: HDR-style latency histograms for per-frame timings.
+*
+*   An average hides the slow frames we care about, such as the page faults on the first
+*   touch of a new gray image or a pause in the allocator, so every sample is counted and
+*   percentiles are read back from the counts.
+*
+*   The buckets follow the layout of an HDR histogram. Values below LATENCY_SUB_BUCKETS
+*   nanoseconds get a bucket each. Above that, every power of two range [2^k, 2^(k+1))
+*   is split into LATENCY_SUB_BUCKETS / 2 equal buckets, so each recorded value is within
+*   1 part in 512 (about 0.2%) of the true value whether it is 3 microseconds or 3
+*   minutes. Values of 2^LATENCY_MAX_BITS ns (about 18 minutes) or more are counted in
+*   the last bucket; the exact minimum and maximum are always kept.
+*
+*   A histogram has one writer. When several threads record the same stage, each thread
+*   gets its own histogram from a LatencyRecorder and the histograms are merged when the
+*   results are read. Recording is a handful of relaxed atomic loads and stores to memory
+*   no other thread writes, so the hot path never takes a lock or bounces a cache line,
+*   and a reader may merge the histograms while they are being written.
+*
+*   Every benchmark links this file, so it also holds what they share: the median of a
+*   run of repeats, the -s widthxheight option and the random bytes of a test image.
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LATENCY_SUB_BUCKET_BITS 10
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS 40
+#define LATENCY_COUNTS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 2) * (LATENCY_SUB_BUCKETS / 2))
+
+#define LATENCY_MAX_THREADS 256         /// histograms per recorder
+
+typedef struct LatencyHistogram{
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t minNs;
+    uint64_t maxNs;
+    uint64_t counts[LATENCY_COUNTS];
+} LatencyHistogram;
+
+/** A named stage, such as "load" or "convert", with one histogram per recording thread */
+typedef struct LatencyRecorder{
+    const char* name;
+    int threads;
+    LatencyHistogram* histograms[LATENCY_MAX_THREADS];
+} LatencyRecorder;
+
+typedef struct LatencyReporter LatencyReporter;
+
+/** Return the current time of CLOCK_MONOTONIC in nanoseconds */
+uint64_t latencyNow(void);
+
+/** Sort the count samples in ns and return the middle one, what the benchmarks report
+*   for count repeats of the same work */
+uint64_t latencyMedian(uint64_t* ns, int count);
+
+/** Parse a size such as 1920x1080. Returns 0, or -1 and leaves width and height alone
+*   if text is not two positive numbers. */
+int latencyParseSize(const char* text, int* width, int* height);
+
+/** Fill size bytes with pseudo-random bytes, continuing the sequence from *seed. The
+*   benchmarks start *seed at 1, so every run converts the same image. */
+void latencyFillRandom(unsigned char* data, size_t size, unsigned* seed);
+
+void latencyReset(LatencyHistogram* h);
+
+/** Record one sample. Only one thread may record into a given histogram. */
+void latencyRecord(LatencyHistogram* h, uint64_t ns);
+
+/** Add the samples of src to dst. src may be recorded into while this runs. */
+void latencyMerge(LatencyHistogram* dst, const LatencyHistogram* src);
+
+/** Set out to the samples in now that are not in before, an earlier copy of the same
+*   histogram. The minimum and maximum of out are bucket edges, not exact values. */
+void latencyDelta(LatencyHistogram* out, const LatencyHistogram* now, const LatencyHistogram* before);
+
+/** Return the smallest latency in nanoseconds that at least percent % of the samples
+*   do not exceed, to within the bucket precision */
+uint64_t latencyPercentile(const LatencyHistogram* h, double percent);
+
+/** Print count, min, mean, p50, p90, p99, p99.9 and max, one line, in microseconds */
+void latencyPrint(FILE* out, const char* label, const LatencyHistogram* h);
+
+/** Print the shape of the histogram, one line per power of two range of microseconds */
+void latencyPrintBuckets(FILE* out, const LatencyHistogram* h);
+
+/** Start a recorder with no histograms. name is not copied. */
+void latencyRecorderInit(LatencyRecorder* rec, const char* name);
+
+/** Give the calling thread its own histogram in rec. Call once per thread, before the
+*   hot loop. Returns NULL if the histogram could not be allocated. */
+LatencyHistogram* latencyRecorderThread(LatencyRecorder* rec);
+
+/** Merge every thread's histogram into out */
+void latencyRecorderSnapshot(LatencyRecorder* rec, LatencyHistogram* out);
+
+/** Free the histograms. No thread may record into rec afterwards. */
+void latencyRecorderFree(LatencyRecorder* rec);
+
+/** Start a thread that prints the percentiles of the samples recorded in the last
+*   seconds seconds for each of the count recorders, every seconds seconds */
+LatencyReporter* latencyReporterStart(LatencyRecorder** recs, int count, double seconds, FILE* out);
+
+void latencyReporterStop(LatencyReporter* rep);
+
+#endif
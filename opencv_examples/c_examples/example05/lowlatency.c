@@ -0,0 +1,324 @@
+/** Filename: lowlatency.c
+*
+*   Description: a low-latency band converter for single frames.
+*
+*   Handoff protocol. The caller writes the frame description into the pool, sets done
+*   to 0 and increments seq. Each worker spins until seq differs from the last value it
+*   saw, converts its band and increments done. The caller converts band 0 and then
+*   spins until done reaches threads - 1. All waits go through waitWhileEqual(), which
+*   spins first and then sleeps on a futex; sleepers counts the threads that may be
+*   asleep so that the waker only makes a system call when someone needs it.
+*/
+
+#define _GNU_SOURCE
+#include "lowlatency.h"
+#include "gray.h"
+#include "trace.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpuRelax() _mm_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() __asm__ __volatile__("yield")
+#else
+#define cpuRelax() ((void)0)
+#endif
+
+
+typedef struct Worker{
+    LowLatencyPool* pool;
+    int band;
+    pthread_t thread;
+} Worker;
+
+struct LowLatencyPool{
+    /** Written by the caller before seq is incremented, read by the workers after */
+    const unsigned char* colorData;
+    unsigned char* grayData;
+    int colorStep, grayStep, width, height;
+
+    int threads;
+    int spins;
+    int started;                            /// workers successfully created
+    int callerPinned;                       /// callerMask is to be restored
+    cpu_set_t callerMask;                   /// the calling thread's affinity before the pool
+    Worker workers[LOWLATENCY_MAX_THREADS];
+
+    /** The counters live on their own cache lines so that spinning on one does not
+    *   bounce the line holding the other */
+    _Alignas(64) atomic_uint seq;           /// frame generation
+    _Alignas(64) atomic_uint done;          /// bands finished in this generation
+    _Alignas(64) atomic_int sleepers;       /// threads that may be in futex wait
+    atomic_int stop;
+};
+
+
+static void waitWhileEqual(LowLatencyPool* pool, atomic_uint* word, unsigned value){
+    int i;
+
+    for(i = 0; i < pool->spins; ++i){
+        if(atomic_load_explicit(word, memory_order_acquire) != value){
+            return;
+        }
+        cpuRelax();
+    }
+
+    /** The increment of sleepers and the load of word are both sequentially consistent,
+    *   as are the waker's update of word and load of sleepers, so either we see the new
+    *   value or the waker sees us and issues the futex wake */
+    atomic_fetch_add(&pool->sleepers, 1);
+    while(atomic_load(word) == value){
+#ifdef __linux__
+        syscall(SYS_futex, (unsigned*)word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+        sched_yield();
+#endif
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+}
+
+
+static void wakeAll(LowLatencyPool* pool, atomic_uint* word){
+    if(atomic_load(&pool->sleepers) > 0){
+#ifdef __linux__
+        syscall(SYS_futex, (unsigned*)word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+        (void)word;
+#endif
+    }
+}
+
+
+static void convertBand(LowLatencyPool* pool, int band){
+    int rowStart = (int)((long long)pool->height * band / pool->threads);
+    int rowEnd = (int)((long long)pool->height * (band + 1) / pool->threads);
+
+    uint64_t start = traceClock();
+    grayConvertRows(pool->colorData, pool->colorStep, pool->grayData, pool->grayStep,
+                    pool->width, rowStart, rowEnd);
+    traceSpanBand("convert band", start, band, rowStart, rowEnd);
+}
+
+
+static void* workerMain(void* arg){
+    Worker* w = (Worker*)arg;
+    LowLatencyPool* pool = w->pool;
+    unsigned seen = 0;
+
+    traceThreadName("low-latency worker");
+
+    for(;;){
+        uint64_t start = traceClock();
+        waitWhileEqual(pool, &pool->seq, seen);
+        traceSpan("wait for frame", start);
+        seen = atomic_load_explicit(&pool->seq, memory_order_acquire);
+
+        if(atomic_load_explicit(&pool->stop, memory_order_acquire)){
+            break;
+        }
+
+        convertBand(pool, w->band);
+
+        atomic_fetch_add(&pool->done, 1);
+        wakeAll(pool, &pool->done);
+    }
+
+    return NULL;
+}
+
+
+static void pinSelf(int cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0){
+        fprintf(stderr, "lowlatency: could not pin to cpu %d\n", cpu);
+    }
+}
+
+
+LowLatencyPool* lowLatencyCreate(int threads, const int* cpus, int ncpus, int spins){
+    if(threads < 1 || threads > LOWLATENCY_MAX_THREADS){
+        return NULL;
+    }
+
+    LowLatencyPool* pool;
+    if(posix_memalign((void**)&pool, 64, sizeof(*pool)) != 0){
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->threads = threads;
+    pool->spins = spins;
+    atomic_init(&pool->seq, 0);
+    atomic_init(&pool->done, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->stop, 0);
+
+    if(ncpus > 0){
+        pool->callerPinned = pthread_getaffinity_np(pthread_self(), sizeof(pool->callerMask),
+                                                    &pool->callerMask) == 0;
+        pinSelf(cpus[0]);
+    }
+
+    int i;
+    for(i = 1; i < threads; ++i){
+        Worker* w = &pool->workers[i];
+        pthread_attr_t attr;
+
+        w->pool = pool;
+        w->band = i;
+
+        pthread_attr_init(&attr);
+        if(ncpus > 0){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % ncpus], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+
+        int err = pthread_create(&w->thread, &attr, workerMain, w);
+        pthread_attr_destroy(&attr);
+        if(err != 0){
+            lowLatencyDestroy(pool);
+            return NULL;
+        }
+        pool->started = i;
+    }
+
+    return pool;
+}
+
+
+void lowLatencyConvert(LowLatencyPool* pool,
+                       const unsigned char* colorData, int colorStep,
+                       unsigned char* grayData, int grayStep,
+                       int width, int height){
+
+    pool->colorData = colorData;
+    pool->colorStep = colorStep;
+    pool->grayData = grayData;
+    pool->grayStep = grayStep;
+    pool->width = width;
+    pool->height = height;
+
+    atomic_store_explicit(&pool->done, 0, memory_order_relaxed);
+    atomic_fetch_add(&pool->seq, 1);        /// publishes the frame to the workers
+    wakeAll(pool, &pool->seq);
+
+    convertBand(pool, 0);
+
+    unsigned workers = (unsigned)pool->threads - 1;
+    unsigned d;
+    uint64_t start = traceClock();
+    while((d = atomic_load_explicit(&pool->done, memory_order_acquire)) != workers){
+        waitWhileEqual(pool, &pool->done, d);
+    }
+    traceSpan("wait for bands", start);
+}
+
+
+void lowLatencyDestroy(LowLatencyPool* pool){
+    if(pool == NULL){
+        return;
+    }
+
+    atomic_store(&pool->stop, 1);
+    atomic_fetch_add(&pool->seq, 1);
+    wakeAll(pool, &pool->seq);
+
+    int i;
+    for(i = 1; i <= pool->started; ++i){
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    if(pool->callerPinned){
+        pthread_setaffinity_np(pthread_self(), sizeof(pool->callerMask), &pool->callerMask);
+    }
+    free(pool);
+}
+
+
+int lowLatencyParseCpus(const char* list, int* cpus, int max){
+    int n = 0;
+    const char* p = list;
+
+    while(*p != '\0' && *p != '\n'){
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if(end == p || first < 0){
+            return -1;
+        }
+        p = end;
+        if(*p == '-'){
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first){
+                return -1;
+            }
+            p = end;
+        }
+
+        long c;
+        for(c = first; c <= last; ++c){
+            if(n == max){
+                return -1;
+            }
+            cpus[n++] = (int)c;
+        }
+
+        if(*p == ','){
+            ++p;
+        }
+        else if(*p != '\0' && *p != '\n'){
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+
+int lowLatencyDefaultCpus(int* cpus, int max){
+    char line[1024];
+    int n = 0;
+
+    FILE* f = fopen("/sys/devices/system/cpu/isolated", "r");
+    if(f != NULL){
+        if(fgets(line, sizeof(line), f) != NULL){
+            n = lowLatencyParseCpus(line, cpus, max);
+        }
+        fclose(f);
+    }
+    if(n > 0){
+        return n;
+    }
+
+    cpu_set_t set;
+    n = 0;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+        int c;
+        for(c = 0; c < CPU_SETSIZE && n < max; ++c){
+            if(CPU_ISSET(c, &set)){
+                cpus[n++] = c;
+            }
+        }
+    }
+
+    return n;
+}
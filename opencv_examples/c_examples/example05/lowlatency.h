@@ -0,0 +1,56 @@
+/** Filename: lowlatency.h
+*
+*   Description: a low-latency band converter for single frames.
+*
+*   A thread pool that parks its workers on a condition variable pays a kernel wakeup on
+*   every frame, and the wakeup time varies from frame to frame. Here the worker threads
+*   are pinned to one core each and spin on an atomic frame counter, executing the CPU's
+*   pause instruction, so that a new frame is picked up within a few hundred nanoseconds.
+*   Only after spinning for a while does a worker go to sleep on a futex. Handing a frame
+*   to the workers and collecting the finished bands never takes a lock.
+*
+*   The calling thread converts the first band itself, so a pool of N threads uses the
+*   caller plus N - 1 workers.
+*/
+
+#ifndef LOWLATENCY_H
+#define LOWLATENCY_H
+
+#define LOWLATENCY_MAX_THREADS 64
+#define LOWLATENCY_DEFAULT_SPINS 20000  /// pause iterations before a waiter sleeps
+
+typedef struct LowLatencyPool LowLatencyPool;
+
+/** Create a pool of threads bands (the caller plus threads - 1 workers).
+*
+*   Parameters:
+*       threads – number of bands each frame is split into, 1 to LOWLATENCY_MAX_THREADS
+*       cpus – cores to pin to; band i runs on cpus[i % ncpus]. The calling thread is
+*              pinned to cpus[0] until lowLatencyDestroy, which restores its affinity.
+*              May be NULL if ncpus is 0, which disables pinning.
+*       ncpus – number of entries in cpus
+*       spins – pause iterations a waiting thread spins before it sleeps
+*
+*   Returns NULL if the threads could not be started.
+*/
+LowLatencyPool* lowLatencyCreate(int threads, const int* cpus, int ncpus, int spins);
+
+/** Convert one BGR frame to gray, returning when every band has been written */
+void lowLatencyConvert(LowLatencyPool* pool,
+                       const unsigned char* colorData, int colorStep,
+                       unsigned char* grayData, int grayStep,
+                       int width, int height);
+
+/** Stop and join the workers and free the pool. Call it from the thread that created the
+*   pool, whose affinity it restores. */
+void lowLatencyDestroy(LowLatencyPool* pool);
+
+/** Parse a core list such as "2,3,6-9" into cpus. Returns the number of cores parsed,
+*   or -1 if the list is malformed or holds more than max cores. */
+int lowLatencyParseCpus(const char* list, int* cpus, int max);
+
+/** Fill cpus with the isolated cores (/sys/devices/system/cpu/isolated), or with the
+*   cores this process may run on if none are isolated. Returns the number of cores. */
+int lowLatencyDefaultCpus(int* cpus, int max);
+
+#endif
@@ -0,0 +1,71 @@
+/** Filename: matimage.hpp
+*
+*   Description: move-only ownership of cv::Mat images for the C++ port of example05.
+*
+*   cv::Mat shares its pixels between copies through a reference count, so after
+*   "cv::Mat b = a;" writing to b also changes a. MatImage wraps a cv::Mat that nobody
+*   else refers to and can only be moved, so there is always exactly one owner of the
+*   pixels, and they are freed when that owner goes out of scope, as with gray::Image.
+*/
+
+#ifndef MATIMAGE_HPP
+#define MATIMAGE_HPP
+
+#include <stdexcept>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "gray.hpp"
+
+class MatImage {
+public:
+    MatImage() {}
+
+    /** Take the pixels of m. m must not share them with another cv::Mat; clone() it
+    *   first if it might. */
+    explicit MatImage(cv::Mat& m) : mat_(m) { m.release(); }
+
+    MatImage(int rows, int cols, int type) : mat_(rows, cols, type) {}
+
+    MatImage(MatImage&& other) : mat_(other.mat_) { other.mat_.release(); }
+
+    MatImage& operator=(MatImage&& other){
+        if(this != &other){
+            mat_ = other.mat_;
+            other.mat_.release();
+        }
+        return *this;
+    }
+
+    MatImage(const MatImage&) = delete;
+    MatImage& operator=(const MatImage&) = delete;
+
+    bool empty() const { return mat_.empty(); }
+
+    /** The pixels as a cv::Mat, for passing to OpenCV. Do not keep a copy of it beyond
+    *   the life of this MatImage. */
+    cv::Mat& mat() { return mat_; }
+    const cv::Mat& mat() const { return mat_; }
+
+private:
+    cv::Mat mat_;
+};
+
+/** Load an image file as BGR. Throws std::runtime_error if it cannot be read. */
+inline MatImage loadColor(const std::string& path){
+    cv::Mat m = cv::imread(path, 1);
+    if(m.empty()){
+        throw std::runtime_error("File " + path + " not opened");
+    }
+    return MatImage(m);
+}
+
+/** A cv::Mat header over the pixels of a gray::Image; the image keeps ownership */
+inline cv::Mat matView(gray::Image& img){
+    return cv::Mat(img.height(), img.width(), img.channels() == 3 ? CV_8UC3 : CV_8UC1,
+                   img.data(), static_cast<size_t>(img.step()));
+}
+
+#endif
@@ -0,0 +1,60 @@
+/** Filename: modes.h
+*
+*   Description: the run modes of example05 besides the single image demo.
+*/
+
+#ifndef MODES_H
+#define MODES_H
+
+#include "gray.h"
+
+#define MODES_MAX_RECTS 64              /// regions of interest per image
+
+/** Command line settings shared by the modes */
+typedef struct Options{
+    int frames;                 /// frames to time in low-latency mode
+    int threads;                /// bands per frame (-L) or worker threads (-b)
+    int spins;                  /// pause iterations before a waiting thread sleeps
+    const char* cpuList;        /// cores to pin to, NULL for the default
+    double reportSeconds;       /// print interval percentiles this often, 0 for never
+    const char* outputDir;      /// batch mode writes the gray images here, NULL for no output
+    int display;                /// show windows; 0 with -N or in a headless build
+    const char* threadPolicy;   /// batch mode: flat, nested, serial, W:T or auto; NULL to leave alone
+    int useOpenCV;              /// batch mode converts with cvCvtColor instead of libgray
+    GrayRect rects[MODES_MAX_RECTS];    /// convert only these regions (-r), none for the whole image
+    int rectCount;
+    int inPlace;                /// convert in the color image's own buffer (-I)
+    const char* hugePages;      /// low-latency frame buffers: off, thp or hugetlb; NULL for cvCreateImage
+    int numa;                   /// node-local bands (demo) or per-node worker groups (batch), -M
+    const char* readAhead;      /// batch mode read-ahead (-R): N, uring:N or threads:N files
+    const char* cacheDir;       /// batch mode gray image cache (-K): dir[:megabytes]
+    int tileWidth;              /// video mode converts only changed tiles of this size (-d),
+    int tileHeight;             /// 0 to convert whole frames
+    int viewer;                 /// demo shows the gray image in the pyramid viewer (-Z)
+    int linear;                 /// demo and video mode convert in linear light (-G)
+    GrayConverter converter;    /// luma standard (-S) and kernel of the demo, batch and video mode
+    int rowAlign;               /// demo and low-latency rows padded and aligned to this (-A), 0 for cvCreateImage
+} Options;
+
+/** Batch mode: load and convert every image in images on opt->threads threads */
+int runBatch(const Options* opt, char** images, int count);
+
+/** Video mode: convert and display the frames of a video file, or of a camera when
+*   source is a camera number such as 0 */
+int runVideo(const Options* opt, const char* source);
+
+/** Frame daemon mode: create the shared-memory frame ring described by spec,
+*   name[:slots[:widthxheight]], and convert the frames producers write into it on
+*   opt->threads threads until SIGINT or SIGTERM */
+int runDaemon(const Options* opt, const char* spec);
+
+/** Conversion server mode: listen on the Unix domain socket described by spec,
+*   path[:batch[:delayus]], and convert the images clients send on opt->threads threads,
+*   in batches, until SIGINT or SIGTERM */
+int runServer(const Options* opt, const char* spec);
+
+/** Worker mode: convert jobs read from stdin until it is closed. format is "paths" for
+*   lines of input and output file names, or "raw" for length-prefixed BGR frames. */
+int runWorker(const Options* opt, const char* format);
+
+#endif
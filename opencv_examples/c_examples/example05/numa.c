@@ -0,0 +1,345 @@
+/** Filename: numa.c
+*
+*   Description: NUMA topology and node-local band conversion. See numa.h.
+*/
+
+#define _GNU_SOURCE
+#include "numa.h"
+#include "gray.h"
+#include "hugepage.h"
+#include "latency.h"
+#include "lowlatency.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define NUMA_MAX_THREADS 256
+#define NUMA_PAGE_SAMPLES 64            /// pages per band checked for their node
+
+
+int numaTopology(NumaTopology* topo){
+    cpu_set_t allowed;
+    int cpus[NUMA_MAX_CPUS];
+    int id, i;
+
+    memset(topo, 0, sizeof(*topo));
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        CPU_ZERO(&allowed);
+    }
+
+    /** Node numbers can have gaps, e.g. after a CPU hot unplug */
+    for(id = 0; id < 1024 && topo->count < NUMA_MAX_NODES; ++id){
+        char path[128], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+
+        FILE* f = fopen(path, "r");
+        if(f == NULL){
+            continue;
+        }
+        int n = fgets(line, sizeof(line), f) != NULL ? lowLatencyParseCpus(line, cpus, NUMA_MAX_CPUS) : 0;
+        fclose(f);
+
+        /** Nodes with memory but no cores, or none we may use, get no workers */
+        NumaNode* node = &topo->nodes[topo->count];
+        node->id = id;
+        node->cpuCount = 0;
+        for(i = 0; i < n; ++i){
+            if(cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed)){
+                node->cpus[node->cpuCount++] = cpus[i];
+            }
+        }
+        if(node->cpuCount > 0){
+            ++topo->count;
+        }
+    }
+
+    if(topo->count == 0){
+        NumaNode* node = &topo->nodes[0];
+        node->id = 0;
+        node->cpuCount = lowLatencyDefaultCpus(node->cpus, NUMA_MAX_CPUS);
+        if(node->cpuCount <= 0){
+            return -1;
+        }
+        topo->count = 1;
+    }
+
+    return topo->count;
+}
+
+
+int numaPinToNode(const NumaNode* node){
+    cpu_set_t set;
+    int i;
+
+    CPU_ZERO(&set);
+    for(i = 0; i < node->cpuCount; ++i){
+        CPU_SET(node->cpus[i], &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+
+int numaSpread(const NumaTopology* topo, int threads, int max, int* perNode){
+    int n, total = 0;
+
+    for(n = 0; n < topo->count; ++n){
+        perNode[n] = 0;
+    }
+    if(threads <= 0){
+        for(n = 0; n < topo->count; ++n){
+            threads += topo->nodes[n].cpuCount;
+        }
+    }
+    if(threads > max){
+        threads = max;
+    }
+
+    /** Round robin over the nodes with a core left, then over all of them once every core
+    *   has a thread */
+    while(total < threads){
+        int full = 1;
+        for(n = 0; n < topo->count; ++n){
+            if(perNode[n] < topo->nodes[n].cpuCount){
+                full = 0;
+            }
+        }
+        for(n = 0; n < topo->count && total < threads; ++n){
+            if(full || perNode[n] < topo->nodes[n].cpuCount){
+                ++perNode[n];
+                ++total;
+            }
+        }
+    }
+    return total;
+}
+
+
+int numaNodeOf(const void* address){
+#ifdef SYS_move_pages
+    /** With no target nodes, move_pages only reports where each page is */
+    void* page = (void*)((uintptr_t)address & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+    if(syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0 && status >= 0){
+        return status;
+    }
+#else
+    (void)address;
+#endif
+    return -1;
+}
+
+
+/** Holds the band threads until all of them have started: the barrier counts every
+*   thread, so if one cannot be created the others must leave before they reach it */
+typedef struct NumaGate{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int state;                          /// 0 waiting, 1 go, -1 abort
+} NumaGate;
+
+typedef struct NumaBand{
+    pthread_t thread;
+    NumaGate* gate;
+    const IplImage* source;
+    unsigned char* color;
+    unsigned char* gray;
+    int colorStep;
+    int grayStep;
+    const NumaNode* node;
+    int rowStart;
+    int rowEnd;
+    int frames;
+    pthread_barrier_t* barrier;
+    uint64_t busyNs;                    /// time spent converting
+    int localPages;
+    int checkedPages;
+} NumaBand;
+
+
+static void* bandMain(void* arg){
+    NumaBand* b = (NumaBand*)arg;
+    int row, frame;
+
+    pthread_mutex_lock(&b->gate->lock);
+    while(b->gate->state == 0){
+        pthread_cond_wait(&b->gate->cond, &b->gate->lock);
+    }
+    int go = b->gate->state > 0;
+    pthread_mutex_unlock(&b->gate->lock);
+    if(!go){
+        return NULL;
+    }
+
+    if(numaPinToNode(b->node) != 0){
+        fprintf(stderr, "numa: could not pin to node %d\n", b->node->id);
+    }
+
+    /** First touch: these writes place the band's pages on this node */
+    for(row = b->rowStart; row < b->rowEnd; ++row){
+        memcpy(b->color + (size_t)row * b->colorStep,
+               b->source->imageData + (size_t)row * b->source->widthStep,
+               (size_t)b->source->width * 3);
+        memset(b->gray + (size_t)row * b->grayStep, 0, (size_t)b->grayStep);
+    }
+
+    /** Sample pages spread over the band and ask the kernel where they are */
+    int rows = b->rowEnd - b->rowStart;
+    int i;
+    for(i = 0; i < NUMA_PAGE_SAMPLES && rows > 0; ++i){
+        row = b->rowStart + (int)((long)rows * i / NUMA_PAGE_SAMPLES);
+        int node = numaNodeOf(b->color + (size_t)row * b->colorStep);
+        if(node >= 0){
+            ++b->checkedPages;
+            b->localPages += node == b->node->id;
+        }
+    }
+
+    pthread_barrier_wait(b->barrier);
+
+    for(frame = 0; frame < b->frames; ++frame){
+        uint64_t start = latencyNow();
+        grayConvertRows(b->color, b->colorStep, b->gray, b->grayStep, b->source->width,
+                        b->rowStart, b->rowEnd);
+        b->busyNs += latencyNow() - start;
+
+        /** All bands work on the same frame, as they would on a stream of frames */
+        pthread_barrier_wait(b->barrier);
+    }
+
+    return NULL;
+}
+
+
+int runNuma(const Options* opt, IplImage* colorimg){
+    NumaTopology* topo = (NumaTopology*)malloc(sizeof(NumaTopology));
+    NumaBand* bands = (NumaBand*)calloc(NUMA_MAX_THREADS, sizeof(NumaBand));
+    int perNode[NUMA_MAX_NODES] = {0};
+    int n, i, k;
+
+    if(topo == NULL || bands == NULL || numaTopology(topo) < 0){
+        printf("NUMA topology not found\n");
+        free(topo);
+        free(bands);
+        return -1;
+    }
+
+    int maxThreads = colorimg->height < NUMA_MAX_THREADS ? colorimg->height : NUMA_MAX_THREADS;
+    int threads = numaSpread(topo, opt->threads, maxThreads, perNode);
+
+    /** Plain 4 KB pages: a 2 MB page would span the boundary between two nodes' bands */
+    int colorStep = colorimg->width * 3;
+    int grayStep = colorimg->width;
+    size_t colorSize = (size_t)colorStep * colorimg->height;
+    size_t graySize = (size_t)grayStep * colorimg->height;
+    unsigned char* color = (unsigned char*)hugePageAlloc(colorSize, HUGEPAGE_OFF, NULL);
+    unsigned char* gray = (unsigned char*)hugePageAlloc(graySize, HUGEPAGE_OFF, NULL);
+    pthread_barrier_t barrier;
+    NumaGate gate = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+
+    if(color == NULL || gray == NULL || pthread_barrier_init(&barrier, NULL, (unsigned)threads + 1) != 0){
+        printf("No memory allocated for the NUMA frame buffers\n");
+        hugePageFree(color, colorSize);
+        hugePageFree(gray, graySize);
+        free(topo);
+        free(bands);
+        return -1;
+    }
+
+    /** Bands in node order, so each node's rows are adjacent in memory */
+    int t = 0;
+    for(n = 0; n < topo->count; ++n){
+        for(k = 0; k < perNode[n]; ++k, ++t){
+            NumaBand* b = &bands[t];
+            b->source = colorimg;
+            b->color = color;
+            b->gray = gray;
+            b->colorStep = colorStep;
+            b->grayStep = grayStep;
+            b->node = &topo->nodes[n];
+            b->rowStart = (int)((long)colorimg->height * t / threads);
+            b->rowEnd = (int)((long)colorimg->height * (t + 1) / threads);
+            b->frames = opt->frames;
+            b->barrier = &barrier;
+            b->gate = &gate;
+        }
+    }
+
+    int started;
+    for(started = 0; started < threads; ++started){
+        if(pthread_create(&bands[started].thread, NULL, bandMain, &bands[started]) != 0){
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&gate.lock);
+    gate.state = started == threads ? 1 : -1;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+
+    if(started < threads){
+        printf("Could not start %d NUMA threads\n", threads);
+        for(i = 0; i < started; ++i){
+            pthread_join(bands[i].thread, NULL);
+        }
+        pthread_barrier_destroy(&barrier);
+        hugePageFree(color, colorSize);
+        hugePageFree(gray, graySize);
+        free(topo);
+        free(bands);
+        return -1;
+    }
+
+    printf("NUMA band mode: %d nodes, %d threads, %d frames\n", topo->count, threads, opt->frames);
+
+    pthread_barrier_wait(&barrier);
+    uint64_t start = latencyNow();
+    for(i = 0; i < opt->frames; ++i){
+        pthread_barrier_wait(&barrier);
+    }
+    double seconds = (latencyNow() - start) / 1e9;
+
+    for(i = 0; i < threads; ++i){
+        pthread_join(bands[i].thread, NULL);
+    }
+
+    printf("%-6s %8s %8s %12s %12s\n", "node", "threads", "rows", "MPix/s", "local pages");
+    for(n = 0, t = 0; n < topo->count; ++n){
+        int rows = 0, local = 0, checked = 0;
+        uint64_t busy = 0;
+        for(k = 0; k < perNode[n]; ++k, ++t){
+            rows += bands[t].rowEnd - bands[t].rowStart;
+            if(bands[t].busyNs > busy){
+                busy = bands[t].busyNs;
+            }
+            local += bands[t].localPages;
+            checked += bands[t].checkedPages;
+        }
+        if(perNode[n] == 0){
+            continue;
+        }
+
+        /** Pixels over the longest time a thread of the node spent converting */
+        double mpix = (double)rows * colorimg->width * opt->frames / 1e6;
+        double busySeconds = busy / 1e9;
+        char pages[32] = "unknown";
+        if(checked > 0){
+            snprintf(pages, sizeof(pages), "%.0f%%", 100.0 * local / checked);
+        }
+        printf("node%-2d %8d %8d %12.1f %12s\n", topo->nodes[n].id, perNode[n], rows,
+               busySeconds > 0 ? mpix / busySeconds : 0.0, pages);
+    }
+    printf("total: %.1f frames/s, %.1f MPix/s\n", opt->frames / seconds,
+           (double)colorimg->width * colorimg->height * opt->frames / 1e6 / seconds);
+
+    pthread_barrier_destroy(&barrier);
+    hugePageFree(color, colorSize);
+    hugePageFree(gray, graySize);
+    free(topo);
+    free(bands);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/** Filename: numa.h
+*
+*   Description: NUMA topology and node-local band conversion.
+*
+*   On a multi-socket host each socket is a NUMA node with its own memory. A page lives on
+*   the node of the thread that first writes it, and a thread reading a page of another
+*   node crosses the interconnect between the sockets, which has less bandwidth than the
+*   local memory. The topology is read from /sys/devices/system/node; no libnuma is needed.
+*/
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <opencv/cv.h>
+
+#include "modes.h"
+
+#define NUMA_MAX_NODES 16
+#define NUMA_MAX_CPUS 256               /// cores per node
+
+typedef struct NumaNode{
+    int id;                             /// the N of /sys/devices/system/node/nodeN
+    int cpuCount;
+    int cpus[NUMA_MAX_CPUS];            /// the cores of the node this process may run on
+} NumaNode;
+
+typedef struct NumaTopology{
+    int count;
+    NumaNode nodes[NUMA_MAX_NODES];
+} NumaTopology;
+
+/** Fill topo with the nodes that have cores this process may run on. Without NUMA
+*   information, all those cores make up one node 0. Returns the number of nodes, or -1
+*   if no core was found. */
+int numaTopology(NumaTopology* topo);
+
+/** Restrict the calling thread to the cores of node. Returns 0, or -1 on failure. */
+int numaPinToNode(const NumaNode* node);
+
+/** Spread threads threads over the nodes in turn, or give every node one thread per core
+*   if threads is 0, storing the count of node i in perNode[i]. At most max threads are
+*   given out. Returns the total. */
+int numaSpread(const NumaTopology* topo, int threads, int max, int* perNode);
+
+/** Return the node the page holding address lives on, or -1 if unknown (not yet
+*   touched, or no NUMA support in the kernel) */
+int numaNodeOf(const void* address);
+
+/** NUMA band mode: the frame is split into one band of rows per thread, the threads of
+*   each node taking adjacent bands. Each thread copies its band of colorimg into a fresh
+*   buffer and clears its band of the gray buffer, so those pages are first touched, and
+*   placed, on its node, then converts its band opt->frames times. The rows, megapixels
+*   per second and share of node-local pages of every node are printed. opt->threads
+*   threads are spread over the nodes, or one per core if 0. */
+int runNuma(const Options* opt, IplImage* colorimg);
+
+#endif
@@ -0,0 +1,302 @@
+/** Filename: pnm.c
+*
+*   Description: the PPM reader and PGM writer, see pnm.h.
+*
+*   The header is "P6", then the width, the height and the maximum value as decimal text
+*   separated by whitespace, with comments from # to the end of a line, then exactly one
+*   whitespace byte and the pixels, 3 bytes each in R, G, B order, rows one after another.
+*
+*   The rows are copied with their red and blue bytes swapped. With SSSE3 one pshufb swaps
+*   5 pixels: 16 bytes are loaded and stored, of which the last is the first byte of the
+*   next 5 pixels and is written again by the next store.
+*/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "pnm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNM_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+
+typedef void (*SwapRow)(const unsigned char* rgb, unsigned char* bgr, int width);
+
+
+static void swapRowScalar(const unsigned char* rgb, unsigned char* bgr, int width){
+    int col;
+
+    for(col = 0; col < width; ++col){
+        bgr[3 * col] = rgb[3 * col + 2];
+        bgr[3 * col + 1] = rgb[3 * col + 1];
+        bgr[3 * col + 2] = rgb[3 * col];
+    }
+}
+
+
+#ifdef PNM_HAVE_X86
+
+__attribute__((target("ssse3")))
+static void swapRowSsse3(const unsigned char* rgb, unsigned char* bgr, int width){
+    const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    int col;
+
+    /** The 16 bytes loaded and stored end 3 * col + 16 bytes into the row, which is
+    *   inside it while 6 pixels are left */
+    for(col = 0; col + 6 <= width; col += 5){
+        __m128i v = _mm_loadu_si128((const __m128i*)(rgb + 3 * col));
+        _mm_storeu_si128((__m128i*)(bgr + 3 * col), _mm_shuffle_epi8(v, swap));
+    }
+
+    swapRowScalar(rgb + 3 * col, bgr + 3 * col, width - col);
+}
+
+#endif
+
+
+static SwapRow swapRowKernel(void){
+#ifdef PNM_HAVE_X86
+    if(__builtin_cpu_supports("ssse3")){
+        return swapRowSsse3;
+    }
+#endif
+    return swapRowScalar;
+}
+
+
+/** Skip whitespace and comments, then read a decimal number. Returns -1 if there is none
+*   or it is larger than INT_MAX. */
+static long readNumber(const unsigned char* data, size_t size, size_t* pos){
+    size_t p = *pos;
+    long value = 0;
+
+    for(;;){
+        if(p >= size){
+            return -1;
+        }
+        if(data[p] == '#'){
+            while(p < size && data[p] != '\n' && data[p] != '\r'){
+                ++p;
+            }
+        }
+        else if(isspace(data[p])){
+            ++p;
+        }
+        else{
+            break;
+        }
+    }
+
+    if(!isdigit(data[p])){
+        return -1;
+    }
+    while(p < size && isdigit(data[p])){
+        value = value * 10 + (data[p] - '0');
+        if(value > INT_MAX){
+            return -1;
+        }
+        ++p;
+    }
+
+    *pos = p;
+    return value;
+}
+
+
+IplImage* pnmDecode(const unsigned char* data, size_t size){
+    size_t pos = 2;
+
+    if(size < 2 || data[0] != 'P' || data[1] != '6'){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    long width = readNumber(data, size, &pos);
+    long height = readNumber(data, size, &pos);
+    long maxval = readNumber(data, size, &pos);
+    if(width <= 0 || height <= 0 || maxval != 255 || pos >= size || !isspace(data[pos])){
+        errno = EINVAL;
+        return NULL;
+    }
+    ++pos;
+
+    /** The image's widthStep and imageSize are ints */
+    size_t rowBytes = 3 * (size_t)width;
+    if(rowBytes > INT_MAX - 3 || ((rowBytes + 3) & ~(size_t)3) * (size_t)height > INT_MAX ||
+       (size - pos) / rowBytes < (size_t)height){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    IplImage* img = cvCreateImage(cvSize((int)width, (int)height), IPL_DEPTH_8U, 3);
+    if(img == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    SwapRow swapRow = swapRowKernel();
+    int row;
+    for(row = 0; row < (int)height; ++row){
+        swapRow(data + pos + (size_t)row * rowBytes,
+                (unsigned char*)img->imageData + (size_t)row * img->widthStep, (int)width);
+    }
+    return img;
+}
+
+
+IplImage* pnmRead(const char* path){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    if(st.st_size < 2){
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int saved = errno;
+    close(fd);
+    if(map == MAP_FAILED){
+        errno = saved;
+        return NULL;
+    }
+
+    /** Read the pixels in order, so the kernel reads ahead */
+    madvise(map, size, MADV_SEQUENTIAL);
+    IplImage* img = pnmDecode((const unsigned char*)map, size);
+    saved = errno;
+    munmap(map, size);
+    errno = saved;
+    return img;
+}
+
+
+/** writev all count buffers, continuing after a partial write */
+static int writeAll(int fd, struct iovec* iov, int count){
+    while(count > 0){
+        ssize_t n = writev(fd, iov, count);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+
+        while(count > 0 && (size_t)n >= iov->iov_len){
+            n -= (ssize_t)iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count > 0){
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+
+int pnmWriteGray(const char* path, const IplImage* gray){
+    struct iovec iov[IOV_MAX];
+    char header[64];
+    int row, n;
+
+    if(gray->nChannels != 1 || gray->depth != IPL_DEPTH_8U){
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0){
+        return -1;
+    }
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)snprintf(header, sizeof(header), "P5\n%d %d\n255\n", gray->width, gray->height);
+    n = 1;
+
+    /** Without padding the rows are one block of memory */
+    if(gray->widthStep == gray->width){
+        iov[1].iov_base = gray->imageData;
+        iov[1].iov_len = (size_t)gray->width * (size_t)gray->height;
+        n = 2;
+    }
+    else{
+        for(row = 0; row < gray->height; ++row){
+            if(n == IOV_MAX){
+                if(writeAll(fd, iov, n) != 0){
+                    break;
+                }
+                n = 0;
+            }
+            iov[n].iov_base = gray->imageData + (size_t)row * gray->widthStep;
+            iov[n].iov_len = (size_t)gray->width;
+            ++n;
+        }
+        if(row < gray->height){
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+    }
+
+    if(writeAll(fd, iov, n) != 0){
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return close(fd);
+}
+
+
+int pnmIsPnmName(const char* path){
+    const char* ext = strrchr(path, '.');
+    return ext != NULL && (strcasecmp(ext, ".ppm") == 0 || strcasecmp(ext, ".pgm") == 0 ||
+                           strcasecmp(ext, ".pnm") == 0);
+}
+
+
+IplImage* pnmLoadColor(const char* path){
+    if(pnmIsPnmName(path)){
+        IplImage* img = pnmRead(path);
+        if(img != NULL || errno != EINVAL){
+            return img;
+        }
+    }
+    return cvLoadImage(path, CV_LOAD_IMAGE_COLOR);
+}
+
+
+int pnmSaveGray(const char* path, const IplImage* gray){
+    if(pnmIsPnmName(path)){
+        return pnmWriteGray(path, gray) == 0;
+    }
+    return cvSaveImage(path, gray, NULL);
+}
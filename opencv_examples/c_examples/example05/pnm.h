@@ -0,0 +1,45 @@
+/** Filename: pnm.h
+*
+*   Description: a reader for binary PPM (P6) color images and a writer for binary PGM
+*   (P5) gray images, for the files passed between pipeline stages.
+*
+*   cvLoadImage and cvSaveImage go through OpenCV's codec layer: the file is found by
+*   trying each decoder's signature, read through a buffered stream in small pieces and
+*   the pixels copied once more into the image. A PPM file is a short text header and the
+*   raw pixels, so the reader maps the file, parses the header itself and copies each row,
+*   swapping RGB to BGR on the way, straight into the rows of a new IplImage with its
+*   widthStep. The writer writes the header and the rows with writev, all rows in one call
+*   (or IOV_MAX rows at a time), so a gray image is written with a few system calls.
+*
+*   Only 8 bit images are handled (maxval 255). pnmLoadColor and pnmSaveGray use the fast
+*   path for .ppm, .pgm and .pnm names and fall back to cvLoadImage and cvSaveImage for
+*   every other file, and for PNM files the reader does not take (ASCII, 16 bit, P5).
+*/
+
+#ifndef PNM_H
+#define PNM_H
+
+#include <stddef.h>
+#include <opencv/cv.h>
+
+/** Read a P6 file into a new 3 channel BGR image. Returns NULL with errno set if the file
+*   cannot be read, or with errno EINVAL if it is not an 8 bit binary PPM file. */
+IplImage* pnmRead(const char* path);
+
+/** As pnmRead, from the size bytes of a file already in memory */
+IplImage* pnmDecode(const unsigned char* data, size_t size);
+
+/** Write the 1 channel image gray as a P5 file. Returns 0, or -1 with errno set. */
+int pnmWriteGray(const char* path, const IplImage* gray);
+
+/** Return 1 if path ends in .ppm, .pgm or .pnm, in any case */
+int pnmIsPnmName(const char* path);
+
+/** Load a color image, with pnmRead for PNM names it can read and cvLoadImage otherwise */
+IplImage* pnmLoadColor(const char* path);
+
+/** Save a gray image, with pnmWriteGray for PNM names and cvSaveImage otherwise. Returns
+*   nonzero on success, as cvSaveImage does. */
+int pnmSaveGray(const char* path, const IplImage* gray);
+
+#endif
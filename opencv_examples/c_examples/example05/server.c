@@ -0,0 +1,657 @@
+/** Filename: server.c
+*
+*   Description: conversion server mode of example05.
+*
+*   The server listens on a Unix domain socket for clients that cannot map the frame ring
+*   (daemon.c), and converts the raw or encoded images they send (sockproto.h). Every
+*   connection has a reader thread that reads whole requests and queues them; a pool of
+*   opt->threads workers takes them off the queue in batches.
+*
+*   A worker takes its share of the queue: the queued requests divided among the idle
+*   workers, rounded up, and at most batchMax requests or SERVER_BATCH_PIXELS pixels (a
+*   large image is a batch by itself). While other workers are idle, or all of them are, a
+*   worker takes its share at once and wakes the next idle worker for the rest, so a burst
+*   is spread over the pool. Only the last idle worker of a pool whose other workers are
+*   busy waits for a batch to form: until batchMax requests or SERVER_BATCH_PIXELS pixels
+*   are queued or the oldest request has waited delay microseconds. Readers wake a worker
+*   when the queue becomes non-empty, a batch fills up, or more workers are idle than
+*   requests queued, so under load a stream of small requests costs one wakeup per batch
+*   instead of one per request.
+*
+*   Recorded are the time a request waited in the queue ("queue"), its decode and conversion
+*   ("convert") and the time from reading it until its reply was written ("request").
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "gray.h"
+#include "latency.h"
+#include "modes.h"
+#include "sockproto.h"
+#include "trace.h"
+
+#define SERVER_DEFAULT_BATCH 16
+#define SERVER_DEFAULT_DELAY_US 500
+#define SERVER_BATCH_PIXELS (1 << 20)   /// a batch of this many pixels is taken at once
+#define SERVER_MAX_BATCH 256
+#define SERVER_MAX_CONNECTIONS 256
+
+
+typedef struct Connection{
+    int fd;
+    int refs;                   /// the reader plus every request not yet answered
+    int broken;                 /// a reply could not be written
+    pthread_mutex_t writeLock;  /// replies from different workers do not interleave
+} Connection;
+
+typedef struct Request{
+    struct Request* next;
+    Connection* conn;
+    SockRequest head;
+    unsigned char* data;
+    uint64_t arriveNs;
+} Request;
+
+typedef struct Server{
+    int batchMax;
+    uint64_t delayNs;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       /// workers: the queue changed
+    pthread_cond_t idle;        /// main thread: a connection closed
+    Request* head;
+    Request* tail;
+    int queued;
+    uint64_t queuedPixels;
+    int workers;                /// started
+    int waiting;                /// workers in takeBatch, without a batch
+    int stopping;
+    Connection* conns[SERVER_MAX_CONNECTIONS];
+    int connCount;
+    LatencyRecorder queue;
+    LatencyRecorder convert;
+    LatencyRecorder request;
+    uint64_t requests;
+    uint64_t batches;
+    uint64_t failed;
+} Server;
+
+typedef struct Reader{
+    Server* server;
+    Connection* conn;
+} Reader;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+
+static void onSignal(int sig){
+    (void)sig;
+    stopRequested = 1;
+}
+
+
+/** Parse path[:batch[:delayus]] */
+static int parseSpec(const char* spec, char* path, size_t pathSize, int* batch, int* delayUs){
+    const char* colon = strchr(spec, ':');
+    size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+
+    if(len == 0 || len >= pathSize){
+        return -1;
+    }
+    memcpy(path, spec, len);
+    path[len] = '\0';
+
+    *batch = SERVER_DEFAULT_BATCH;
+    *delayUs = SERVER_DEFAULT_DELAY_US;
+    if(colon == NULL){
+        return 0;
+    }
+
+    int n = sscanf(colon + 1, "%d:%d", batch, delayUs);
+    if((n != 1 && n != 2) || *batch < 1 || *batch > SERVER_MAX_BATCH || *delayUs < 0){
+        return -1;
+    }
+    return 0;
+}
+
+
+static int readFull(int fd, void* buffer, size_t size){
+    unsigned char* p = (unsigned char*)buffer;
+    while(size > 0){
+        ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+static int writeFull(int fd, const void* buffer, size_t size){
+    const unsigned char* p = (const unsigned char*)buffer;
+    while(size > 0){
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+/** Drop one reference; the last one closes the socket */
+static void releaseConnection(Server* s, Connection* conn){
+    if(__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) != 0){
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    int i;
+    for(i = 0; i < s->connCount; ++i){
+        if(s->conns[i] == conn){
+            s->conns[i] = s->conns[--s->connCount];
+            break;
+        }
+    }
+    pthread_cond_broadcast(&s->idle);
+    pthread_mutex_unlock(&s->lock);
+
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->writeLock);
+    free(conn);
+}
+
+
+static uint64_t requestPixels(const SockRequest* head){
+    /** An encoded image's size is not known before it is decoded; count it as its bytes */
+    if(head->kind == SOCK_KIND_RAW){
+        return (uint64_t)head->width * head->height;
+    }
+    return head->bytes;
+}
+
+
+/** Queue a request, waking a worker only if this starts or fills a batch or an idle worker
+*   would otherwise have nothing to take. Returns -1 once the server is stopping. */
+static int enqueue(Server* s, Request* req){
+    uint64_t pixels = requestPixels(&req->head);
+
+    pthread_mutex_lock(&s->lock);
+    if(s->stopping){
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    if(s->tail != NULL){
+        s->tail->next = req;
+    }
+    else{
+        s->head = req;
+    }
+    s->tail = req;
+    __atomic_add_fetch(&req->conn->refs, 1, __ATOMIC_RELAXED);
+
+    int filled = s->queuedPixels < SERVER_BATCH_PIXELS && s->queuedPixels + pixels >= SERVER_BATCH_PIXELS;
+    ++s->queued;
+    s->queuedPixels += pixels;
+    if(s->queued == 1 || s->queued == s->batchMax || filled || s->waiting > s->queued){
+        pthread_cond_signal(&s->ready);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+
+static void* readerMain(void* arg){
+    Reader* r = (Reader*)arg;
+    Server* s = r->server;
+    Connection* conn = r->conn;
+    free(r);
+
+    traceThreadName("server reader");
+
+    for(;;){
+        SockRequest head;
+        if(readFull(conn->fd, &head, sizeof(head)) != 0){
+            break;
+        }
+        if(head.magic != SOCK_REQUEST_MAGIC || head.bytes > SOCK_MAX_BYTES){
+            printf("Bad request header, closing the connection\n");
+            break;
+        }
+
+        Request* req = (Request*)calloc(1, sizeof(Request));
+        if(req != NULL){
+            req->data = (unsigned char*)malloc(head.bytes > 0 ? head.bytes : 1);
+        }
+        if(req == NULL || req->data == NULL){
+            printf("No memory allocated for a request of %u bytes\n", head.bytes);
+            free(req);
+            break;
+        }
+        if(readFull(conn->fd, req->data, head.bytes) != 0){
+            free(req->data);
+            free(req);
+            break;
+        }
+
+        req->head = head;
+        req->conn = conn;
+        req->arriveNs = latencyNow();
+        if(enqueue(s, req) != 0){
+            free(req->data);
+            free(req);
+            break;
+        }
+    }
+
+    /** Queued requests keep the connection open until their replies are written */
+    shutdown(conn->fd, SHUT_RD);
+    releaseConnection(s, conn);
+    return NULL;
+}
+
+
+/** Wait for a batch and move this worker's share of it to batch; return its size, or 0
+*   when the server stops */
+static int takeBatch(Server* s, Request** batch){
+    int n = 0;
+    uint64_t pixels = 0;
+
+    pthread_mutex_lock(&s->lock);
+    ++s->waiting;
+    for(;;){
+        if(s->head == NULL){
+            if(s->stopping){
+                --s->waiting;
+                pthread_mutex_unlock(&s->lock);
+                return 0;
+            }
+            pthread_cond_wait(&s->ready, &s->lock);
+            continue;
+        }
+
+        /** Waiting only saves wakeups while the rest of the pool is busy; with another
+        *   worker idle, or none busy, it would only delay the request */
+        int othersBusy = s->workers - s->waiting;
+        uint64_t deadline = s->head->arriveNs + s->delayNs;
+        if(s->stopping || s->waiting > 1 || othersBusy <= 0 || s->queued >= s->batchMax ||
+           s->queuedPixels >= SERVER_BATCH_PIXELS || latencyNow() >= deadline){
+            break;
+        }
+
+        struct timespec until = { (time_t)(deadline / 1000000000u), (long)(deadline % 1000000000u) };
+        pthread_cond_timedwait(&s->ready, &s->lock, &until);
+    }
+
+    int share = (s->queued + s->waiting - 1) / s->waiting;
+    if(share > s->batchMax){
+        share = s->batchMax;
+    }
+    --s->waiting;
+
+    while(s->head != NULL && n < share && (n == 0 || pixels < SERVER_BATCH_PIXELS)){
+        Request* req = s->head;
+        s->head = req->next;
+        if(s->head == NULL){
+            s->tail = NULL;
+        }
+        --s->queued;
+        s->queuedPixels -= requestPixels(&req->head);
+        pixels += requestPixels(&req->head);
+        req->next = NULL;
+        batch[n++] = req;
+    }
+
+    /** An idle worker takes what is left, or starts the timer of the next batch */
+    if(s->head != NULL && s->waiting > 0){
+        pthread_cond_signal(&s->ready);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+
+/** Make sure *buffer holds at least size bytes, keeping it if it already does */
+static int reserve(unsigned char** buffer, size_t* capacity, size_t size){
+    if(size <= *capacity){
+        return 0;
+    }
+
+    unsigned char* p = (unsigned char*)realloc(*buffer, size);
+    if(p == NULL){
+        return -1;
+    }
+
+    *buffer = p;
+    *capacity = size;
+    return 0;
+}
+
+
+/** Convert one request into *gray and fill in reply */
+static void convertRequest(const Request* req, SockReply* reply, unsigned char** gray, size_t* capacity){
+    const SockRequest* head = &req->head;
+    const unsigned char* color = req->data;
+    IplImage* decoded = NULL;
+    int width = 0, height = 0, step = 0;
+
+    reply->status = SOCK_OK;
+
+    if(head->kind == SOCK_KIND_RAW){
+        width = (int)head->width;
+        height = (int)head->height;
+        step = (int)head->step;
+        if(head->width > (uint32_t)INT32_MAX / 3 || head->height > (uint32_t)INT32_MAX ||
+           head->step > (uint32_t)INT32_MAX || (uint64_t)head->step * head->height != head->bytes){
+            reply->status = SOCK_ERR_REQUEST;
+        }
+    }
+    else if(head->kind == SOCK_KIND_ENCODED){
+        /** The encoded file as a single row of bytes */
+        CvMat buffer = cvMat(1, (int)head->bytes, CV_8UC1, req->data);
+        decoded = head->bytes > 0 ? cvDecodeImage(&buffer, CV_LOAD_IMAGE_COLOR) : NULL;
+        if(decoded == NULL){
+            reply->status = SOCK_ERR_DECODE;
+        }
+        else{
+            width = decoded->width;
+            height = decoded->height;
+            step = decoded->widthStep;
+            color = (const unsigned char*)decoded->imageData;
+        }
+    }
+    else{
+        reply->status = SOCK_ERR_REQUEST;
+    }
+
+    if(reply->status == SOCK_OK && reserve(gray, capacity, (size_t)width * height) != 0){
+        reply->status = SOCK_ERR_MEMORY;
+    }
+    if(reply->status == SOCK_OK){
+        reply->status = grayConvert(color, step, *gray, width, width, height);
+    }
+    if(reply->status == SOCK_OK){
+        reply->width = (uint32_t)width;
+        reply->height = (uint32_t)height;
+        reply->bytes = (uint32_t)width * (uint32_t)height;
+    }
+
+    cvReleaseImage(&decoded);
+}
+
+
+static void* serverWorker(void* arg){
+    Server* s = (Server*)arg;
+    LatencyHistogram* queueHist = latencyRecorderThread(&s->queue);
+    LatencyHistogram* convertHist = latencyRecorderThread(&s->convert);
+    LatencyHistogram* requestHist = latencyRecorderThread(&s->request);
+    Request* batch[SERVER_MAX_BATCH];
+    unsigned char* gray = NULL;             /// reused while the images do not grow
+    size_t capacity = 0;
+    int n, i;
+
+    if(queueHist == NULL || convertHist == NULL || requestHist == NULL){
+        printf("No memory allocated for the latency histograms\n");
+        return NULL;
+    }
+
+    traceThreadName("server worker");
+
+    while((n = takeBatch(s, batch)) > 0){
+        uint64_t batchStart = latencyNow();
+
+        for(i = 0; i < n; ++i){
+            Request* req = batch[i];
+            Connection* conn = req->conn;
+            SockReply reply = { SOCK_REPLY_MAGIC, req->head.id, 0, 0, 0, 0 };
+
+            uint64_t start = latencyNow();
+            convertRequest(req, &reply, &gray, &capacity);
+            uint64_t converted = latencyNow();
+
+            pthread_mutex_lock(&conn->writeLock);
+            if(!conn->broken){
+                conn->broken = writeFull(conn->fd, &reply, sizeof(reply)) != 0 ||
+                               (reply.bytes > 0 && writeFull(conn->fd, gray, reply.bytes) != 0);
+            }
+            pthread_mutex_unlock(&conn->writeLock);
+
+            latencyRecord(queueHist, start - req->arriveNs);
+            latencyRecord(convertHist, converted - start);
+            latencyRecord(requestHist, latencyNow() - req->arriveNs);
+            if(reply.status != SOCK_OK){
+                __atomic_fetch_add(&s->failed, 1, __ATOMIC_RELAXED);
+            }
+
+            free(req->data);
+            free(req);
+            releaseConnection(s, conn);
+        }
+
+        traceSpan("convert batch", batchStart);
+        __atomic_fetch_add(&s->requests, (uint64_t)n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->batches, 1, __ATOMIC_RELAXED);
+    }
+
+    free(gray);
+    return NULL;
+}
+
+
+static int listenOn(const char* path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        printf("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        printf("Socket not created: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /** A socket file left behind by a server that was killed */
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+        printf("Cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/** Give a new connection its reader thread */
+static void startReader(Server* s, int fd){
+    Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+    Reader* r = (Reader*)malloc(sizeof(Reader));
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if(conn == NULL || r == NULL){
+        free(conn);
+        free(r);
+        close(fd);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if(s->connCount == SERVER_MAX_CONNECTIONS){
+        pthread_mutex_unlock(&s->lock);
+        printf("Too many connections, one refused\n");
+        free(conn);
+        free(r);
+        close(fd);
+        return;
+    }
+    conn->fd = fd;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->writeLock, NULL);
+    s->conns[s->connCount++] = conn;
+    pthread_mutex_unlock(&s->lock);
+
+    r->server = s;
+    r->conn = conn;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, readerMain, r) != 0){
+        free(r);
+        shutdown(fd, SHUT_RDWR);
+        releaseConnection(s, conn);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+
+int runServer(const Options* opt, const char* spec){
+    char path[108];
+    int batchMax, delayUs;
+    pthread_t threads[LATENCY_MAX_THREADS];
+    Server s;
+    int nthreads = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int started, i;
+
+    if(parseSpec(spec, path, sizeof(path), &batchMax, &delayUs) != 0){
+        printf("Bad socket %s, expected path[:batch[:delayus]] with batch 1 to %d\n", spec,
+               SERVER_MAX_BATCH);
+        return -1;
+    }
+    if(nthreads > LATENCY_MAX_THREADS) nthreads = LATENCY_MAX_THREADS;
+    if(nthreads < 1) nthreads = 1;
+
+    int listenFd = listenOn(path);
+    if(listenFd < 0){
+        return -1;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.batchMax = batchMax;
+    s.delayNs = (uint64_t)delayUs * 1000u;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);     /// deadlines are latencyNow() times
+    pthread_cond_init(&s.ready, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_cond_init(&s.idle, NULL);
+    latencyRecorderInit(&s.queue, "queue");
+    latencyRecorderInit(&s.convert, "convert");
+    latencyRecorderInit(&s.request, "request");
+
+    /** No SA_RESTART, so accept returns EINTR when the server is stopped */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    LatencyRecorder* recs[3] = { &s.queue, &s.convert, &s.request };
+    LatencyReporter* reporter = NULL;
+    if(opt->reportSeconds > 0){
+        reporter = latencyReporterStart(recs, 3, opt->reportSeconds, stdout);
+    }
+
+    for(started = 0; started < nthreads; ++started){
+        if(pthread_create(&threads[started], NULL, serverWorker, &s) != 0){
+            break;
+        }
+    }
+    /** Until the pool is counted, no worker waits for a batch to form */
+    pthread_mutex_lock(&s.lock);
+    s.workers = started;
+    pthread_mutex_unlock(&s.lock);
+    if(started == 0){
+        printf("Could not start the server threads\n");
+        latencyReporterStop(reporter);
+        close(listenFd);
+        unlink(path);
+        return -1;
+    }
+
+    printf("Conversion server: %s, batches of up to %d requests or %d pixels, %d us delay, %d threads\n",
+           path, batchMax, SERVER_BATCH_PIXELS, delayUs, started);
+    fflush(stdout);
+
+    uint64_t start = latencyNow();
+    while(!stopRequested){
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd >= 0){
+            startReader(&s, fd);
+        }
+        else if(errno != EINTR && errno != ECONNABORTED){
+            printf("accept failed: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    close(listenFd);
+    unlink(path);
+
+    /** Stop reading, answer what is queued, then wait for the readers to let go */
+    pthread_mutex_lock(&s.lock);
+    for(i = 0; i < s.connCount; ++i){
+        shutdown(s.conns[i]->fd, SHUT_RD);
+    }
+    s.stopping = 1;
+    pthread_cond_broadcast(&s.ready);
+    pthread_mutex_unlock(&s.lock);
+
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_lock(&s.lock);
+    while(s.connCount > 0){
+        pthread_cond_wait(&s.idle, &s.lock);
+    }
+    pthread_mutex_unlock(&s.lock);
+
+    double seconds = (latencyNow() - start) / 1e9;
+    latencyReporterStop(reporter);
+
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(total != NULL){
+        for(i = 0; i < 3; ++i){
+            latencyRecorderSnapshot(recs[i], total);
+            latencyPrint(stdout, recs[i]->name, total);
+        }
+        latencyPrintBuckets(stdout, total);
+        free(total);
+    }
+    printf("%llu requests (%llu failed) in %llu batches, %.1f per batch, in %.1f s\n",
+           (unsigned long long)s.requests, (unsigned long long)s.failed,
+           (unsigned long long)s.batches, s.batches > 0 ? (double)s.requests / s.batches : 0.0,
+           seconds);
+
+    for(i = 0; i < 3; ++i){
+        latencyRecorderFree(recs[i]);
+    }
+    pthread_cond_destroy(&s.ready);
+    pthread_cond_destroy(&s.idle);
+    pthread_mutex_destroy(&s.lock);
+    return 0;
+}
@@ -0,0 +1,315 @@
+/** Filename: sockload.c
+*
+*   Description: load client for the conversion server (example05 -U).
+*
+*   Usage: ./sockload [-n requests] [-c connections] [-d depth] [-s widthxheight | -e image]
+*                     [-V] socket
+*
+*   Each of the connections sends requests requests (sockproto.h) and keeps up to depth of
+*   them in flight: it writes depth requests, then writes the next one as each reply comes
+*   back. The requests are a random raw frame of widthxheight, or with -e the bytes of an
+*   image file for the server to decode. Reported are the requests per second, the
+*   megapixels per second and a histogram of the time from writing a request until its
+*   reply was read. With -V every gray frame of a raw request is compared with a
+*   conversion done locally.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gray.h"
+#include "latency.h"
+#include "sockproto.h"
+
+#define SOCKLOAD_MAX_CONNECTIONS 256
+
+
+typedef struct Load{
+    const char* path;
+    int requests;               /// per connection
+    int depth;
+    int verify;
+    SockRequest head;           /// the same request every time, only the id changes
+    unsigned char* payload;
+    unsigned char* expected;    /// gray of a raw frame, for -V
+    LatencyRecorder latency;
+    uint64_t pixels;
+    int failed;                 /// replies with an error status
+    int wrong;                  /// gray frames that did not match the expected gray
+    int lost;                   /// connections that ended early
+} Load;
+
+
+static int readFull(int fd, void* buffer, size_t size){
+    unsigned char* p = (unsigned char*)buffer;
+    while(size > 0){
+        ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+static int writeFull(int fd, const void* buffer, size_t size){
+    const unsigned char* p = (const unsigned char*)buffer;
+    while(size > 0){
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+
+static int connectTo(const char* path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static int sendRequest(const Load* load, int fd, uint32_t id){
+    SockRequest head = load->head;
+    head.id = id;
+    if(writeFull(fd, &head, sizeof(head)) != 0){
+        return -1;
+    }
+    return writeFull(fd, load->payload, head.bytes);
+}
+
+
+static void* connectionMain(void* arg){
+    Load* load = (Load*)arg;
+    LatencyHistogram* hist = latencyRecorderThread(&load->latency);
+    uint64_t* sentNs = (uint64_t*)malloc(sizeof(uint64_t) * load->requests);
+    unsigned char* gray = NULL;
+    size_t capacity = 0;
+    int sent = 0, received = 0;
+    int fd = connectTo(load->path);
+
+    if(hist == NULL || sentNs == NULL || fd < 0){
+        printf("Connection to %s failed\n", load->path);
+        __atomic_fetch_add(&load->lost, 1, __ATOMIC_RELAXED);
+        free(sentNs);
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+
+    while(sent < load->depth && sent < load->requests){
+        sentNs[sent] = latencyNow();
+        if(sendRequest(load, fd, (uint32_t)sent) != 0){
+            break;
+        }
+        ++sent;
+    }
+
+    while(received < sent){
+        SockReply reply;
+        if(readFull(fd, &reply, sizeof(reply)) != 0 || reply.magic != SOCK_REPLY_MAGIC ||
+           reply.id >= (uint32_t)sent){
+            break;
+        }
+        if(reply.bytes > capacity){
+            unsigned char* p = (unsigned char*)realloc(gray, reply.bytes);
+            if(p == NULL){
+                break;
+            }
+            gray = p;
+            capacity = reply.bytes;
+        }
+        if(readFull(fd, gray, reply.bytes) != 0){
+            break;
+        }
+        latencyRecord(hist, latencyNow() - sentNs[reply.id]);
+        ++received;
+
+        if(reply.status != SOCK_OK){
+            __atomic_fetch_add(&load->failed, 1, __ATOMIC_RELAXED);
+        }
+        else{
+            __atomic_fetch_add(&load->pixels, (uint64_t)reply.width * reply.height, __ATOMIC_RELAXED);
+            if(load->verify && load->expected != NULL &&
+               (reply.width != load->head.width || reply.height != load->head.height ||
+                memcmp(gray, load->expected, reply.bytes) != 0)){
+                __atomic_fetch_add(&load->wrong, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        if(sent < load->requests){
+            sentNs[sent] = latencyNow();
+            if(sendRequest(load, fd, (uint32_t)sent) != 0){
+                break;
+            }
+            ++sent;
+        }
+    }
+
+    if(received < load->requests){
+        __atomic_fetch_add(&load->lost, 1, __ATOMIC_RELAXED);
+    }
+    close(fd);
+    free(gray);
+    free(sentNs);
+    return NULL;
+}
+
+
+/** Read the whole file into a malloc'd buffer */
+static unsigned char* readFile(const char* name, uint32_t* size){
+    FILE* f = fopen(name, "rb");
+    unsigned char* data = NULL;
+    long n;
+
+    if(f == NULL){
+        return NULL;
+    }
+    if(fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0 && (unsigned long)n <= SOCK_MAX_BYTES &&
+       fseek(f, 0, SEEK_SET) == 0){
+        data = (unsigned char*)malloc((size_t)n);
+        if(data != NULL && fread(data, 1, (size_t)n, f) != (size_t)n){
+            free(data);
+            data = NULL;
+        }
+        *size = (uint32_t)n;
+    }
+    fclose(f);
+    return data;
+}
+
+
+int main(int argc, char** argv){
+    Load load;
+    int connections = 1;
+    int width = 640, height = 480;
+    const char* imageFile = NULL;
+    int opt, i;
+
+    memset(&load, 0, sizeof(load));
+    load.requests = 1000;
+    load.depth = 4;
+
+    while((opt = getopt(argc, argv, "n:c:d:s:e:V")) != -1){
+        switch(opt){
+            case 'n': load.requests = atoi(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 'd': load.depth = atoi(optarg); break;
+            case 's':
+                if(latencyParseSize(optarg, &width, &height) != 0){
+                    width = 0;
+                }
+                break;
+            case 'e': imageFile = optarg; break;
+            case 'V': load.verify = 1; break;
+            default: width = 0; break;
+        }
+    }
+    if(optind >= argc || width == 0 || load.requests < 1 || load.depth < 1 ||
+       connections < 1 || connections > SOCKLOAD_MAX_CONNECTIONS){
+        printf("Usage: ./sockload [-n requests] [-c connections] [-d depth] "
+               "[-s widthxheight | -e image] [-V] socket\n");
+        return -1;
+    }
+    load.path = argv[optind];
+    load.head.magic = SOCK_REQUEST_MAGIC;
+
+    if(imageFile != NULL){
+        load.head.kind = SOCK_KIND_ENCODED;
+        load.payload = readFile(imageFile, &load.head.bytes);
+        if(load.payload == NULL){
+            printf("Image %s not read\n", imageFile);
+            return -1;
+        }
+    }
+    else{
+        int step = (3 * width + 3) & ~3;
+        size_t n, size = (size_t)step * height;
+
+        load.head.kind = SOCK_KIND_RAW;
+        load.head.width = (uint32_t)width;
+        load.head.height = (uint32_t)height;
+        load.head.step = (uint32_t)step;
+        load.head.bytes = (uint32_t)size;
+        load.payload = (unsigned char*)malloc(size);
+        load.expected = (unsigned char*)malloc((size_t)width * height);
+        if(size > SOCK_MAX_BYTES || load.payload == NULL || load.expected == NULL){
+            printf("No memory allocated for a %d x %d frame\n", width, height);
+            return -1;
+        }
+        for(n = 0; n < size; ++n){
+            load.payload[n] = (unsigned char)rand();
+        }
+        grayConvert(load.payload, step, load.expected, width, width, height);
+    }
+
+    latencyRecorderInit(&load.latency, "request");
+
+    pthread_t threads[SOCKLOAD_MAX_CONNECTIONS];
+    int started;
+    uint64_t start = latencyNow();
+    for(started = 0; started < connections; ++started){
+        if(pthread_create(&threads[started], NULL, connectionMain, &load) != 0){
+            break;
+        }
+    }
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (latencyNow() - start) / 1e9;
+
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(total == NULL){
+        return -1;
+    }
+    latencyRecorderSnapshot(&load.latency, total);
+
+    printf("%d connections, %d requests each, %d in flight, %s\n", started, load.requests,
+           load.depth, imageFile != NULL ? imageFile : "raw frames");
+    printf("%.0f requests/s, %.1f MPix/s\n", total->count / seconds, load.pixels / seconds / 1e6);
+    latencyPrint(stdout, "request", total);
+    latencyPrintBuckets(stdout, total);
+    printf("%d failed, %d connections ended early%s", load.failed, load.lost,
+           load.verify && load.expected != NULL ? "" : "\n");
+    if(load.verify && load.expected != NULL){
+        printf(", %d wrong\n", load.wrong);
+    }
+
+    int ok = load.failed == 0 && load.wrong == 0 && load.lost == 0;
+    free(total);
+    free(load.payload);
+    free(load.expected);
+    latencyRecorderFree(&load.latency);
+    return ok ? 0 : -1;
+}
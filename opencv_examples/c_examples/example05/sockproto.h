@@ -0,0 +1,56 @@
+/** Filename: sockproto.h
+*
+*   Description: the messages of the conversion server (example05 -U) and its clients.
+*
+*   A client connects to the server's Unix domain socket and writes requests, each a
+*   SockRequest followed by bytes bytes of payload. A raw request carries height rows of
+*   BGR pixels, step bytes apart; an encoded request carries an image file (JPEG, PNG, ...)
+*   as it is on disk, with width, height and step 0. The server answers every request with
+*   a SockReply followed, when status is SOCK_OK, by width * height gray bytes with no row
+*   padding.
+*
+*   A client may write many requests before it reads the replies. Replies carry the id of
+*   their request and come back in the order the conversions finish, which need not be the
+*   order of the requests. Both ends are on the same host, so the fields are in its byte
+*   order. A request with a wrong magic number or a payload over SOCK_MAX_BYTES cannot be
+*   skipped, and the server closes the connection.
+*/
+
+#ifndef SOCKPROTO_H
+#define SOCKPROTO_H
+
+#include <stdint.h>
+
+#define SOCK_REQUEST_MAGIC 0x31515247u  /// "GRQ1"
+#define SOCK_REPLY_MAGIC 0x31505247u    /// "GRP1"
+#define SOCK_MAX_BYTES (256u << 20)     /// largest payload of a request
+
+#define SOCK_KIND_RAW 0
+#define SOCK_KIND_ENCODED 1
+
+/** Reply status: SOCK_OK, a GrayStatus (gray.h) or one of these */
+#define SOCK_OK 0
+#define SOCK_ERR_REQUEST -100           /// unknown kind, or bytes does not match the frame
+#define SOCK_ERR_DECODE -101            /// the encoded image could not be decoded
+#define SOCK_ERR_MEMORY -102
+
+typedef struct SockRequest{
+    uint32_t magic;
+    uint32_t id;                /// chosen by the client, returned in the reply
+    uint32_t kind;
+    uint32_t width;
+    uint32_t height;
+    uint32_t step;
+    uint32_t bytes;
+} SockRequest;
+
+typedef struct SockReply{
+    uint32_t magic;
+    uint32_t id;
+    int32_t status;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;             /// gray bytes that follow, width * height or 0
+} SockReply;
+
+#endif
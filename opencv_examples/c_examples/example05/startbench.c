@@ -0,0 +1,131 @@
+/** Filename: startbench.c
+*
+*   Description: startup benchmark for example05.
+*
+*   Usage: ./startbench [-n runs] command [arguments...]
+*
+*   Runs the command runs times and reports two times per run, both measured from just
+*   before the process is created:
+*
+*       first pixel – until the program finished its first gray image (see startup.h)
+*       exit        – until the program exited
+*
+*   For a short-lived job most of the first pixel time is spent before main() runs, in
+*   the dynamic loader resolving the shared libraries, so comparing builds linked against
+*   different sets of libraries (make bench-startup) shows what the link set costs.
+*   The command must not wait for a key press; give example05 the -N option.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "latency.h"
+#include "startup.h"
+
+
+/** Run the command once. Returns 0 and sets the two times, or -1 if it failed. */
+static int runOnce(char** command, uint64_t* firstPixelNs, uint64_t* exitNs){
+    int fds[2];
+    if(pipe(fds) != 0){
+        return -1;
+    }
+
+    uint64_t start = latencyNow();
+    pid_t pid = fork();
+    if(pid < 0){
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if(pid == 0){
+        char fd[16];
+        snprintf(fd, sizeof(fd), "%d", fds[1]);
+        setenv(STARTUP_FD_ENV, fd, 1);
+        close(fds[0]);
+
+        /** The program's own output would bury the results */
+        int devnull = open("/dev/null", O_WRONLY);
+        if(devnull >= 0){
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        execvp(command[0], command);
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    char text[32] = {0};
+    ssize_t got = read(fds[0], text, sizeof(text) - 1);
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    *exitNs = latencyNow() - start;
+
+    if(got <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        return -1;
+    }
+
+    *firstPixelNs = strtoull(text, NULL, 10) - start;
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    int runs = 50;
+    int opt;
+
+    while((opt = getopt(argc, argv, "+n:")) != -1){
+        switch(opt){
+            case 'n': runs = atoi(optarg); break;
+            default:
+                printf("Usage: ./startbench [-n runs] command [arguments...]\n");
+                return -1;
+        }
+    }
+    if(optind >= argc || runs < 1){
+        printf("Usage: ./startbench [-n runs] command [arguments...]\n");
+        return -1;
+    }
+
+    LatencyHistogram* firstPixel = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    LatencyHistogram* exited = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(firstPixel == NULL || exited == NULL){
+        return -1;
+    }
+    latencyReset(firstPixel);
+    latencyReset(exited);
+
+    /** The first run fills the page cache with the program and its libraries; we want
+    *   the cost of starting, not of reading the disk */
+    uint64_t a, b;
+    if(runOnce(argv + optind, &a, &b) != 0){
+        printf("%s failed or never reported a first pixel\n", argv[optind]);
+        return -1;
+    }
+
+    int i;
+    for(i = 0; i < runs; ++i){
+        if(runOnce(argv + optind, &a, &b) != 0){
+            printf("%s failed on run %d\n", argv[optind], i + 1);
+            return -1;
+        }
+        latencyRecord(firstPixel, a);
+        latencyRecord(exited, b);
+    }
+
+    printf("%s\n", argv[optind]);
+    latencyPrint(stdout, "  first pixel", firstPixel);
+    latencyPrint(stdout, "  exit", exited);
+
+    free(firstPixel);
+    free(exited);
+    return 0;
+}
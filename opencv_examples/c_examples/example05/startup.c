@@ -0,0 +1,32 @@
+/** Filename: startup.c
+*
+*   Description: time-to-first-pixel probe for the startup benchmark.
+*/
+
+#include "startup.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int reported = 0;
+
+
+void startupFirstPixel(void){
+    if(__atomic_exchange_n(&reported, 1, __ATOMIC_RELAXED)){
+        return;
+    }
+
+    uint64_t now = latencyNow();
+    const char* fd = getenv(STARTUP_FD_ENV);
+    if(fd == NULL){
+        return;
+    }
+
+    char text[32];
+    int n = snprintf(text, sizeof(text), "%llu\n", (unsigned long long)now);
+    if(write(atoi(fd), text, (size_t)n) != n){
+        fprintf(stderr, "startup: could not report the first pixel\n");
+    }
+}
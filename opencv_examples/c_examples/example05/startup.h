@@ -0,0 +1,19 @@
+/** Filename: startup.h
+*
+*   Description: time-to-first-pixel probe for the startup benchmark.
+*
+*   startbench runs example05 with the environment variable EXAMPLE05_FIRST_PIXEL_FD set
+*   to the number of a pipe. The first time a gray image is finished, example05 writes the
+*   CLOCK_MONOTONIC time in nanoseconds to that pipe, so startbench can subtract the time
+*   it started the process. Without the variable the probe does nothing.
+*/
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#define STARTUP_FD_ENV "EXAMPLE05_FIRST_PIXEL_FD"
+
+/** Report the first finished gray image; later calls do nothing */
+void startupFirstPixel(void);
+
+#endif
@@ -0,0 +1,201 @@
+/** Filename: threading.c
+*
+*   Description: threading policy for running conversions in parallel.
+*/
+
+#include "threading.h"
+#include "gray.h"
+#include "latency.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+int threadingParse(const char* spec, int cores, ThreadPolicy* policy, int* isAuto){
+    int w, t;
+
+    *isAuto = 0;
+    if(cores < 1) cores = 1;
+
+    if(strcmp(spec, "auto") == 0){
+        *isAuto = 1;
+        return 0;
+    }
+    if(strcmp(spec, "flat") == 0){
+        policy->workers = cores;
+        policy->cvThreads = 1;
+        policy->name = "flat";
+        return 0;
+    }
+    if(strcmp(spec, "nested") == 0){
+        policy->workers = cores;
+        policy->cvThreads = cores;
+        policy->name = "nested";
+        return 0;
+    }
+    if(strcmp(spec, "serial") == 0){
+        policy->workers = 1;
+        policy->cvThreads = cores;
+        policy->name = "serial";
+        return 0;
+    }
+    if(sscanf(spec, "%d:%d", &w, &t) == 2 && w > 0 && t > 0){
+        policy->workers = w;
+        policy->cvThreads = t;
+        policy->name = "custom";
+        return 0;
+    }
+
+    return -1;
+}
+
+
+void threadingApply(const ThreadPolicy* policy){
+    cvSetNumThreads(policy->cvThreads);
+}
+
+
+int threadingCandidates(int cores, int useOpenCV, ThreadPolicy* candidates){
+    static const char* const names[] = { "flat", "nested", "serial" };
+    int n = 0, isAuto, i;
+
+    /** With libgray OpenCV's threads do not take part in the conversion, so only the
+    *   flat policy and fewer workers are worth trying */
+    for(i = 0; i < 3; ++i){
+        if(!useOpenCV && i > 0){
+            break;
+        }
+        threadingParse(names[i], cores, &candidates[n], &isAuto);
+        candidates[n++].useOpenCV = useOpenCV;
+    }
+
+    if(cores >= 4){
+        candidates[n].workers = cores / 2;
+        candidates[n].cvThreads = useOpenCV ? 2 : 1;
+        candidates[n].name = "half";
+        candidates[n++].useOpenCV = useOpenCV;
+    }
+
+    return n;
+}
+
+
+typedef struct Trial{
+    const ThreadPolicy* policy;
+    const IplImage* sample;
+    int conversions;            /// per worker
+    int failed;
+    LatencyRecorder latency;
+} Trial;
+
+
+static void* trialWorker(void* arg){
+    Trial* trial = (Trial*)arg;
+    const IplImage* c = trial->sample;
+    LatencyHistogram* hist = latencyRecorderThread(&trial->latency);
+    IplImage* gray = cvCreateImage(cvSize(c->width, c->height), c->depth, 1);
+    int i;
+
+    if(hist == NULL || gray == NULL){
+        __atomic_fetch_add(&trial->failed, 1, __ATOMIC_RELAXED);
+        cvReleaseImage(&gray);
+        return NULL;
+    }
+
+    for(i = 0; i < trial->conversions; ++i){
+        uint64_t start = latencyNow();
+        if(trial->policy->useOpenCV){
+            cvCvtColor(c, gray, CV_BGR2GRAY);
+        }
+        else{
+            grayConvert((const unsigned char*)c->imageData, c->widthStep,
+                        (unsigned char*)gray->imageData, gray->widthStep, c->width, c->height);
+        }
+        latencyRecord(hist, latencyNow() - start);
+    }
+
+    cvReleaseImage(&gray);
+    return NULL;
+}
+
+
+int threadingMeasure(const ThreadPolicy* policy, const IplImage* sample, int conversions, ThreadTrial* result){
+    Trial trial;
+    pthread_t* threads = (pthread_t*)malloc(policy->workers * sizeof(pthread_t));
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    int started, i;
+
+    if(threads == NULL || total == NULL){
+        free(threads);
+        free(total);
+        return -1;
+    }
+
+    memset(&trial, 0, sizeof(trial));
+    trial.policy = policy;
+    trial.sample = sample;
+    trial.conversions = (conversions + policy->workers - 1) / policy->workers;
+    latencyRecorderInit(&trial.latency, policy->name);
+
+    threadingApply(policy);
+
+    uint64_t start = latencyNow();
+    for(started = 0; started < policy->workers; ++started){
+        if(pthread_create(&threads[started], NULL, trialWorker, &trial) != 0){
+            break;
+        }
+    }
+    for(i = 0; i < started; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (latencyNow() - start) / 1e9;
+
+    latencyRecorderSnapshot(&trial.latency, total);
+    result->policy = *policy;
+    result->imagesPerSecond = total->count / seconds;
+    result->p50Ns = latencyPercentile(total, 50.0);
+    result->p99Ns = latencyPercentile(total, 99.0);
+    result->maxNs = total->maxNs;
+
+    int status = started == policy->workers && trial.failed == 0 ? 0 : -1;
+    latencyRecorderFree(&trial.latency);
+    free(threads);
+    free(total);
+    return status;
+}
+
+
+int threadingChoose(const ThreadTrial* trials, int count){
+    int best = 0, i;
+
+    for(i = 1; i < count; ++i){
+        if(trials[i].imagesPerSecond > trials[best].imagesPerSecond){
+            best = i;
+        }
+    }
+
+    int chosen = best;
+    for(i = 0; i < count; ++i){
+        if(trials[i].imagesPerSecond >= 0.95 * trials[best].imagesPerSecond &&
+           trials[i].p99Ns < trials[chosen].p99Ns){
+            chosen = i;
+        }
+    }
+
+    return chosen;
+}
+
+
+void threadingPrint(const ThreadTrial* trial){
+    if(trial == NULL){
+        printf("%-8s %8s %10s %10s %12s %12s %12s\n", "policy", "workers", "cv threads",
+               "images/s", "p50 us", "p99 us", "max us");
+        return;
+    }
+
+    printf("%-8s %8d %10d %10.1f %12.1f %12.1f %12.1f\n", trial->policy.name,
+           trial->policy.workers, trial->policy.cvThreads, trial->imagesPerSecond,
+           trial->p50Ns / 1000.0, trial->p99Ns / 1000.0, trial->maxNs / 1000.0);
+}
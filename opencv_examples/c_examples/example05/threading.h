@@ -0,0 +1,59 @@
+/** Filename: threading.h
+*
+*   Description: threading policy for running conversions in parallel.
+*
+*   cvCvtColor may split each image across OpenCV's own thread pool. When several of our
+*   worker threads call it at once, each call fans out again and the machine runs
+*   workers x OpenCV threads runnable threads on its cores. A policy fixes both numbers:
+*
+*       flat     one worker per core, OpenCV single threaded
+*       nested   one worker per core, and OpenCV one thread per core as well
+*       serial   one worker, OpenCV one thread per core
+*       W:T      W workers, T OpenCV threads
+*       auto     time the candidates above (and W = cores / 2, T = 2) on a sample image
+*                and use the one with the highest throughput
+*/
+
+#ifndef THREADING_H
+#define THREADING_H
+
+#include <stdint.h>
+#include <opencv/cv.h>
+
+#define THREADING_MAX_CANDIDATES 8
+
+typedef struct ThreadPolicy{
+    int workers;                /// our threads, each converting whole images
+    int cvThreads;              /// cvSetNumThreads for OpenCV's pool
+    int useOpenCV;              /// 1: convert with cvCvtColor, 0: with libgray
+    const char* name;
+} ThreadPolicy;
+
+typedef struct ThreadTrial{
+    ThreadPolicy policy;
+    double imagesPerSecond;
+    uint64_t p50Ns, p99Ns, maxNs;   /// latency of one conversion
+} ThreadTrial;
+
+/** Parse a policy name (see above) for a machine with cores cores. For "auto" only
+*   *isAuto is set. Returns -1 if spec is not a policy. */
+int threadingParse(const char* spec, int cores, ThreadPolicy* policy, int* isAuto);
+
+/** Set OpenCV's thread count from the policy */
+void threadingApply(const ThreadPolicy* policy);
+
+/** Fill candidates with the policies "auto" tries; returns how many */
+int threadingCandidates(int cores, int useOpenCV, ThreadPolicy* candidates);
+
+/** Convert sample conversions times split over policy->workers threads, with OpenCV
+*   set to policy->cvThreads. Returns -1 if the threads or buffers could not be created. */
+int threadingMeasure(const ThreadPolicy* policy, const IplImage* sample, int conversions, ThreadTrial* trial);
+
+/** Return the index of the best of count measured trials: the highest throughput,
+*   except that a trial within 5% of it with a lower p99 latency wins */
+int threadingChoose(const ThreadTrial* trials, int count);
+
+/** Print one trial as a table row; the header is printed when trial is NULL */
+void threadingPrint(const ThreadTrial* trial);
+
+#endif
@@ -0,0 +1,135 @@
+/** Filename: tiles.c
+*
+*   Description: incremental tile conversion, see tiles.h.
+*
+*   The frame is worked through one row of tiles at a time, so the rows of a band are
+*   still in the cache when the dirty tiles among them are converted and copied. Runs of
+*   neighbouring dirty tiles are converted and copied as one span, which gives the SIMD
+*   kernels long rows when most of the frame changed.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gray.h"
+#include "tiles.h"
+
+
+int tilesInit(TileState* tiles, int width, int height, int tileWidth, int tileHeight){
+    memset(tiles, 0, sizeof(*tiles));
+    if(width <= 0 || height <= 0 || tileWidth <= 0 || tileHeight <= 0){
+        return GRAY_ERR_SIZE;
+    }
+
+    tiles->width = width;
+    tiles->height = height;
+    tiles->tileWidth = tileWidth < width ? tileWidth : width;
+    tiles->tileHeight = tileHeight < height ? tileHeight : height;
+    tiles->cols = (width + tiles->tileWidth - 1) / tiles->tileWidth;
+    tiles->rows = (height + tiles->tileHeight - 1) / tiles->tileHeight;
+    tiles->previous = (unsigned char*)malloc((size_t)width * 3 * height);
+    tiles->dirty = (unsigned char*)malloc((size_t)tiles->cols);
+
+    if(tiles->previous == NULL || tiles->dirty == NULL){
+        tilesFree(tiles);
+        return GRAY_ERR_NOMEM;
+    }
+    return GRAY_OK;
+}
+
+
+/** Mark the tiles of rows [y0, y1) that differ from the previous frame. A row is first
+*   compared whole, which is one long memcmp over a static scene; only a row that differs
+*   is compared tile by tile, and only for the tiles not already marked. */
+static void markDirty(TileState* tiles, const unsigned char* colorData, int colorStep, int y0, int y1){
+    size_t previousStep = (size_t)tiles->width * 3;
+    int y, tx;
+
+    memset(tiles->dirty, !tiles->primed, (size_t)tiles->cols);
+    if(!tiles->primed){
+        return;
+    }
+
+    for(y = y0; y < y1; ++y){
+        const unsigned char* current = colorData + (size_t)y * colorStep;
+        const unsigned char* previous = tiles->previous + y * previousStep;
+
+        if(memcmp(current, previous, previousStep) == 0){
+            continue;
+        }
+        for(tx = 0; tx < tiles->cols; ++tx){
+            size_t x0 = (size_t)tx * tiles->tileWidth * 3;
+            size_t x1 = x0 + (size_t)tiles->tileWidth * 3 < previousStep ? x0 + (size_t)tiles->tileWidth * 3 : previousStep;
+            if(!tiles->dirty[tx] && memcmp(current + x0, previous + x0, x1 - x0) != 0){
+                tiles->dirty[tx] = 1;
+            }
+        }
+    }
+}
+
+
+int tilesConvert(TileState* tiles, const unsigned char* colorData, int colorStep,
+                 unsigned char* grayData, int grayStep){
+    int status = grayValidate(colorData, colorStep, grayData, grayStep, tiles->width, tiles->height);
+    if(status != GRAY_OK){
+        return status;
+    }
+    if(tiles->previous == NULL){
+        return GRAY_ERR_NULL;
+    }
+
+    size_t previousStep = (size_t)tiles->width * 3;
+    int converted = 0;
+    int ty, tx, y;
+
+    for(ty = 0; ty < tiles->rows; ++ty){
+        int y0 = ty * tiles->tileHeight;
+        int y1 = y0 + tiles->tileHeight < tiles->height ? y0 + tiles->tileHeight : tiles->height;
+
+        markDirty(tiles, colorData, colorStep, y0, y1);
+
+        /** Convert and remember each run of dirty tiles */
+        tx = 0;
+        while(tx < tiles->cols){
+            if(!tiles->dirty[tx]){
+                ++tx;
+                continue;
+            }
+
+            int first = tx;
+            while(tx < tiles->cols && tiles->dirty[tx]){
+                ++tx;
+            }
+            converted += tx - first;
+
+            int x0 = first * tiles->tileWidth;
+            int x1 = tx * tiles->tileWidth < tiles->width ? tx * tiles->tileWidth : tiles->width;
+            grayConvertRows(colorData + (size_t)x0 * 3, colorStep, grayData + x0, grayStep,
+                            x1 - x0, y0, y1);
+            for(y = y0; y < y1; ++y){
+                memcpy(tiles->previous + y * previousStep + (size_t)x0 * 3,
+                       colorData + (size_t)y * colorStep + (size_t)x0 * 3, (size_t)(x1 - x0) * 3);
+            }
+        }
+    }
+
+    tiles->primed = 1;
+    return converted;
+}
+
+
+int tilesCount(const TileState* tiles){
+    return tiles->cols * tiles->rows;
+}
+
+
+void tilesReset(TileState* tiles){
+    tiles->primed = 0;
+}
+
+
+void tilesFree(TileState* tiles){
+    free(tiles->previous);
+    free(tiles->dirty);
+    memset(tiles, 0, sizeof(*tiles));
+}
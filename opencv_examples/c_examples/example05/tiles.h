@@ -0,0 +1,51 @@
+/** Filename: tiles.h
+*
+*   Description: incremental conversion of video frames, one tile at a time.
+*
+*   A fixed camera sees mostly the same pixels from one frame to the next. The frame is
+*   divided into tiles, and a tile whose BGR bytes are the same as in the previous frame
+*   keeps the gray pixels it already has; only the tiles that changed ("dirty") are
+*   converted. The previous frame is kept as a copy and compared with memcmp, which glibc
+*   implements with SIMD loads and which stops at the first difference. A copy is exact
+*   where a hash of each tile could miss a change, and comparing two buffers is faster
+*   than hashing one.
+*
+*   The gray image passed to tilesConvert must be the same buffer, unchanged, from one
+*   frame to the next, since the gray pixels of clean tiles are not written again.
+*/
+
+#ifndef TILES_H
+#define TILES_H
+
+#define TILES_DEFAULT_SIZE 64
+
+typedef struct TileState{
+    int width;
+    int height;
+    int tileWidth;
+    int tileHeight;
+    int cols;                   /// tiles per row of tiles
+    int rows;
+    unsigned char* previous;    /// the BGR pixels of the last frame, width * 3 bytes a row
+    unsigned char* dirty;       /// one flag per tile of the current row of tiles
+    int primed;                 /// previous and the gray image hold a frame
+} TileState;
+
+/** Set up for frames of width x height in tiles of tileWidth x tileHeight. Returns
+*   GRAY_OK or a GrayStatus code. */
+int tilesInit(TileState* tiles, int width, int height, int tileWidth, int tileHeight);
+
+/** Convert the tiles of the frame that changed since the last call. Returns the number
+*   of tiles converted, all of them for the first frame, or a negative GrayStatus code. */
+int tilesConvert(TileState* tiles, const unsigned char* colorData, int colorStep,
+                 unsigned char* grayData, int grayStep);
+
+/** Return the number of tiles in a frame */
+int tilesCount(const TileState* tiles);
+
+/** Forget the previous frame, so the next call converts every tile */
+void tilesReset(TileState* tiles);
+
+void tilesFree(TileState* tiles);
+
+#endif
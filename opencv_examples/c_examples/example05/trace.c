@@ -0,0 +1,250 @@
+/** Filename: trace.c
+*
+*   Description: Chrome trace (trace_event JSON) export.
+*
+*   Spans are stored as complete ("ph":"X") events in per-thread lists of fixed-size
+*   chunks, so recording a span never copies earlier events or takes a lock. The lock
+*   below is only taken when a thread records its first span and registers its buffer.
+*
+*   Span names are literals, but a span's file is copied: callers pass paths from buffers
+*   they reuse for the next file, such as the line a worker has just read.
+*/
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_CHUNK_EVENTS 4096
+
+typedef struct TraceEvent{
+    const char* name;
+    char* file;                 /// a copy; NULL if the span has no file
+    int band;                   /// -1 if the span is not a band
+    int rowStart, rowEnd;
+    uint64_t startNs, endNs;
+} TraceEvent;
+
+typedef struct TraceChunk{
+    struct TraceChunk* next;
+    int used;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+typedef struct TraceBuffer{
+    struct TraceBuffer* next;
+    int tid;
+    const char* threadName;
+    TraceChunk* first;
+    TraceChunk* last;
+} TraceBuffer;
+
+int traceEnabled = 0;
+
+static FILE* traceFile = NULL;
+static uint64_t traceOrigin;                /// timestamps are written relative to this
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer* traceBuffers = NULL;
+static int traceThreads = 0;
+static __thread TraceBuffer* threadBuffer = NULL;
+
+
+int traceStart(const char* path){
+    traceFile = fopen(path, "w");
+    if(traceFile == NULL){
+        return -1;
+    }
+
+    traceOrigin = latencyNow();
+    traceEnabled = 1;
+    return 0;
+}
+
+
+static TraceBuffer* getBuffer(void){
+    if(threadBuffer != NULL){
+        return threadBuffer;
+    }
+
+    TraceBuffer* b = (TraceBuffer*)calloc(1, sizeof(TraceBuffer));
+    if(b == NULL){
+        return NULL;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    b->tid = ++traceThreads;
+    b->next = traceBuffers;
+    traceBuffers = b;
+    pthread_mutex_unlock(&traceLock);
+
+    threadBuffer = b;
+    return b;
+}
+
+
+void traceThreadName(const char* name){
+    if(!traceEnabled){
+        return;
+    }
+
+    TraceBuffer* b = getBuffer();
+    if(b != NULL){
+        b->threadName = name;
+    }
+}
+
+
+static void record(const char* name, uint64_t startNs, const char* file,
+                   int band, int rowStart, int rowEnd){
+    uint64_t endNs = latencyNow();
+    TraceBuffer* b = getBuffer();
+    if(b == NULL){
+        return;
+    }
+
+    char* copy = NULL;
+    if(file != NULL){
+        copy = strdup(file);
+        if(copy == NULL){
+            return;
+        }
+    }
+
+    if(b->last == NULL || b->last->used == TRACE_CHUNK_EVENTS){
+        TraceChunk* c = (TraceChunk*)malloc(sizeof(TraceChunk));
+        if(c == NULL){
+            free(copy);
+            return;
+        }
+        c->next = NULL;
+        c->used = 0;
+        if(b->last != NULL){
+            b->last->next = c;
+        }
+        else{
+            b->first = c;
+        }
+        b->last = c;
+    }
+
+    TraceEvent* e = &b->last->events[b->last->used++];
+    e->name = name;
+    e->file = copy;
+    e->band = band;
+    e->rowStart = rowStart;
+    e->rowEnd = rowEnd;
+    e->startNs = startNs;
+    e->endNs = endNs;
+}
+
+
+void traceSpan(const char* name, uint64_t startNs){
+    if(traceEnabled){
+        record(name, startNs, NULL, -1, 0, 0);
+    }
+}
+
+
+void traceSpanFile(const char* name, uint64_t startNs, const char* file){
+    if(traceEnabled){
+        record(name, startNs, file, -1, 0, 0);
+    }
+}
+
+
+void traceSpanBand(const char* name, uint64_t startNs, int band, int rowStart, int rowEnd){
+    if(traceEnabled){
+        record(name, startNs, NULL, band, rowStart, rowEnd);
+    }
+}
+
+
+static void writeString(FILE* f, const char* s){
+    fputc('"', f);
+    for(; *s != '\0'; ++s){
+        unsigned char c = (unsigned char)*s;
+        if(c == '"' || c == '\\'){
+            fputc('\\', f);
+            fputc(c, f);
+        }
+        else if(c < 0x20){
+            fprintf(f, "\\u%04x", c);
+        }
+        else{
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+
+void traceFinish(void){
+    if(!traceEnabled){
+        return;
+    }
+    traceEnabled = 0;
+
+    FILE* f = traceFile;
+    int pid = (int)getpid();
+    int first = 1;
+    TraceBuffer* b;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for(b = traceBuffers; b != NULL; b = b->next){
+        if(b->threadName != NULL){
+            fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                    first ? "" : ",\n", pid, b->tid);
+            writeString(f, b->threadName);
+            fprintf(f, "}}");
+            first = 0;
+        }
+
+        TraceChunk* c;
+        int i;
+        for(c = b->first; c != NULL; c = c->next){
+            for(i = 0; i < c->used; ++i){
+                TraceEvent* e = &c->events[i];
+
+                /** ts and dur are in microseconds; keep the nanoseconds as decimals */
+                fprintf(f, "%s{\"ph\":\"X\",\"name\":", first ? "" : ",\n");
+                writeString(f, e->name);
+                fprintf(f, ",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", pid, b->tid,
+                        (e->startNs - traceOrigin) / 1000.0, (e->endNs - e->startNs) / 1000.0);
+                if(e->file != NULL){
+                    fprintf(f, ",\"args\":{\"file\":");
+                    writeString(f, e->file);
+                    fprintf(f, "}");
+                }
+                else if(e->band >= 0){
+                    fprintf(f, ",\"args\":{\"band\":%d,\"rows\":\"%d-%d\"}",
+                            e->band, e->rowStart, e->rowEnd);
+                }
+                fprintf(f, "}");
+                first = 0;
+            }
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    traceFile = NULL;
+
+    while(traceBuffers != NULL){
+        b = traceBuffers;
+        traceBuffers = b->next;
+        while(b->first != NULL){
+            TraceChunk* c = b->first;
+            int i;
+            b->first = c->next;
+            for(i = 0; i < c->used; ++i){
+                free(c->events[i].file);
+            }
+            free(c);
+        }
+        free(b);
+    }
+}
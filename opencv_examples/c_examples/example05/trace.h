@@ -0,0 +1,49 @@
+/** Filename: trace.h
+*
+*   Description: Chrome trace (trace_event JSON) export.
+*
+*   When tracing is on, every thread records the spans it spends loading, converting,
+*   writing and waiting into a buffer of its own. At exit the buffers are written as one
+*   JSON file that chrome://tracing, Perfetto (ui.perfetto.dev) or speedscope can open,
+*   with one track per thread, so overlap between the stages and the gaps where threads
+*   sit idle can be seen directly.
+*
+*   When tracing is off, each call returns after testing traceEnabled.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "latency.h"
+
+extern int traceEnabled;
+
+/** Turn tracing on; the trace is written to path by traceFinish(). Returns -1 if the
+*   file cannot be created. */
+int traceStart(const char* path);
+
+/** Write the trace file and turn tracing off. Every thread that recorded spans must have
+*   finished recording. Safe to call when tracing is off; suitable for atexit(). */
+void traceFinish(void);
+
+/** Name the calling thread's track in the trace viewer. name is not copied. */
+void traceThreadName(const char* name);
+
+/** The time to pass as a span start: the current time, or 0 when tracing is off */
+static inline uint64_t traceClock(void){
+    return traceEnabled ? latencyNow() : 0;
+}
+
+/** Record a span from startNs until now. name is not copied and should be a literal. */
+void traceSpan(const char* name, uint64_t startNs);
+
+/** As traceSpan, with the file the span worked on. file is copied, so it may be a buffer
+*   the caller reuses. */
+void traceSpanFile(const char* name, uint64_t startNs, const char* file);
+
+/** As traceSpan, for one band of rows [rowStart, rowEnd) of a frame */
+void traceSpanBand(const char* name, uint64_t startNs, int band, int rowStart, int rowEnd);
+
+#endif
@@ -0,0 +1,257 @@
+/** Filename: video.c
+*
+*   Description: video mode of example05.
+*
+*   Frames are read from a video file or a camera, converted to gray with our kernel and
+*   displayed. The time cvQueryFrame takes to deliver a frame and the time of the gray
+*   conversion are recorded for every frame. Press Esc to stop.
+*
+*   Frames are shown by a display thread (display.h), which shows the latest converted
+*   frame and drops the ones it had no time for, so the GUI never slows the conversion.
+*   The frame rates of the processing loop and of the display are reported separately.
+*
+*   With tiles (-d, tiles.h), only the tiles that changed since the previous frame are
+*   converted. To measure what that saves, every VIDEO_BASELINE_EVERY frames the whole
+*   frame is also converted into a scratch image ("full frame"), which must equal the
+*   incremental result. The share of dirty tiles and the speedup of the incremental
+*   conversion over the full one are reported at the end.
+*
+*   Whole frames are converted with the luma standard chosen with -S, or with -G in
+*   linear light (grayConvertLinear).
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "display.h"
+#include "gray.h"
+#include "latency.h"
+#include "modes.h"
+#include "startup.h"
+#include "tiles.h"
+#include "trace.h"
+
+#define VIDEO_BASELINE_EVERY 16         /// frames between full conversions with -d
+
+
+static CvCapture* openSource(const char* source){
+    const char* p = source;
+
+    while(isdigit((unsigned char)*p)) ++p;
+    if(*source != '\0' && *p == '\0'){
+        return cvCaptureFromCAM(atoi(source));
+    }
+
+    return cvCaptureFromFile(source);
+}
+
+
+/** Time a full conversion of frame into scratch and check gray, the incremental result,
+*   against it. Returns 0 if they are equal. */
+static int convertBaseline(const IplImage* frame, IplImage* scratch, const IplImage* gray,
+                           LatencyHistogram* fullHist){
+    uint64_t start = latencyNow();
+    grayConvert((unsigned char*)frame->imageData, frame->widthStep,
+                (unsigned char*)scratch->imageData, scratch->widthStep,
+                frame->width, frame->height);
+    latencyRecord(fullHist, latencyNow() - start);
+    traceSpan("full frame", start);
+
+    int y;
+    for(y = 0; y < gray->height; ++y){
+        if(memcmp(scratch->imageData + (size_t)y * scratch->widthStep,
+                  gray->imageData + (size_t)y * gray->widthStep, (size_t)gray->width) != 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/** Print the share of dirty tiles and the incremental conversion's speedup */
+static void printTiles(const TileState* tiles, long long dirty, int frames, int mismatches,
+                       LatencyRecorder* convert, LatencyRecorder* full, LatencyHistogram* total){
+    long long all = (long long)tilesCount(tiles) * frames;
+
+    latencyRecorderSnapshot(convert, total);
+    double incremental = total->count > 0 ? total->sumNs / 1e3 / total->count : 0.0;
+    latencyRecorderSnapshot(full, total);
+    double whole = total->count > 0 ? total->sumNs / 1e3 / total->count : 0.0;
+
+    printf("tiles: %d x %d, %d per frame, %.1f%% dirty\n", tiles->tileWidth, tiles->tileHeight,
+           tilesCount(tiles), all > 0 ? 100.0 * dirty / all : 0.0);
+    printf("convert %.1f us per frame, full frame %.1f us (every %d frames): %.2fx\n",
+           incremental, whole, VIDEO_BASELINE_EVERY, incremental > 0 ? whole / incremental : 0.0);
+    if(mismatches > 0){
+        printf("%d frames differed from the full conversion\n", mismatches);
+    }
+}
+
+
+int runVideo(const Options* opt, const char* source){
+    CvCapture* capture = openSource(source);
+    if(capture == NULL){
+        printf("Video %s not opened, program ending\n", source);
+        return -1;
+    }
+
+    LatencyRecorder load, convert, full;
+    latencyRecorderInit(&load, "load");
+    latencyRecorderInit(&convert, "convert");
+    latencyRecorderInit(&full, "full frame");
+    LatencyHistogram* loadHist = latencyRecorderThread(&load);
+    LatencyHistogram* convertHist = latencyRecorderThread(&convert);
+    LatencyHistogram* fullHist = latencyRecorderThread(&full);
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+
+    if(loadHist == NULL || convertHist == NULL || fullHist == NULL || total == NULL){
+        printf("No memory allocated for the latency histograms\n");
+        free(total);
+        latencyRecorderFree(&load);
+        latencyRecorderFree(&convert);
+        latencyRecorderFree(&full);
+        cvReleaseCapture(&capture);
+        return -1;
+    }
+
+    int useTiles = opt->tileWidth > 0;
+    int nrecs = useTiles ? 3 : 2;
+    LatencyRecorder* recs[3] = { &load, &convert, &full };
+    LatencyReporter* reporter = NULL;
+    if(opt->reportSeconds > 0){
+        reporter = latencyReporterStart(recs, nrecs, opt->reportSeconds, stdout);
+    }
+
+#ifdef EXAMPLE05_HEADLESS
+    int display = 0;
+#else
+    int display = opt->display;
+#endif
+    Display* screen = NULL;
+
+    /** The gray image is created for the first frame and reused, because every frame
+    *   of a video has the same size */
+    IplImage* mygrayimg = NULL;
+    IplImage* scratch = NULL;                   /// full conversions to compare with
+    TileState tiles = {0};
+    long long dirty = 0;
+    int mismatches = 0;
+    int frames = 0;
+    uint64_t loopStart = latencyNow();
+
+    for(;;){
+        uint64_t start = latencyNow();
+        IplImage* frame = cvQueryFrame(capture);       /// owned by the capture, do not release
+        if(frame == NULL){
+            break;
+        }
+        latencyRecord(loadHist, latencyNow() - start);
+        traceSpan("cvQueryFrame", start);
+
+        if(mygrayimg == NULL){
+            mygrayimg = cvCreateImage(cvSize(frame->width, frame->height), frame->depth, 1);
+            if(mygrayimg == NULL){
+                printf("No memory allocated for mygrayimg\n");
+                break;
+            }
+            if(useTiles){
+                scratch = cvCreateImage(cvSize(frame->width, frame->height), frame->depth, 1);
+                if(scratch == NULL || tilesInit(&tiles, frame->width, frame->height,
+                                                opt->tileWidth, opt->tileHeight) != GRAY_OK){
+                    printf("No memory allocated for the tiles\n");
+                    break;
+                }
+            }
+        }
+
+        start = latencyNow();
+        int status;
+        if(useTiles){
+            status = tilesConvert(&tiles, (unsigned char*)frame->imageData, frame->widthStep,
+                                  (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep);
+            if(status >= 0){
+                dirty += status;
+                status = GRAY_OK;
+            }
+        }
+        else if(opt->linear){
+            status = grayConvertLinear((unsigned char*)frame->imageData, frame->widthStep,
+                                       (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep,
+                                       frame->width, frame->height);
+        }
+        else{
+            status = grayConverterConvert(&opt->converter,
+                                          (unsigned char*)frame->imageData, frame->widthStep,
+                                          (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep,
+                                          frame->width, frame->height);
+        }
+        latencyRecord(convertHist, latencyNow() - start);
+        traceSpan("convert", start);
+
+        if(useTiles && status == GRAY_OK && frames % VIDEO_BASELINE_EVERY == VIDEO_BASELINE_EVERY - 1 &&
+           convertBaseline(frame, scratch, mygrayimg, fullHist) != 0){
+            ++mismatches;
+        }
+
+        if(status != GRAY_OK){
+            printf("Frame %d not converted: %s\n", frames, grayStatusString(status));
+            break;
+        }
+        ++frames;
+        startupFirstPixel();
+
+        if(!display){
+            continue;
+        }
+
+        /** The display thread, and with it the window and the GUI toolkit, is started once
+        *   there is a frame to show, so opening the video is not delayed by it */
+        if(screen == NULL && (screen = displayStart()) == NULL){
+            printf("Could not start the display thread, frames are not shown\n");
+            display = 0;
+            continue;
+        }
+        start = traceClock();
+        displayPost(screen, "gray", mygrayimg);
+        traceSpan("post frame", start);
+        if((displayKey(screen) & 0xff) == 27){          /// Esc stops the video
+            break;
+        }
+    }
+
+    double seconds = (latencyNow() - loopStart) / 1e9;
+    DisplayStats shown;
+    displayStop(screen, &shown);
+    latencyReporterStop(reporter);
+
+    printf("%d frames from %s\n", frames, source);
+    printf("processing: %.1f frames/s", seconds > 0 ? frames / seconds : 0.0);
+    if(screen != NULL){
+        printf(", display: %.1f frames/s (%llu shown, %llu dropped)", shown.shown / seconds,
+               (unsigned long long)shown.shown, (unsigned long long)shown.dropped);
+    }
+    printf("\n");
+    int i;
+    for(i = 0; i < nrecs; ++i){
+        latencyRecorderSnapshot(recs[i], total);
+        latencyPrint(stdout, recs[i]->name, total);
+        latencyPrintBuckets(stdout, total);
+    }
+    if(useTiles && tiles.previous != NULL){
+        printTiles(&tiles, dirty, frames, mismatches, &convert, &full, total);
+    }
+
+    free(total);
+    latencyRecorderFree(&load);
+    latencyRecorderFree(&convert);
+    latencyRecorderFree(&full);
+    tilesFree(&tiles);
+    cvReleaseImage(&scratch);
+    cvReleaseImage(&mygrayimg);
+    cvReleaseCapture(&capture);
+    return 0;
+}
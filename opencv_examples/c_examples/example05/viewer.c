@@ -0,0 +1,441 @@
+/** Filename: viewer.c
+*
+*   Description: the pyramid viewer, see viewer.h.
+*
+*   A tile of level L covers the pixels of four tiles of level L - 1, one per quadrant, and
+*   is computed from them, computing them first if they have not been. Level 0 is read
+*   straight from the image, so the first view of the whole image reads every pixel once;
+*   later views only read tiles already computed. Tiles are kept until the viewer closes,
+*   which together costs at most a third of the image's size.
+*
+*   A view is drawn row by row into the canvas: at zoom levels of 0 or more each row is a
+*   few memcpy calls from the tiles it crosses, and when zoomed in past one image pixel
+*   per screen pixel each image pixel is repeated from level 0.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "latency.h"
+#include "trace.h"
+#include "viewer.h"
+
+#define VIEWER_MAX_LEVELS 32
+#define VIEWER_BACKGROUND 32            /// gray level outside the image
+#define VIEWER_WINDOW "viewer"
+#define VIEWER_POLL_MS 15
+
+
+typedef struct PyramidLevel{
+    int width;
+    int height;
+    int cols;                   /// tiles per row
+    int rows;
+    unsigned char** tiles;      /// NULL until computed; level 0 has none
+} PyramidLevel;
+
+typedef struct Pyramid{
+    const unsigned char* data;  /// level 0
+    int step;
+    int levels;
+    PyramidLevel level[VIEWER_MAX_LEVELS];
+    int computed;               /// tiles computed so far
+} Pyramid;
+
+typedef struct View{
+    Pyramid* pyramid;
+    int zoom;                   /// pyramid level shown, negative when zoomed in past it
+    int fitZoom;                /// the zoom that shows the whole image
+    double cx;                  /// level 0 pixel at the center of the canvas
+    double cy;
+    int canvasWidth;
+    int canvasHeight;
+    int changed;                /// the canvas must be drawn again
+    int dragging;
+    int dragX;
+    int dragY;
+} View;
+
+
+static int pyramidInit(Pyramid* p, const IplImage* gray, int fitWidth, int fitHeight){
+    memset(p, 0, sizeof(*p));
+    p->data = (const unsigned char*)gray->imageData;
+    p->step = gray->widthStep;
+
+    int width = gray->width, height = gray->height;
+    for(;;){
+        PyramidLevel* l = &p->level[p->levels];
+        l->width = width;
+        l->height = height;
+        l->cols = (width + VIEWER_TILE - 1) / VIEWER_TILE;
+        l->rows = (height + VIEWER_TILE - 1) / VIEWER_TILE;
+        if(p->levels > 0){
+            l->tiles = (unsigned char**)calloc((size_t)l->cols * l->rows, sizeof(unsigned char*));
+            if(l->tiles == NULL){
+                return -1;
+            }
+        }
+        ++p->levels;
+
+        /** Levels are added until one fits the canvas */
+        if((width <= fitWidth && height <= fitHeight) || p->levels == VIEWER_MAX_LEVELS){
+            return 0;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+}
+
+
+static void pyramidFree(Pyramid* p){
+    int i;
+    size_t t;
+    for(i = 1; i < p->levels; ++i){
+        PyramidLevel* l = &p->level[i];
+        if(l->tiles == NULL){
+            continue;
+        }
+        for(t = 0; t < (size_t)l->cols * l->rows; ++t){
+            free(l->tiles[t]);
+        }
+        free(l->tiles);
+    }
+    memset(p, 0, sizeof(*p));
+}
+
+
+/** Halve the w x h block at src into dst, each pixel the rounded mean of four. An odd
+*   last row or column is paired with itself. */
+static void downsample(const unsigned char* src, int srcStep, int w, int h, unsigned char* dst, int dstStep){
+    int outH = (h + 1) / 2;
+    int x, y;
+
+    for(y = 0; y < outH; ++y){
+        const unsigned char* r0 = src + (size_t)(2 * y) * srcStep;
+        const unsigned char* r1 = 2 * y + 1 < h ? r0 + srcStep : r0;
+        unsigned char* out = dst + (size_t)y * dstStep;
+
+        for(x = 0; x < w / 2; ++x){
+            out[x] = (unsigned char)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+        }
+        if(w & 1){
+            out[x] = (unsigned char)((2 * r0[2 * x] + 2 * r1[2 * x] + 2) >> 2);
+        }
+    }
+}
+
+
+static const unsigned char* pyramidTile(Pyramid* p, int level, int tx, int ty);
+
+
+/** Point at block (bx, by) of level: a tile, or a tile-sized block of the image */
+static const unsigned char* sourceBlock(Pyramid* p, int level, int bx, int by, int* step, int* w, int* h){
+    const PyramidLevel* l = &p->level[level];
+    int x0 = bx * VIEWER_TILE, y0 = by * VIEWER_TILE;
+
+    *w = l->width - x0 < VIEWER_TILE ? l->width - x0 : VIEWER_TILE;
+    *h = l->height - y0 < VIEWER_TILE ? l->height - y0 : VIEWER_TILE;
+    if(level == 0){
+        *step = p->step;
+        return p->data + (size_t)y0 * p->step + x0;
+    }
+    *step = VIEWER_TILE;
+    return pyramidTile(p, level, bx, by);
+}
+
+
+/** Return tile (tx, ty) of level 1 or above, computing it if needed; NULL if there was
+*   no memory */
+static const unsigned char* pyramidTile(Pyramid* p, int level, int tx, int ty){
+    PyramidLevel* l = &p->level[level];
+    unsigned char** slot = &l->tiles[(size_t)ty * l->cols + tx];
+    if(*slot != NULL){
+        return *slot;
+    }
+
+    unsigned char* tile = (unsigned char*)malloc((size_t)VIEWER_TILE * VIEWER_TILE);
+    if(tile == NULL){
+        return NULL;
+    }
+
+    const PyramidLevel* below = &p->level[level - 1];
+    int qx, qy;
+    for(qy = 0; qy < 2; ++qy){
+        for(qx = 0; qx < 2; ++qx){
+            int bx = 2 * tx + qx, by = 2 * ty + qy;
+            int step, w, h;
+            if(bx >= below->cols || by >= below->rows){
+                continue;
+            }
+            const unsigned char* src = sourceBlock(p, level - 1, bx, by, &step, &w, &h);
+            if(src == NULL){
+                free(tile);
+                return NULL;
+            }
+            downsample(src, step, w, h,
+                       tile + (size_t)qy * (VIEWER_TILE / 2) * VIEWER_TILE + qx * (VIEWER_TILE / 2),
+                       VIEWER_TILE);
+        }
+    }
+
+    ++p->computed;
+    *slot = tile;
+    return tile;
+}
+
+
+/** Copy n pixels of row y of level, starting at column x, all inside the level */
+static void copyLevelRow(Pyramid* p, int level, int x, int y, int n, unsigned char* out){
+    if(level == 0){
+        memcpy(out, p->data + (size_t)y * p->step + x, (size_t)n);
+        return;
+    }
+
+    while(n > 0){
+        int tx = x / VIEWER_TILE, ty = y / VIEWER_TILE;
+        int offset = x % VIEWER_TILE;
+        int count = VIEWER_TILE - offset < n ? VIEWER_TILE - offset : n;
+        const unsigned char* tile = pyramidTile(p, level, tx, ty);
+
+        if(tile != NULL){
+            memcpy(out, tile + (size_t)(y % VIEWER_TILE) * VIEWER_TILE + offset, (size_t)count);
+        }
+        else{
+            memset(out, VIEWER_BACKGROUND, (size_t)count);
+        }
+        out += count;
+        x += count;
+        n -= count;
+    }
+}
+
+
+/** Return the screen coordinate of level 0 coordinate c at zoom */
+static long toScreen(double c, int zoom){
+    long pixel = (long)c;
+    return zoom >= 0 ? pixel >> zoom : pixel << -zoom;
+}
+
+
+/** Draw the view into canvas */
+static void drawView(View* v, IplImage* canvas){
+    Pyramid* p = v->pyramid;
+    int level = v->zoom > 0 ? v->zoom : 0;
+    int magnify = v->zoom < 0 ? -v->zoom : 0;
+    const PyramidLevel* l = &p->level[level];
+    long vx = toScreen(v->cx, v->zoom) - canvas->width / 2;
+    long vy = toScreen(v->cy, v->zoom) - canvas->height / 2;
+    int x, y;
+
+    for(y = 0; y < canvas->height; ++y){
+        unsigned char* out = (unsigned char*)canvas->imageData + (size_t)y * canvas->widthStep;
+        long sy = vy + y;
+        long ly = sy >= 0 ? sy >> magnify : -1;
+
+        if(ly < 0 || ly >= l->height){
+            memset(out, VIEWER_BACKGROUND, (size_t)canvas->width);
+            continue;
+        }
+
+        if(magnify > 0){
+            const unsigned char* row = p->data + (size_t)ly * p->step;
+            for(x = 0; x < canvas->width; ++x){
+                long sx = vx + x;
+                long lx = sx >= 0 ? sx >> magnify : -1;
+                out[x] = lx >= 0 && lx < l->width ? row[lx] : VIEWER_BACKGROUND;
+            }
+            continue;
+        }
+
+        /** Background left and right of the image, level pixels in between */
+        long first = vx < 0 ? -vx : 0;
+        long last = l->width - vx < canvas->width ? l->width - vx : canvas->width;
+        if(first >= last){
+            memset(out, VIEWER_BACKGROUND, (size_t)canvas->width);
+            continue;
+        }
+        memset(out, VIEWER_BACKGROUND, (size_t)first);
+        copyLevelRow(p, level, (int)(vx + first), (int)ly, (int)(last - first), out + first);
+        memset(out + last, VIEWER_BACKGROUND, (size_t)(canvas->width - last));
+    }
+}
+
+
+static void zoomTo(View* v, int zoom){
+    int top = v->pyramid->levels - 1;
+    if(zoom > top) zoom = top;
+    if(zoom < -VIEWER_MAX_ZOOM_IN) zoom = -VIEWER_MAX_ZOOM_IN;
+    if(zoom != v->zoom){
+        v->zoom = zoom;
+        v->changed = 1;
+    }
+}
+
+
+/** Move the center by dx, dy screen pixels, keeping it inside the image */
+static void pan(View* v, double dx, double dy){
+    double pixels = v->zoom >= 0 ? (double)(1 << v->zoom) : 1.0 / (1 << -v->zoom);
+    const PyramidLevel* l0 = &v->pyramid->level[0];
+
+    v->cx += dx * pixels;
+    v->cy += dy * pixels;
+    if(v->cx < 0) v->cx = 0;
+    if(v->cy < 0) v->cy = 0;
+    if(v->cx > l0->width) v->cx = l0->width;
+    if(v->cy > l0->height) v->cy = l0->height;
+    v->changed = 1;
+}
+
+
+static void showAll(View* v){
+    v->zoom = v->fitZoom;
+    v->cx = v->pyramid->level[0].width / 2.0;
+    v->cy = v->pyramid->level[0].height / 2.0;
+    v->changed = 1;
+}
+
+
+#ifndef EXAMPLE05_HEADLESS
+
+static void onMouse(int event, int x, int y, int flags, void* param){
+    View* v = (View*)param;
+    (void)flags;
+
+    if(event == CV_EVENT_LBUTTONDOWN){
+        v->dragging = 1;
+    }
+    else if(event == CV_EVENT_LBUTTONUP){
+        v->dragging = 0;
+    }
+    else if(event == CV_EVENT_MOUSEMOVE && v->dragging){
+        pan(v, v->dragX - x, v->dragY - y);
+    }
+    v->dragX = x;
+    v->dragY = y;
+}
+
+
+/** Handle a key; returns 1 when the viewer should close */
+static int onKey(View* v, int key){
+    int stepX = v->canvasWidth / 4, stepY = v->canvasHeight / 4;
+
+    switch(key){
+        case 27: case 'q': return 1;
+        case '+': case '=': zoomTo(v, v->zoom - 1); break;
+        case '-': case '_': zoomTo(v, v->zoom + 1); break;
+        case '0': showAll(v); break;
+        case 'a': case 'h': pan(v, -stepX, 0); break;
+        case 'd': case 'l': pan(v, stepX, 0); break;
+        case 'w': case 'k': pan(v, 0, -stepY); break;
+        case 's': case 'j': pan(v, 0, stepY); break;
+        default: break;
+    }
+    return 0;
+}
+
+#endif
+
+
+/** Draw the view if it changed, recording the time in drawHist */
+static void redraw(View* v, IplImage* canvas, LatencyHistogram* drawHist){
+    uint64_t start = latencyNow();
+    drawView(v, canvas);
+    latencyRecord(drawHist, latencyNow() - start);
+    traceSpan("draw view", start);
+    v->changed = 0;
+}
+
+
+/** Without a window: zoom out, then in level by level to the closest zoom, panning a
+*   window width in each direction at every level */
+static void tour(View* v, IplImage* canvas, LatencyHistogram* drawHist){
+    static const int moves[4][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+    int zoom, i;
+
+    for(zoom = v->fitZoom; zoom >= -VIEWER_MAX_ZOOM_IN; --zoom){
+        zoomTo(v, zoom);
+        redraw(v, canvas, drawHist);
+        for(i = 0; i < 4; ++i){
+            pan(v, moves[i][0] * v->canvasWidth, moves[i][1] * v->canvasHeight);
+            redraw(v, canvas, drawHist);
+        }
+    }
+}
+
+
+int viewerRun(const IplImage* gray, int interactive){
+    Pyramid pyramid;
+    View view;
+
+    memset(&pyramid, 0, sizeof(pyramid));
+    memset(&view, 0, sizeof(view));
+    view.canvasWidth = gray->width < VIEWER_WIDTH ? gray->width : VIEWER_WIDTH;
+    view.canvasHeight = gray->height < VIEWER_HEIGHT ? gray->height : VIEWER_HEIGHT;
+    view.pyramid = &pyramid;
+
+    IplImage* canvas = cvCreateImage(cvSize(view.canvasWidth, view.canvasHeight), IPL_DEPTH_8U, 1);
+    LatencyRecorder draws;
+    latencyRecorderInit(&draws, "draw");
+    LatencyHistogram* drawHist = latencyRecorderThread(&draws);
+    LatencyHistogram* total = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+
+    if(canvas == NULL || drawHist == NULL || total == NULL ||
+       pyramidInit(&pyramid, gray, view.canvasWidth, view.canvasHeight) != 0){
+        printf("No memory allocated for the viewer\n");
+        pyramidFree(&pyramid);
+        cvReleaseImage(&canvas);
+        latencyRecorderFree(&draws);
+        free(total);
+        return -1;
+    }
+    view.fitZoom = pyramid.levels - 1;
+    showAll(&view);
+
+    /** The first view computes every tile above level 0, so it is timed on its own */
+    uint64_t start = latencyNow();
+    drawView(&view, canvas);
+    double firstMs = (latencyNow() - start) / 1e6;
+    traceSpan("draw first view", start);
+    view.changed = 0;
+
+#ifndef EXAMPLE05_HEADLESS
+    if(interactive){
+        cvNamedWindow(VIEWER_WINDOW, CV_WINDOW_AUTOSIZE);
+        cvSetMouseCallback(VIEWER_WINDOW, onMouse, &view);
+        cvShowImage(VIEWER_WINDOW, canvas);
+        for(;;){
+            int key = cvWaitKey(VIEWER_POLL_MS);
+            if(key >= 0 && onKey(&view, key & 0xff)){
+                break;
+            }
+            if(view.changed){
+                redraw(&view, canvas, drawHist);
+                cvShowImage(VIEWER_WINDOW, canvas);
+            }
+        }
+        cvDestroyWindow(VIEWER_WINDOW);
+    }
+    else{
+        tour(&view, canvas, drawHist);
+    }
+#else
+    /** No windows in the headless build */
+    (void)interactive;
+    tour(&view, canvas, drawHist);
+#endif
+
+    printf("viewer: %d x %d image, %d levels, %d x %d canvas, first view %.1f ms, %d tiles computed (%.1f MB)\n",
+           gray->width, gray->height, pyramid.levels, view.canvasWidth, view.canvasHeight, firstMs,
+           pyramid.computed, pyramid.computed * (double)VIEWER_TILE * VIEWER_TILE / 1048576.0);
+    latencyRecorderSnapshot(&draws, total);
+    latencyPrint(stdout, "draw", total);
+
+    free(total);
+    latencyRecorderFree(&draws);
+    pyramidFree(&pyramid);
+    cvReleaseImage(&canvas);
+    return 0;
+}
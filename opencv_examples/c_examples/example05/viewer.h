@@ -0,0 +1,35 @@
+/** Filename: viewer.h
+*
+*   Description: a zoom and pan viewer for gray images of any size.
+*
+*   cvShowImage copies the whole image into the window and scales it to the window on
+*   every repaint, which for a gigapixel image takes seconds and a second copy of the
+*   image. The viewer shows a window-sized canvas instead, drawn from a pyramid of the
+*   image: level 0 is the image itself and each level above it is half the width and
+*   height of the one below, every pixel the rounded mean of four. The pyramid is split
+*   into VIEWER_TILE x VIEWER_TILE tiles that are only computed the first time they are
+*   seen, so drawing a view costs about the same for any image size, and zooming in to
+*   a corner never computes the rest of the lower levels.
+*
+*   Keys: + and - zoom in and out by a factor of two (down to 8 screen pixels per image
+*   pixel), w a s d or h j k l pan by a quarter of the window, 0 shows the whole image,
+*   Esc or q closes the viewer. Dragging with the left mouse button pans.
+*/
+
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include <opencv/cv.h>
+
+#define VIEWER_TILE 256                 /// pixels on a side of a pyramid tile
+#define VIEWER_WIDTH 1280               /// largest canvas
+#define VIEWER_HEIGHT 800
+#define VIEWER_MAX_ZOOM_IN 3            /// 2^3 screen pixels per image pixel
+
+/** Show the 1 channel image gray in the viewer until it is closed. With interactive 0,
+*   no window is opened; a fixed tour of zooms and pans is drawn instead and the drawing
+*   times are printed, as it always is in the headless build. Returns 0, or -1 if there
+*   was no memory. */
+int viewerRun(const IplImage* gray, int interactive);
+
+#endif
@@ -0,0 +1,256 @@
+/** Filename: worker.c
+*
+*   Description: persistent worker mode of example05.
+*
+*   Starting example05 once per image pays for loading a dozen OpenCV shared libraries,
+*   initializing them and warming up the kernels on every image. A worker is started once
+*   and then reads one job after another from stdin, so those costs are paid once per
+*   worker. The buffers are kept between jobs and only grow when a larger image arrives.
+*
+*   Two job formats are read:
+*
+*   paths   one job per line: the input image file and the output image file, separated
+*           by a tab (or a space if the line has no tab). A line with only an input
+*           converts without writing. Each job gets one line on stdout:
+*               ok <job> <input> <milliseconds>
+*               error <job> <input> <reason>
+*
+*   raw     each job is a header line "<width> <height> <step>\n" followed by height * step
+*           bytes of BGR pixels, rows step bytes apart. The reply is one line
+*               ok <job> <width> <height> <milliseconds>
+*           followed by width * height gray bytes (no row padding), or one line
+*               error <job> <reason>
+*           with no pixels. After an error in the pixel data itself the stream cannot be
+*           resynchronized and the worker exits.
+*
+*   Status lines go to stdout and are flushed after every job; the latency summary goes
+*   to stderr when stdin is closed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "gray.h"
+#include "latency.h"
+#include "modes.h"
+#include "pnm.h"
+#include "startup.h"
+#include "trace.h"
+
+#define WORKER_LINE_MAX 8192
+
+
+/** Make sure *buffer holds at least size bytes, keeping it if it already does */
+static int reserve(unsigned char** buffer, size_t* capacity, size_t size){
+    if(size <= *capacity){
+        return 0;
+    }
+
+    unsigned char* p = (unsigned char*)realloc(*buffer, size);
+    if(p == NULL){
+        return -1;
+    }
+
+    *buffer = p;
+    *capacity = size;
+    return 0;
+}
+
+
+static void chomp(char* line){
+    size_t n = strlen(line);
+    while(n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')){
+        line[--n] = '\0';
+    }
+}
+
+
+static int runPathJobs(LatencyHistogram* jobHist){
+    char line[WORKER_LINE_MAX];
+    IplImage* mygrayimg = NULL;             /// reused while the image size stays the same
+    long job = 0;
+    int failed = 0;
+
+    while(fgets(line, sizeof(line), stdin) != NULL){
+        chomp(line);
+        if(line[0] == '\0'){
+            continue;
+        }
+        ++job;
+
+        char* input = line;
+        char* output = strchr(line, '\t');
+        if(output == NULL){
+            output = strchr(line, ' ');
+        }
+        if(output != NULL){
+            *output++ = '\0';
+        }
+
+        uint64_t start = latencyNow();
+        uint64_t spanStart = traceClock();
+        IplImage* colorimg = pnmLoadColor(input);
+        traceSpanFile("load", spanStart, input);
+
+        if(colorimg == NULL){
+            printf("error %ld %s not opened\n", job, input);
+            fflush(stdout);
+            ++failed;
+            continue;
+        }
+
+        if(mygrayimg != NULL && (mygrayimg->width != colorimg->width || mygrayimg->height != colorimg->height)){
+            cvReleaseImage(&mygrayimg);
+        }
+        if(mygrayimg == NULL){
+            mygrayimg = cvCreateImage(cvSize(colorimg->width, colorimg->height), colorimg->depth, 1);
+        }
+        if(mygrayimg == NULL){
+            printf("error %ld %s %s\n", job, input, grayStatusString(GRAY_ERR_NOMEM));
+            fflush(stdout);
+            cvReleaseImage(&colorimg);
+            ++failed;
+            continue;
+        }
+
+        spanStart = traceClock();
+        int status = grayConvert((unsigned char*)colorimg->imageData, colorimg->widthStep,
+                                 (unsigned char*)mygrayimg->imageData, mygrayimg->widthStep,
+                                 colorimg->width, colorimg->height);
+        traceSpanFile("convert", spanStart, input);
+        cvReleaseImage(&colorimg);
+
+        if(status != GRAY_OK){
+            printf("error %ld %s %s\n", job, input, grayStatusString(status));
+        }
+        else if(output != NULL && *output != '\0' && !pnmSaveGray(output, mygrayimg)){
+            printf("error %ld %s %s not written\n", job, input, output);
+            status = GRAY_ERR_NULL;
+        }
+        else{
+            uint64_t ns = latencyNow() - start;
+            latencyRecord(jobHist, ns);
+            startupFirstPixel();
+            printf("ok %ld %s %.3f\n", job, input, ns / 1e6);
+        }
+        fflush(stdout);
+
+        if(status != GRAY_OK){
+            ++failed;
+        }
+    }
+
+    cvReleaseImage(&mygrayimg);
+    return failed == 0 ? 0 : -1;
+}
+
+
+static int runRawJobs(LatencyHistogram* jobHist){
+    char line[256];
+    unsigned char* color = NULL;
+    unsigned char* gray = NULL;
+    size_t colorCapacity = 0, grayCapacity = 0;
+    long job = 0;
+    int failed = 0;
+
+    while(fgets(line, sizeof(line), stdin) != NULL){
+        int width, height, step;
+        ++job;
+
+        if(sscanf(line, "%d %d %d", &width, &height, &step) != 3){
+            printf("error %ld bad header\n", job);
+            fflush(stdout);
+            ++failed;
+            break;                          /// no length, so the stream is lost
+        }
+
+        uint64_t start = latencyNow();
+
+        /** The header is checked before the pixels are read so that a bad size does not
+        *   make us read gigabytes; gray is packed, so its step is the width */
+        int status = width > 0 && height > 0 && step > 0 && (size_t)step * height < ((size_t)1 << 40)
+                   ? GRAY_OK : GRAY_ERR_SIZE;
+        if(status == GRAY_OK && step < 3 * width){
+            status = GRAY_ERR_STEP;
+        }
+        if(status != GRAY_OK){
+            printf("error %ld %s\n", job, grayStatusString(status));
+            fflush(stdout);
+            ++failed;
+            break;
+        }
+
+        size_t colorBytes = (size_t)step * height;
+        size_t grayBytes = (size_t)width * height;
+        if(reserve(&color, &colorCapacity, colorBytes) != 0 || reserve(&gray, &grayCapacity, grayBytes) != 0){
+            printf("error %ld %s\n", job, grayStatusString(GRAY_ERR_NOMEM));
+            fflush(stdout);
+            ++failed;
+            break;
+        }
+
+        uint64_t spanStart = traceClock();
+        size_t got = fread(color, 1, colorBytes, stdin);
+        traceSpan("read frame", spanStart);
+        if(got != colorBytes){
+            printf("error %ld short frame, %zu of %zu bytes\n", job, got, colorBytes);
+            fflush(stdout);
+            ++failed;
+            break;
+        }
+
+        spanStart = traceClock();
+        status = grayConvert(color, step, gray, width, width, height);
+        traceSpan("convert", spanStart);
+
+        if(status != GRAY_OK){
+            printf("error %ld %s\n", job, grayStatusString(status));
+            fflush(stdout);
+            ++failed;
+            continue;                       /// the pixels were consumed, so we are still in step
+        }
+
+        uint64_t ns = latencyNow() - start;
+        latencyRecord(jobHist, ns);
+        startupFirstPixel();
+        printf("ok %ld %d %d %.3f\n", job, width, height, ns / 1e6);
+
+        spanStart = traceClock();
+        fwrite(gray, 1, grayBytes, stdout);
+        fflush(stdout);
+        traceSpan("write frame", spanStart);
+    }
+
+    free(color);
+    free(gray);
+    return failed == 0 ? 0 : -1;
+}
+
+
+int runWorker(const Options* opt, const char* format){
+    (void)opt;
+
+    int raw = strcmp(format, "raw") == 0;
+    if(!raw && strcmp(format, "paths") != 0){
+        printf("Unknown worker format %s, use paths or raw\n", format);
+        return -1;
+    }
+
+    LatencyHistogram* jobHist = (LatencyHistogram*)malloc(sizeof(LatencyHistogram));
+    if(jobHist == NULL){
+        return -1;
+    }
+    latencyReset(jobHist);
+
+    /** Pick the kernel now rather than during the first job */
+    grayKernelBest();
+
+    int status = raw ? runRawJobs(jobHist) : runPathJobs(jobHist);
+
+    latencyPrint(stderr, "job", jobHist);
+    free(jobHist);
+    return status;
+}